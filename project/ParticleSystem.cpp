@@ -1,12 +1,125 @@
 #include "ParticleSystem.h"
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <labhelper.h>
+#include "parallelFor.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLE_PACK_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace glm;
 
+namespace
+{
+///////////////////////////////////////////////////////////////////////////////
+// Float to half conversion with round to nearest even, including subnormals,
+// infinity and NaN (after Fabian Giesen's float_to_half_fast3_rtne)
+///////////////////////////////////////////////////////////////////////////////
+const uint32_t HalfOverflow = (127 + 16) << 23;       // this and above become infinity
+const uint32_t HalfMinNormal = (127 - 14) << 23;      // below this the half is subnormal
+const uint32_t HalfSubnormalMagic = (127 - 15 + 23 - 10 + 1) << 23;
+const uint32_t HalfNormalBias = 0xfffu - ((127 - 15) << 23); // rebias exponent, round mantissa
+
+uint16_t float_to_half(float value)
+{
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+	const uint32_t sign = f & 0x80000000u;
+	f ^= sign;
+
+	uint32_t half;
+	if (f >= HalfOverflow) {
+		half = f > 0x7f800000u ? 0x7e00 : 0x7c00;
+	}
+	else if (f < HalfMinNormal) {
+		// adding the magic number shifts the mantissa into place and rounds it
+		float magic, shifted;
+		memcpy(&magic, &HalfSubnormalMagic, sizeof(magic));
+		memcpy(&shifted, &f, sizeof(shifted));
+		shifted += magic;
+		memcpy(&half, &shifted, sizeof(half));
+		half -= HalfSubnormalMagic;
+	}
+	else {
+		const uint32_t mantissa_odd = (f >> 13) & 1;
+		half = (f + HalfNormalBias + mantissa_odd) >> 13;
+	}
+	return uint16_t(half | (sign >> 16));
+}
+
+#ifdef PARTICLE_PACK_SSE2
+/// Four lanes of float_to_half(), each result sign extended to 32 bits
+__m128i float_to_half_sse2(__m128 f)
+{
+	const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(int(0x80000000u)));
+	const __m128 sign = _mm_and_ps(f, sign_mask);
+	const __m128 absolute = _mm_xor_ps(f, sign);
+	const __m128i bits = _mm_castps_si128(absolute);
+
+	// infinity, or a quiet NaN
+	const __m128i is_nan = _mm_castps_si128(_mm_cmpunord_ps(absolute, absolute));
+	const __m128i special = _mm_or_si128(_mm_and_si128(is_nan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+	const __m128i is_regular = _mm_cmpgt_epi32(_mm_set1_epi32(int(HalfOverflow)), bits);
+
+	const __m128i magic = _mm_set1_epi32(int(HalfSubnormalMagic));
+	const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absolute, _mm_castsi128_ps(magic))), magic);
+	const __m128i is_subnormal = _mm_cmpgt_epi32(_mm_set1_epi32(int(HalfMinNormal)), bits);
+
+	// -1 where the half mantissa is odd, subtracting it rounds ties to even
+	const __m128i mantissa_odd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+	const __m128i normal =
+	    _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(bits, _mm_set1_epi32(int(HalfNormalBias))), mantissa_odd), 13);
+
+	const __m128i finite = _mm_or_si128(_mm_and_si128(is_subnormal, subnormal), _mm_andnot_si128(is_subnormal, normal));
+	const __m128i half = _mm_or_si128(_mm_and_si128(is_regular, finite), _mm_andnot_si128(is_regular, special));
+	return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
+/// xyz as half, w as unorm16, in 32 bit lanes sign extended from 16 bits for _mm_packs_epi32
+__m128i pack_particle_sse2(__m128 particle)
+{
+	const __m128i life_lane = _mm_set_epi32(-1, 0, 0, 0);
+	const __m128 clamped = _mm_min_ps(_mm_max_ps(particle, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	const __m128i life = _mm_cvtps_epi32(_mm_mul_ps(clamped, _mm_set1_ps(65535.0f)));
+	const __m128i lanes = _mm_or_si128(_mm_andnot_si128(life_lane, float_to_half_sse2(particle)),
+	                                   _mm_and_si128(life_lane, life));
+	return _mm_srai_epi32(_mm_slli_epi32(lanes, 16), 16);
+}
+#endif
+} // namespace
+
+void pack_particles(const glm::vec4* source, PackedParticle* destination, int count)
+{
+	int i = 0;
+#ifdef PARTICLE_PACK_SSE2
+	// two particles per 16 byte store
+	for (; i + 2 <= count; i += 2) {
+		const __m128i first = pack_particle_sse2(_mm_loadu_ps(&source[i].x));
+		const __m128i second = pack_particle_sse2(_mm_loadu_ps(&source[i + 1].x));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packs_epi32(first, second));
+	}
+#endif
+	for (; i < count; i++) {
+		destination[i].position[0] = float_to_half(source[i].x);
+		destination[i].position[1] = float_to_half(source[i].y);
+		destination[i].position[2] = float_to_half(source[i].z);
+		destination[i].life = uint16_t(std::nearbyint(clamp(source[i].w, 0.0f, 1.0f) * 65535.0f));
+	}
+}
+
+ParticleSimulation::ParticleSimulation(int capacity) : max_size(capacity)
+{
+}
+
 ParticleSystem::ParticleSystem(int capacity) : max_size(capacity)
 {
 	gl_data_temp_buffer.resize(max_size);
+	gl_packed_buffer.resize(max_size);
 }
 
 ParticleSystem::~ParticleSystem()//Destructor
@@ -15,80 +128,183 @@ ParticleSystem::~ParticleSystem()//Destructor
 
 void ParticleSystem::init_gpu_data()
 {
-	glGenVertexArrays(1, &gl_vao);
+	gl_vao = GlVertexArray("Particles", GL_RESOURCE_SITE);
 	glBindVertexArray(gl_vao);
 
-	glGenBuffers(1, &gl_buffer);
+	gl_buffer = GlBuffer("Particles", GL_RESOURCE_SITE);
 	glBindBuffer(GL_ARRAY_BUFFER, gl_buffer);
 	glBufferData(GL_ARRAY_BUFFER, max_size * sizeof(vec4), nullptr, GL_STATIC_DRAW);
+	gl_buffer.setSize(max_size * sizeof(vec4), "vec4 vertices");
 
-	glVertexAttribPointer(0, 4, GL_FLOAT, false, 0, 0);
+	// position and life are separate attributes so both layouts feed the same shader
+	glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(vec4), 0);
 	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 1, GL_FLOAT, false, sizeof(vec4), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+
+	gl_packed_vao = GlVertexArray("Particles", GL_RESOURCE_SITE);
+	glBindVertexArray(gl_packed_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, gl_buffer);
+	glVertexAttribPointer(0, 3, GL_HALF_FLOAT, false, sizeof(PackedParticle), 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 1, GL_UNSIGNED_SHORT, true, sizeof(PackedParticle),
+	                      (void*)offsetof(PackedParticle, life));
+	glEnableVertexAttribArray(1);
+}
+
+void ParticleSystem::destroy_gpu_data()
+{
+	gl_packed_vao.reset();
+	gl_vao.reset();
+	gl_buffer.reset();
 }
 //process particles
-void ParticleSystem::process_particles(float dt)
+void ParticleSimulation::process_particles(const std::vector<Particle>& source, float dt,
+                                           std::vector<Particle>& destination)
 {
-	for (Particle& particle : particles) {
-
-		particle.pos += particle.velocity * dt; // update position 
-		particle.lifetime += dt;   //update lifetime
-		//std::cout << "Particle Life: " << particle.lifetime << std::endl;
-		//// adjust transparency (alpha)
-		//particle.alpha = 1.0f - (particle.lifetime / particle.life_length);
+	typedef std::chrono::high_resolution_clock Clock;
 
-		//if (particle.lifetime > particle.life_length) {
-		//	particle.alpha = 0.0f;
-		//}
+	// Repulsion from neighbours, using the positions from before this step
+	last_grid_build_ms = last_grid_query_ms = 0.0f;
+	if (repulsion_radius > 0.0f && !source.empty()) {
+		Clock::time_point start = Clock::now();
+		neighbour_grid.setCellSize(repulsion_radius);
+		neighbour_grid.build(&source[0].pos, source.size(), sizeof(Particle));
+		last_grid_build_ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
 
+		start = Clock::now();
+		velocity_delta.resize(source.size());
+		parallelFor(source.size(), 4096, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				const vec3 p = source[i].pos;
+				vec3 push(0.0f);
+				neighbour_grid.forEachNeighbour(p, repulsion_radius, [&](uint32_t j) {
+					const vec3 d = p - source[j].pos;
+					const float distance = length(d);
+					// skips the particle itself and exact duplicates, which have no direction to push in
+					if (distance > 1e-5f) {
+						push += d * ((1.0f - distance / repulsion_radius) / distance);
+					}
+				});
+				velocity_delta[i] = push * (repulsion_strength * dt);
+			}
+		});
+		last_grid_query_ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
 	}
+
+	// the particles spawned since the last step go after the existing ones, and start moving now
+	const size_t count = source.size();
+	destination.resize(count + spawned.size());
+	std::copy(spawned.begin(), spawned.end(), destination.begin() + count);
+	spawned.clear();
+
+	parallelFor(destination.size(), 8192, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			Particle particle = i < count ? source[i] : destination[i];
+			if (repulsion_radius > 0.0f && i < count) {
+				particle.velocity += velocity_delta[i];
+			}
+
+			const vec3 next = particle.pos + particle.velocity * dt;
+			float t;
+			vec3 normal;
+			if (collider != nullptr && collider->intersect(particle.pos, next, t, normal)) {
+				// bounce, losing part of the speed along the normal, and stay just above the surface
+				particle.pos += (next - particle.pos) * t + normal * 0.01f;
+				particle.velocity -= normal * ((1.0f + restitution) * dot(particle.velocity, normal));
+			}
+			else {
+				particle.pos = next; // update position
+			}
+			particle.lifetime += dt;   //update lifetime
+			destination[i] = particle;
+		}
+	});
 	// Kill dead particles
 	// particles is a vector < structure of particles>
 	// particles.size() visit and check all members of particles
-	for (unsigned i = 0; i < particles.size(); ++i) {
+	for (unsigned i = 0; i < destination.size(); ++i) {
 		
-		if (particles[i].lifetime > particles[i].life_length)
+		if (destination[i].lifetime > destination[i].life_length)
 		{
 			//particles[i].alpha = 0;
-				kill(i);
+				kill(destination, i);
 		}
 	}
+	alive = destination.size();
 }
 
-void ParticleSystem::submit_to_gpu(const glm::mat4& viewMat)
+int ParticleSystem::prepare_gpu_data(const std::vector<Particle>& source, const glm::mat4& viewMat, float time_offset,
+                                     bool sort, ParticleVertexFormat format)
 {
-	unsigned int num_active_particles = particles.size();
+	unsigned int num_active_particles = source.size();
 
 	//firstly bind all particles into buffer, then submit buffer to GPU
 	gl_data_temp_buffer.clear();
-	for (const Particle& particle : particles) {
-		const glm::vec3 pos = glm::vec3(viewMat * glm::vec4(particle.pos, 1.0));// translate from World Coordinate  into View Coordinate
+	for (const Particle& particle : source) {
+		// extrapolate from the simulation tick to the render time
+		const glm::vec3 world_pos = particle.pos + particle.velocity * time_offset;
+		const glm::vec3 pos = glm::vec3(viewMat * glm::vec4(world_pos, 1.0));// translate from World Coordinate  into View Coordinate
 
 		//vec4 pos = viewMat * vec4(particle.pos, 1.0f); // translate from World Coordinate  into View Coordinate
 		//wrong version 
 		//gl_data_temp_buffer.push_back(pos);
 		// now do clamp to normalize
-		vec4 tmp = glm::vec4(pos, glm::clamp(particle.lifetime / particle.life_length, 0.f, 1.f));
+		vec4 tmp = glm::vec4(pos, glm::clamp((particle.lifetime + time_offset) / particle.life_length, 0.f, 1.f));
 		gl_data_temp_buffer.push_back(tmp);
 	}
 
 	// sort particles by z-value/depth, ensuring rendered in the correct order, from nearest to farest
-	std::sort(gl_data_temp_buffer.begin(), std::next(gl_data_temp_buffer.begin(), num_active_particles),
-		[](const vec4& lhs, const vec4& rhs) { return lhs.z < rhs.z; });
+	if (sort) {
+		std::sort(gl_data_temp_buffer.begin(), std::next(gl_data_temp_buffer.begin(), num_active_particles),
+			[](const vec4& lhs, const vec4& rhs) { return lhs.z < rhs.z; });
+	}
 
-	glBindVertexArray(gl_vao);
+	// pack after sorting, the sort needs the float depth
+	prepared_format = format;
+	last_pack_ms = 0.0f;
+	if (format == ParticlePacked) {
+		const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		pack_particles(gl_data_temp_buffer.data(), gl_packed_buffer.data(), num_active_particles);
+		last_pack_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start)
+		                   .count();
+	}
+	return num_active_particles;
+}
+
+const void* ParticleSystem::gpu_data() const
+{
+	if (prepared_format == ParticlePacked) {
+		return gl_packed_buffer.data();
+	}
+	return gl_data_temp_buffer.data();
+}
+
+size_t ParticleSystem::vertex_size(ParticleVertexFormat format)
+{
+	return format == ParticlePacked ? sizeof(PackedParticle) : sizeof(vec4);
+}
+
+void ParticleSystem::submit_to_gpu(const void* data, int count, ParticleVertexFormat format)
+{
+	glBindVertexArray(format == ParticlePacked ? gl_packed_vao : gl_vao);
 	glBindBuffer(GL_ARRAY_BUFFER, gl_buffer);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec4) * num_active_particles, gl_data_temp_buffer.data());//submit datra
+	const int bytes = int(vertex_size(format) * count);
+	const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data);//submit datra
+	last_upload_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	last_upload_bytes = bytes;
 
-	glDrawArrays(GL_POINTS, 0, num_active_particles);// rendering particles by using OpenGL draw commands
+	glDrawArrays(GL_POINTS, 0, count);// rendering particles by using OpenGL draw commands
 }
 // if number of particles <maximum , add new particle
-void ParticleSystem::spawn(Particle particle) {
-	if (particles.size() < max_size) {
-		particles.push_back(particle);
+void ParticleSimulation::spawn(Particle particle) {
+	if (alive + spawned.size() < size_t(max_size)) {
+		spawned.push_back(particle);
 	}
 };
 // delete the paricles
-void ParticleSystem::kill(int id) {
+void ParticleSimulation::kill(std::vector<Particle>& particles, int id) {
 	std::swap(particles[id], particles[particles.size() - 1]);
 	particles.pop_back();
 };
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <GL/glew.h>
+#include <atomic>
+#include <cstdint>
 #include <vector>
 #include <glm/detail/type_vec3.hpp>
 #include <glm/mat4x4.hpp>
+#include "glResource.h"
+#include "spatialGrid.h"
 
 struct Particle
 {
@@ -14,6 +18,80 @@ struct Particle
 	//xyzw
 };
 
+/// Layout of the per particle vertex data uploaded each frame
+enum ParticleVertexFormat
+{
+	ParticleFloat4 = 0, // view space xyz and normalized life as floats, 16 bytes
+	ParticlePacked      // view space xyz as half floats and life as unorm16, 8 bytes
+};
+
+struct PackedParticle
+{
+	uint16_t position[3]; // half floats
+	uint16_t life;        // normalized to 0..65535
+};
+static_assert(sizeof(PackedParticle) == 8, "PackedParticle must be tightly packed");
+
+/// Converts `count` vertices from the float layout, xyz to half and w to unorm16
+void pack_particles(const glm::vec4* source, PackedParticle* destination, int count);
+
+///////////////////////////////////////////////////////////////////////////////
+// Particle state on the simulation thread. A step reads the particles of the
+// previous tick and writes the next ones to another vector, so the simulation
+// can step straight into the slot it publishes instead of copying its own
+// state there every tick.
+///////////////////////////////////////////////////////////////////////////////
+class ParticleSimulation
+{
+public:
+	/// Keeps at most `capacity` particles alive
+	explicit ParticleSimulation(int capacity);
+
+	/// Queues a new particle for the next process_particles(), if there will be room for it
+	void spawn(Particle particle);
+
+	/// Writes the particles of `source` and the ones spawned since the last call to `destination`,
+	/// moved along their speed and aged by `dt`, and drops any that are past their life_length.
+	/// Particles bounce off the collider and, with a repulsion radius set, push away from their
+	/// neighbours in `source`. `source` and `destination` must be different vectors.
+	void process_particles(const std::vector<Particle>& source, float dt, std::vector<Particle>& destination);
+
+	/// Static geometry the particles bounce off, or nullptr. Must outlive its use.
+	void set_collider(const TriangleGrid* grid) { collider = grid; }
+	/// Neighbours closer than `radius` push each other apart, 0 turns it off
+	void set_repulsion(float radius, float strength)
+	{
+		repulsion_radius = radius;
+		repulsion_strength = strength;
+	}
+
+	/// Time spent in the last process_particles() rebuilding the neighbour grid and querying it
+	float grid_build_ms() const { return last_grid_build_ms; }
+	float grid_query_ms() const { return last_grid_query_ms; }
+
+private:
+	/// Deletes a particle at position `id` by swapping it with the last
+	/// particle in the array and reducing the size by 1.
+	/// (Care with indexes, as this can change the particle an index refers to)
+	static void kill(std::vector<Particle>& particles, int id);
+
+	int max_size;
+	size_t alive = 0; // particles written by the last process_particles()
+	std::vector<Particle> spawned;
+
+	const TriangleGrid* collider = nullptr;
+	float restitution = 0.4f;
+	float repulsion_radius = 0.0f;
+	float repulsion_strength = 0.0f;
+	SpatialHashGrid neighbour_grid;
+	std::vector<glm::vec3> velocity_delta;
+	float last_grid_build_ms = 0.0f;
+	float last_grid_query_ms = 0.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Vertex data and GL buffers the particles are drawn from, on the render side.
+///////////////////////////////////////////////////////////////////////////////
 class ParticleSystem
 {
 public:
@@ -24,28 +102,38 @@ public:
 	~ParticleSystem();
 
 	void init_gpu_data();
+	/// Deletes the vertex buffer and arrays, the destructor does too if the context is still current
+	void destroy_gpu_data();
 
-	/// Creates a new particle if there less than `max_size` elements in the particles array buffer
-	void spawn(Particle particle);
+	/// Fills the vertex data for the given particles, moved `time_offset` seconds along their
+	/// velocity and, if `sort` is set, sorted by depth. Returns the number of vertices in gpu_data().
+	/// Only touches cpu memory, so it can run on another thread than the GL context.
+	int prepare_gpu_data(const std::vector<Particle>& source, const glm::mat4& viewMat, float time_offset,
+	                     bool sort = true, ParticleVertexFormat format = ParticleFloat4);
+	/// Vertices of the last prepare_gpu_data(), in the format it was asked for
+	const void* gpu_data() const;
+	static size_t vertex_size(ParticleVertexFormat format);
 
-	/// Updates all the particles' positions depending on their speed, their lifetimes, and kills any
-	/// that are past their life_length
-	void process_particles(float dt);
+	/// Updates the vertex buffer with `count` prepared vertices, and renders them
+	void submit_to_gpu(const void* data, int count, ParticleVertexFormat format);
 
-	/// Updates the vertex buffer with the current particle properties, and renders them
-	void submit_to_gpu(const glm::mat4& viewMat);
+	/// Time spent packing in the last prepare_gpu_data(), 0 for the float layout
+	float pack_ms() const { return last_pack_ms; }
+	/// Time the last glBufferSubData call took on the GL thread, and its size
+	float upload_ms() const { return last_upload_ms; }
+	int upload_bytes() const { return last_upload_bytes; }
 
 private:
-	/// Deletes a particle at position `id` by swapping it with the last
-	/// particle in the array and reducing the size by 1.
-	/// (Care with indexes, as this can change the particle an index refers to)
-	void kill(int id);
-
-	// Members
-	std::vector<Particle> particles;
 	int max_size;
 
-	GLuint gl_vao = 0;
-	GLuint gl_buffer = 0;
+	GlVertexArray gl_vao;
+	GlVertexArray gl_packed_vao; // same buffer, read as PackedParticle
+	GlBuffer gl_buffer;
 	std::vector<glm::vec4> gl_data_temp_buffer;
+	std::vector<PackedParticle> gl_packed_buffer;
+	ParticleVertexFormat prepared_format = ParticleFloat4;
+	float last_pack_ms = 0.0f;
+	// written on the GL thread, shown on the main thread
+	std::atomic<float> last_upload_ms{ 0.0f };
+	std::atomic<int> last_upload_bytes{ 0 };
 };
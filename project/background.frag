@@ -4,12 +4,11 @@
 precision highp float;
 
 layout(location = 0) out vec4 fragmentColor;
-layout(binding = 6) uniform sampler2D environmentMap;
+layout(binding = 6) uniform samplerCube environmentMap;
 in vec2 texCoord;
 uniform mat4 inv_PV;
 uniform vec3 camera_pos;
 uniform float environment_multiplier;
-#define PI 3.14159265359
 
 void main()
 {
@@ -18,12 +17,6 @@ void main()
 	pixel_world_pos = (1.0 / pixel_world_pos.w) * pixel_world_pos;
 	// Calculate the world-space direction from the camera to that position
 	vec3 dir = normalize(pixel_world_pos.xyz - camera_pos);
-	// Calculate the spherical coordinates of the direction
-	float theta = acos(max(-1.0f, min(1.0f, dir.y)));
-	float phi = atan(dir.z, dir.x);
-	if(phi < 0.0f)
-		phi = phi + 2.0f * PI;
-	// Use these to lookup the color in the environment map
-	vec2 lookup = vec2(phi / (2.0 * PI), 1 - theta / PI);
-	fragmentColor = environment_multiplier * texture(environmentMap, lookup);
+	// The cubemap is looked up by direction directly
+	fragmentColor = environment_multiplier * texture(environmentMap, dir);
 }
@@ -0,0 +1,304 @@
+#include "benchScript.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace glm;
+
+namespace
+{
+const struct
+{
+	const char* name;
+	uint32_t bit;
+} shipControlNames[] = { { "forward", ShipForward }, { "backward", ShipBackward }, { "left", ShipTurnLeft },
+	                     { "right", ShipTurnRight }, { "up", ShipUp },             { "down", ShipDown } };
+
+bool parseShipControls(const std::string& text, uint32_t& controls)
+{
+	controls = 0;
+	if(text == "none")
+	{
+		return true;
+	}
+	std::istringstream names(text);
+	std::string name;
+	while(std::getline(names, name, '+'))
+	{
+		bool found = false;
+		for(const auto& control : shipControlNames)
+		{
+			if(name == control.name)
+			{
+				controls |= control.bit;
+				found = true;
+			}
+		}
+		if(!found)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string shipControlsToString(uint32_t controls)
+{
+	std::string text;
+	for(const auto& control : shipControlNames)
+	{
+		if(controls & control.bit)
+		{
+			text += (text.empty() ? "" : "+") + std::string(control.name);
+		}
+	}
+	return text.empty() ? "none" : text;
+}
+
+struct ByFrame
+{
+	template <typename T>
+	bool operator()(const T& a, const T& b) const
+	{
+		return a.frame < b.frame;
+	}
+};
+} // namespace
+
+bool BenchScript::load(const std::string& filename, BenchScript& script)
+{
+	std::ifstream file(filename);
+	if(!file)
+	{
+		std::cout << "Failed to open benchmark script " << filename << std::endl;
+		return false;
+	}
+
+	script = BenchScript();
+	std::string line;
+	int lineNumber = 0;
+	while(std::getline(file, line))
+	{
+		lineNumber++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream in(line);
+		std::string keyword;
+		if(!(in >> keyword))
+		{
+			continue;
+		}
+
+		bool ok = true;
+		if(keyword == "frames")
+		{
+			ok = bool(in >> script.frames);
+		}
+		else if(keyword == "timestep")
+		{
+			ok = bool(in >> script.timestep) && script.timestep > 0.0f;
+		}
+		else if(keyword == "size")
+		{
+			ok = bool(in >> script.width >> script.height) && script.width > 0 && script.height > 0;
+		}
+		else if(keyword == "camera")
+		{
+			CameraKey key;
+			ok = bool(in >> key.frame >> key.position.x >> key.position.y >> key.position.z >> key.direction.x
+			          >> key.direction.y >> key.direction.z);
+			key.direction = normalize(key.direction);
+			script.camera.push_back(key);
+		}
+		else if(keyword == "ship")
+		{
+			InputEvent event;
+			std::string controls;
+			event.command = { SimCommand::SetShipControls, 0, 0.0f };
+			ok = bool(in >> event.frame >> controls) && parseShipControls(controls, event.command.controls);
+			script.events.push_back(event);
+		}
+		else if(keyword == "light")
+		{
+			InputEvent event;
+			std::string what;
+			ok = bool(in >> event.frame >> what >> event.command.value);
+			event.command.controls = 0;
+			if(what == "animate")
+			{
+				event.command.type = SimCommand::SetAnimateLight;
+			}
+			else if(what == "azimuth")
+			{
+				event.command.type = SimCommand::SetLightAzimuth;
+			}
+			else
+			{
+				ok = false;
+			}
+			script.events.push_back(event);
+		}
+		else if(keyword == "particles")
+		{
+			InputEvent event;
+			event.command = { SimCommand::SetParticlesPerTick, 0, 0.0f };
+			ok = bool(in >> event.frame >> event.command.value);
+			script.events.push_back(event);
+		}
+		else if(keyword == "collision" || keyword == "repulsion")
+		{
+			InputEvent event;
+			event.command = { keyword == "collision" ? SimCommand::SetParticleCollision : SimCommand::SetParticleRepulsion,
+				              0, 0.0f };
+			ok = bool(in >> event.frame >> event.command.value);
+			script.events.push_back(event);
+		}
+		else if(keyword == "hash")
+		{
+			HashCheck check;
+			std::string expected;
+			ok = bool(in >> check.frame);
+			check.hasExpected = bool(in >> expected);
+			check.expected = 0;
+			if(check.hasExpected)
+			{
+				char* end = nullptr;
+				check.expected = strtoull(expected.c_str(), &end, 16);
+				ok = ok && *end == '\0';
+			}
+			script.hashes.push_back(check);
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if(!ok)
+		{
+			std::cout << filename << ":" << lineNumber << ": could not parse '" << line << "'" << std::endl;
+			return false;
+		}
+	}
+
+	// stable, so events on the same frame keep their order
+	std::stable_sort(script.camera.begin(), script.camera.end(), ByFrame());
+	std::stable_sort(script.events.begin(), script.events.end(), ByFrame());
+	std::stable_sort(script.hashes.begin(), script.hashes.end(), ByFrame());
+	return true;
+}
+
+bool BenchScript::save(const std::string& filename) const
+{
+	std::ofstream file(filename);
+	if(!file)
+	{
+		std::cout << "Failed to write benchmark script " << filename << std::endl;
+		return false;
+	}
+
+	file << "# Recorded benchmark script, replay with --bench " << filename << "\n";
+	file << "frames " << frames << "\n";
+	file << "timestep " << timestep << "\n";
+	file << "size " << width << " " << height << "\n";
+	char line[256];
+	for(const CameraKey& key : camera)
+	{
+		snprintf(line, sizeof(line), "camera %d %.4f %.4f %.4f %.5f %.5f %.5f\n", key.frame, key.position.x,
+		         key.position.y, key.position.z, key.direction.x, key.direction.y, key.direction.z);
+		file << line;
+	}
+	for(const InputEvent& event : events)
+	{
+		switch(event.command.type)
+		{
+		case SimCommand::SetShipControls:
+			file << "ship " << event.frame << " " << shipControlsToString(event.command.controls) << "\n";
+			break;
+		case SimCommand::SetAnimateLight:
+			file << "light " << event.frame << " animate " << event.command.value << "\n";
+			break;
+		case SimCommand::SetLightAzimuth:
+			file << "light " << event.frame << " azimuth " << event.command.value << "\n";
+			break;
+		case SimCommand::SetParticlesPerTick:
+			file << "particles " << event.frame << " " << event.command.value << "\n";
+			break;
+		case SimCommand::SetParticleCollision:
+			file << "collision " << event.frame << " " << event.command.value << "\n";
+			break;
+		case SimCommand::SetParticleRepulsion:
+			file << "repulsion " << event.frame << " " << event.command.value << "\n";
+			break;
+		}
+	}
+	for(const HashCheck& check : hashes)
+	{
+		snprintf(line, sizeof(line), "hash %d", check.frame);
+		file << line;
+		if(check.hasExpected)
+		{
+			snprintf(line, sizeof(line), " %016llx", (unsigned long long)check.expected);
+			file << line;
+		}
+		file << "\n";
+	}
+	std::cout << "Wrote benchmark script " << filename << std::endl;
+	return true;
+}
+
+void BenchScript::cameraAt(int frame, vec3& position, vec3& direction) const
+{
+	if(camera.empty())
+	{
+		return;
+	}
+	// first key after `frame`
+	auto next = std::upper_bound(camera.begin(), camera.end(), frame,
+	                             [](int f, const CameraKey& key) { return f < key.frame; });
+	if(next == camera.begin() || next == camera.end())
+	{
+		const CameraKey& key = next == camera.end() ? camera.back() : camera.front();
+		position = key.position;
+		direction = key.direction;
+		return;
+	}
+	const CameraKey& a = *(next - 1);
+	const CameraKey& b = *next;
+	const float t = float(frame - a.frame) / float(b.frame - a.frame);
+	position = mix(a.position, b.position, t);
+	direction = normalize(mix(a.direction, b.direction, t));
+}
+
+void BenchScript::recordCamera(int frame, const vec3& position, const vec3& direction)
+{
+	frames = std::max(frames, frame + 1);
+	if(m_lastSeen.frame >= 0 && position == m_lastSeen.position && direction == m_lastSeen.direction)
+	{
+		m_lastSeen.frame = frame;
+		return;
+	}
+
+	// Moving again after standing still, pin the old pose so the interpolation starts here
+	if(!camera.empty() && camera.back().frame < m_lastSeen.frame)
+	{
+		camera.push_back(m_lastSeen);
+	}
+	const CameraKey key = { frame, position, direction };
+	if(!camera.empty() && camera.back().frame == frame)
+	{
+		camera.back() = key;
+	}
+	else
+	{
+		camera.push_back(key);
+	}
+	m_lastSeen = key;
+}
+
+void BenchScript::recordInput(int frame, const SimCommand& command)
+{
+	events.push_back({ frame, command });
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "simulation.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Camera path and input for a benchmark run, in frames of a fixed timestep.
+// The text format has one entry per line, '#' starts a comment:
+//
+//   frames 600
+//   timestep 0.0166667
+//   size 1280 720
+//   camera <frame> <px> <py> <pz> <dx> <dy> <dz>
+//   ship <frame> forward+left|none     (forward backward left right up down)
+//   light <frame> animate 0|1
+//   light <frame> azimuth <degrees>
+//   particles <frame> <spawned per tick>
+//   collision <frame> 0|1
+//   repulsion <frame> <radius, 0 is off>
+//   hash <frame> [expected hash in hex]
+//
+// The camera is interpolated linearly between keys and held after the last.
+///////////////////////////////////////////////////////////////////////////////
+struct BenchScript
+{
+	struct CameraKey
+	{
+		int frame;
+		glm::vec3 position;
+		glm::vec3 direction;
+	};
+
+	struct InputEvent
+	{
+		int frame;
+		SimCommand command;
+	};
+
+	struct HashCheck
+	{
+		int frame;
+		bool hasExpected;
+		uint64_t expected;
+	};
+
+	int frames = 600;
+	float timestep = 1.0f / 60.0f;
+	int width = 1280;
+	int height = 720;
+	std::vector<CameraKey> camera;
+	std::vector<InputEvent> events;
+	std::vector<HashCheck> hashes;
+
+	static bool load(const std::string& filename, BenchScript& script);
+	bool save(const std::string& filename) const;
+
+	/// Sets `position` and `direction` for `frame`, leaves them alone if there are no keys
+	void cameraAt(int frame, glm::vec3& position, glm::vec3& direction) const;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Recording from interactive input
+	///////////////////////////////////////////////////////////////////////////
+
+	/// Adds a camera key for every frame the pose changed, and one for the last
+	/// frame it stood still before moving again; still frames add none
+	void recordCamera(int frame, const glm::vec3& position, const glm::vec3& direction);
+	void recordInput(int frame, const SimCommand& command);
+
+private:
+	CameraKey m_lastSeen = { -1, glm::vec3(0.0f), glm::vec3(0.0f) };
+};
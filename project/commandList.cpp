@@ -0,0 +1,74 @@
+#include "commandList.h"
+
+#include <algorithm>
+#include <cstdint>
+
+CommandList::CommandList(size_t blockSize)
+    : m_currentBlock(0), m_blockUsed(0), m_recordedBytes(0), m_numCommands(0), m_first(nullptr), m_last(nullptr)
+{
+	m_blocks.push_back({ std::unique_ptr<char[]>(new char[blockSize]), blockSize });
+}
+
+CommandList::~CommandList()
+{
+	reset();
+}
+
+void* CommandList::allocate(size_t size, size_t alignment)
+{
+	for(;;)
+	{
+		Block& block = m_blocks[m_currentBlock];
+		const uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+		const uintptr_t aligned = (base + m_blockUsed + alignment - 1) & ~uintptr_t(alignment - 1);
+		const size_t end = size_t(aligned - base) + size;
+		if(end <= block.size)
+		{
+			m_recordedBytes += end - m_blockUsed;
+			m_blockUsed = end;
+			return reinterpret_cast<void*>(aligned);
+		}
+
+		// Spill into the next block, growing if nothing big enough is left
+		m_currentBlock++;
+		m_blockUsed = 0;
+		if(m_currentBlock == m_blocks.size())
+		{
+			const size_t blockSize = std::max(m_blocks.back().size, size + alignment);
+			m_blocks.push_back({ std::unique_ptr<char[]>(new char[blockSize]), blockSize });
+		}
+	}
+}
+
+void CommandList::replay()
+{
+	for(Command* c = m_first; c != nullptr; c = c->next)
+	{
+		c->execute(c->object);
+	}
+}
+
+void CommandList::reset()
+{
+	for(Command* c = m_first; c != nullptr; c = c->next)
+	{
+		c->destroy(c->object);
+	}
+	m_first = m_last = nullptr;
+
+	// If the frame spilled over, replace the blocks by one that fits it all
+	if(m_currentBlock > 0)
+	{
+		size_t total = 0;
+		for(const Block& block : m_blocks)
+		{
+			total += block.size;
+		}
+		m_blocks.clear();
+		m_blocks.push_back({ std::unique_ptr<char[]>(new char[total]), total });
+	}
+	m_currentBlock = 0;
+	m_blockUsed = 0;
+	m_recordedBytes = 0;
+	m_numCommands = 0;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// A frame of deferred work. Commands are callables recorded on one thread and
+// replayed in order on another. The callables and any data copied with copy()
+// live in a linear arena that is rewound by reset(), so after the first few
+// frames recording does not touch the heap.
+///////////////////////////////////////////////////////////////////////////////
+class CommandList
+{
+public:
+	explicit CommandList(size_t blockSize = 1 << 20);
+	~CommandList();
+
+	CommandList(const CommandList&) = delete;
+	CommandList& operator=(const CommandList&) = delete;
+
+	/// Records `command` to be called by replay(). Captures are moved into the list,
+	/// so they must not refer to anything that changes before the replay.
+	template <typename F>
+	void record(F command)
+	{
+		typedef typename std::decay<F>::type Callable;
+		Command* c = new(allocate(sizeof(Command), alignof(Command))) Command;
+		c->object = new(allocate(sizeof(Callable), alignof(Callable))) Callable(std::move(command));
+		c->execute = [](void* object) { (*static_cast<Callable*>(object))(); };
+		c->destroy = [](void* object) { static_cast<Callable*>(object)->~Callable(); };
+		c->next = nullptr;
+		if(m_last)
+		{
+			m_last->next = c;
+		}
+		else
+		{
+			m_first = c;
+		}
+		m_last = c;
+		m_numCommands++;
+	}
+
+	/// Copies `count` elements into the list. The copy stays valid until reset().
+	template <typename T>
+	T* copy(const T* data, size_t count)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable data can be copied");
+		T* destination = static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+		if(count > 0)
+		{
+			memcpy(destination, data, count * sizeof(T));
+		}
+		return destination;
+	}
+
+	/// Raw memory from the arena, valid until reset()
+	void* allocate(size_t size, size_t alignment);
+
+	/// Calls all recorded commands in order
+	void replay();
+
+	/// Destroys the recorded commands and rewinds the arena
+	void reset();
+
+	size_t recordedBytes() const { return m_recordedBytes; }
+	size_t numCommands() const { return m_numCommands; }
+
+private:
+	struct Command
+	{
+		void (*execute)(void*);
+		void (*destroy)(void*);
+		void* object;
+		Command* next;
+	};
+
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> m_blocks;
+	size_t m_currentBlock;
+	size_t m_blockUsed;
+	size_t m_recordedBytes;
+	size_t m_numCommands;
+	Command* m_first;
+	Command* m_last;
+};
@@ -0,0 +1,23 @@
+#version 420
+// Writes the farthest scene depth of each `factor` x `factor` block, so a
+// particle is only culled by the low resolution depth where every covered
+// full resolution pixel would cull it. The upsample fixes up the edges.
+layout(binding = 0) uniform sampler2D sceneDepthTexture;
+uniform int factor;
+// texels of the scene depth that hold the view, the target is allocated larger
+uniform ivec2 sceneSize;
+
+void main()
+{
+	ivec2 base = ivec2(gl_FragCoord.xy) * factor;
+	ivec2 lastTexel = sceneSize - 1;
+	float depth = 0.0;
+	for(int y = 0; y < factor; y++)
+	{
+		for(int x = 0; x < factor; x++)
+		{
+			depth = max(depth, texelFetch(sceneDepthTexture, min(base + ivec2(x, y), lastTexel), 0).r);
+		}
+	}
+	gl_FragDepth = depth;
+}
@@ -0,0 +1,82 @@
+#include "dynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Fraction of the budget the scale is lowered to when a frame is over it
+const float DownTarget = 0.9f;
+// The scale goes up once the smoothed time is under this fraction of the budget...
+const float UpThreshold = 0.75f;
+// ...for this many measured frames in a row
+const int SettleFrames = 30;
+const float MaxStepUp = 0.05f;
+// Smaller changes are not worth the blur of a different scale
+const float MinChange = 0.01f;
+} // namespace
+
+DynamicResolution::DynamicResolution()
+    : m_enabled(true)
+    , m_targetMs(1000.0f / 60.0f)
+    , m_minScale(0.5f)
+    , m_maxScale(1.0f)
+    , m_changes(0)
+    , m_smoothedMs(-1.0f)
+    , m_scale(1.0f)
+    , m_underBudgetFrames(0)
+    , m_settledFrame(0)
+    , m_lastFrame(0)
+{
+}
+
+void DynamicResolution::update(uint64_t frame, float gpuMs, uint64_t currentFrame)
+{
+	m_maxScale = std::min(std::max(m_maxScale, 0.1f), 1.0f);
+	m_minScale = std::min(std::max(m_minScale, 0.1f), m_maxScale);
+	float scale = std::min(std::max(m_scale, m_minScale), m_maxScale);
+	if(!m_enabled || frame <= m_lastFrame || frame < m_settledFrame || gpuMs <= 0.0f || m_targetMs <= 0.0f)
+	{
+		m_scale = scale;
+		return;
+	}
+	m_lastFrame = frame;
+
+	m_smoothedMs = m_smoothedMs < 0.0f ? gpuMs : m_smoothedMs + 0.1f * (gpuMs - m_smoothedMs);
+	if(gpuMs > m_targetMs)
+	{
+		// Straight from the spike, not the smoothed time
+		scale *= std::sqrt(m_targetMs * DownTarget / gpuMs);
+		m_underBudgetFrames = 0;
+	}
+	else if(m_smoothedMs < m_targetMs * UpThreshold)
+	{
+		if(++m_underBudgetFrames >= SettleFrames)
+		{
+			const float wanted = scale * std::sqrt(m_targetMs * DownTarget / m_smoothedMs);
+			scale = std::min(wanted, scale + MaxStepUp);
+			m_underBudgetFrames = 0;
+		}
+	}
+	else
+	{
+		m_underBudgetFrames = 0;
+	}
+
+	scale = std::min(std::max(scale, m_minScale), m_maxScale);
+	if(std::abs(scale - m_scale) >= MinChange || scale == m_minScale || scale == m_maxScale)
+	{
+		if(scale != m_scale)
+		{
+			m_changes++;
+			m_smoothedMs = -1.0f;
+			m_settledFrame = currentFrame;
+		}
+		m_scale = scale;
+	}
+}
+
+int DynamicResolution::scaled(int size) const
+{
+	return std::max(1, int(std::lround(size * scale())));
+}
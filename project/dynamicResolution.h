@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Picks the fraction of the window size the camera view is rendered at from
+// the measured GPU time of each frame, to keep it within a budget. The cost
+// of a frame is taken to grow with the number of pixels, the square of the
+// scale.
+//
+// A frame over budget lowers the scale at once, so load spikes are absorbed
+// within a few frames. The scale only goes up again once the smoothed time
+// has stayed well under the budget for a while, and then in small steps;
+// between the two thresholds it is held, so it does not oscillate. Timings
+// arrive several frames late, so samples of frames recorded before the last
+// change are ignored.
+///////////////////////////////////////////////////////////////////////////////
+class DynamicResolution
+{
+public:
+	DynamicResolution();
+
+	/// Main thread: feeds the GPU time measured for `frame`, before `currentFrame`
+	/// is recorded at scale(). A frame that was fed before is ignored.
+	void update(uint64_t frame, float gpuMs, uint64_t currentFrame);
+
+	/// Fraction of the window size to render at, 1 when disabled
+	float scale() const { return m_enabled ? m_scale : 1.0f; }
+	/// Rendered size for an output of `size` pixels, at least 1
+	int scaled(int size) const;
+
+	bool m_enabled;
+	float m_targetMs; // budget for the GPU time of a frame
+	float m_minScale;
+	float m_maxScale; // at most 1, targets are allocated at the window size
+	int m_changes;
+	float m_smoothedMs;
+
+private:
+	float m_scale;
+	int m_underBudgetFrames;
+	uint64_t m_settledFrame; // first frame rendered at the current scale
+	uint64_t m_lastFrame;    // last frame fed to update()
+};
@@ -0,0 +1,310 @@
+#include "envCubemap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <glm/glm.hpp>
+#include <stb_image.h>
+#include "parallelFor.h"
+
+using namespace glm;
+
+namespace
+{
+const float Pi = 3.14159265359f;
+
+struct Equirect
+{
+	int width = 0;
+	int height = 0;
+	float* rgb = nullptr;
+};
+
+/// Six faces of `size` x `size` texels, face after face in GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+struct CubeLevel
+{
+	int size;
+	std::vector<vec3> texels;
+};
+
+bool loadEquirect(const std::string& filename, Equirect& image)
+{
+	// Same orientation the 2D textures had, so the mapping below matches the old shaders
+	stbi_set_flip_vertically_on_load(true);
+	int components;
+	image.rgb = stbi_loadf(filename.c_str(), &image.width, &image.height, &components, 3);
+	stbi_set_flip_vertically_on_load(false);
+	if(image.rgb == nullptr)
+	{
+		std::cout << "Failed to load environment map: " << filename << ".\n";
+		return false;
+	}
+	return true;
+}
+
+/// Bilinear lookup with the mapping the shaders used: u = phi / 2pi, v = 1 - theta / pi
+vec3 sampleEquirect(const Equirect& image, const vec3& direction)
+{
+	const float theta = acosf(std::max(-1.0f, std::min(1.0f, direction.y)));
+	float phi = atan2f(direction.z, direction.x);
+	if(phi < 0.0f)
+	{
+		phi += 2.0f * Pi;
+	}
+	const float x = phi / (2.0f * Pi) * image.width - 0.5f;
+	const float y = (1.0f - theta / Pi) * image.height - 0.5f;
+	const int x0 = int(floorf(x));
+	const int y0 = int(floorf(y));
+	const float fx = x - x0;
+	const float fy = y - y0;
+
+	// wraps around horizontally, clamps at the poles
+	auto texel = [&](int tx, int ty) {
+		tx = ((tx % image.width) + image.width) % image.width;
+		ty = std::max(0, std::min(image.height - 1, ty));
+		const float* p = image.rgb + (size_t(ty) * image.width + tx) * 3;
+		return vec3(p[0], p[1], p[2]);
+	};
+	return mix(mix(texel(x0, y0), texel(x0 + 1, y0), fx), mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), fx), fy);
+}
+
+/// Direction through face coordinates `s`, `t` in [-1, 1], following the face
+/// selection table of the GL specification
+vec3 faceDirection(int face, float s, float t)
+{
+	switch(face)
+	{
+	case 0:
+		return vec3(1.0f, -t, -s);
+	case 1:
+		return vec3(-1.0f, -t, s);
+	case 2:
+		return vec3(s, 1.0f, t);
+	case 3:
+		return vec3(s, -1.0f, -t);
+	case 4:
+		return vec3(s, -t, 1.0f);
+	default:
+		return vec3(-s, -t, -1.0f);
+	}
+}
+
+/// Resamples `image` into a cube level, averaging 2x2 samples per texel
+void convert(const Equirect& image, CubeLevel& level)
+{
+	const int size = level.size;
+	level.texels.resize(6 * size_t(size) * size);
+	parallelFor(6 * size_t(size), 16, [&](size_t first, size_t last) {
+		for(size_t row = first; row < last; row++)
+		{
+			const int face = int(row / size);
+			const int j = int(row % size);
+			vec3* out = &level.texels[row * size];
+			for(int i = 0; i < size; i++)
+			{
+				vec3 sum(0.0f);
+				for(int sy = 0; sy < 2; sy++)
+				{
+					for(int sx = 0; sx < 2; sx++)
+					{
+						const float s = 2.0f * (i + 0.25f + 0.5f * sx) / size - 1.0f;
+						const float t = 2.0f * (j + 0.25f + 0.5f * sy) / size - 1.0f;
+						sum += sampleEquirect(image, normalize(faceDirection(face, s, t)));
+					}
+				}
+				out[i] = 0.25f * sum;
+			}
+		}
+	});
+}
+
+/// Box filters each face of `source` to half its size
+void downsample(const CubeLevel& source, CubeLevel& level)
+{
+	const int size = source.size / 2;
+	level.size = size;
+	level.texels.resize(6 * size_t(size) * size);
+	parallelFor(6 * size_t(size), 16, [&](size_t first, size_t last) {
+		for(size_t row = first; row < last; row++)
+		{
+			const size_t face = row / size;
+			const size_t j = row % size;
+			const vec3* above = &source.texels[(face * source.size + 2 * j) * source.size];
+			const vec3* below = above + source.size;
+			vec3* out = &level.texels[row * size];
+			for(int i = 0; i < size; i++)
+			{
+				out[i] = 0.25f * (above[2 * i] + above[2 * i + 1] + below[2 * i] + below[2 * i + 1]);
+			}
+		}
+	});
+}
+
+/// Packs and uploads all faces of `level` as mip `mip` of the bound cubemap. Returns the bytes uploaded.
+size_t upload(const CubeLevel& level, int mip, std::vector<uint32_t>& packed)
+{
+	const size_t faceTexels = size_t(level.size) * level.size;
+	packed.resize(6 * faceTexels);
+	parallelFor(packed.size(), 4096, [&](size_t first, size_t last) {
+		for(size_t i = first; i < last; i++)
+		{
+			const vec3& c = level.texels[i];
+			packed[i] = envmap::packRgb9e5(c.x, c.y, c.z);
+		}
+	});
+	for(int face = 0; face < 6; face++)
+	{
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGB9_E5, level.size, level.size, 0, GL_RGB,
+		             GL_UNSIGNED_INT_5_9_9_9_REV, &packed[face * faceTexels]);
+	}
+	return packed.size() * sizeof(uint32_t);
+}
+
+GlTexture createCubemap(int numLevels)
+{
+	GlTexture texture("Environment", GL_RESOURCE_SITE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	// filter across face edges instead of clamping at them
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+	return texture;
+}
+
+/// Largest power of two not above `size`, at least 1
+int floorPowerOfTwo(int size)
+{
+	int p = 1;
+	while(p * 2 <= size)
+	{
+		p *= 2;
+	}
+	return p;
+}
+
+void report(const std::string& name, int faceSize, int numLevels, size_t bytes, size_t sourceBytes,
+            std::chrono::high_resolution_clock::time_point start)
+{
+	const float ms =
+	    std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << "Environment " << name << ": " << faceSize << "x" << faceSize << " RGB9E5 cubemap, " << numLevels
+	          << " levels, " << bytes / 1024 << " KiB (RGB32F equirect " << sourceBytes / 1024 << " KiB), converted in "
+	          << ms << " ms on " << parallelThreadCount() << " threads.\n";
+}
+} // namespace
+
+namespace envmap
+{
+uint32_t packRgb9e5(float r, float g, float b)
+{
+	const int MantissaBits = 9;
+	const int ExponentBias = 15;
+	const int MaxExponent = 31;
+	const float MaxValue = float(((1 << MantissaBits) - 1)) / (1 << MantissaBits) * (1 << (MaxExponent - ExponentBias));
+
+	// !(x > 0) also catches NaN
+	const float rc = !(r > 0.0f) ? 0.0f : std::min(r, MaxValue);
+	const float gc = !(g > 0.0f) ? 0.0f : std::min(g, MaxValue);
+	const float bc = !(b > 0.0f) ? 0.0f : std::min(b, MaxValue);
+	const float maxc = std::max(rc, std::max(gc, bc));
+	if(maxc == 0.0f)
+	{
+		return 0;
+	}
+
+	// frexp gives maxc = m * 2^e with m in [0.5, 1), so floor(log2(maxc)) = e - 1
+	int e;
+	frexpf(maxc, &e);
+	int exponent = std::max(-ExponentBias - 1, e - 1) + 1 + ExponentBias;
+	float scale = ldexpf(1.0f, MantissaBits + ExponentBias - exponent);
+	if(int(floorf(maxc * scale + 0.5f)) == (1 << MantissaBits))
+	{
+		exponent++;
+		scale *= 0.5f;
+	}
+	const uint32_t rs = uint32_t(floorf(rc * scale + 0.5f));
+	const uint32_t gs = uint32_t(floorf(gc * scale + 0.5f));
+	const uint32_t bs = uint32_t(floorf(bc * scale + 0.5f));
+	return rs | (gs << 9) | (bs << 18) | (uint32_t(exponent) << 27);
+}
+
+GlTexture loadCubemap(const std::string& filename, int faceSize)
+{
+	const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	Equirect image;
+	if(!loadEquirect(filename, image))
+	{
+		return GlTexture();
+	}
+	const size_t sourceBytes = size_t(image.width) * image.height * 3 * sizeof(float);
+
+	CubeLevel levels[2];
+	levels[0].size = floorPowerOfTwo(faceSize > 0 ? faceSize : std::max(1, image.width / 4));
+	convert(image, levels[0]);
+	stbi_image_free(image.rgb);
+
+	int numLevels = 1;
+	while((levels[0].size >> (numLevels - 1)) > 1)
+	{
+		numLevels++;
+	}
+	GlTexture texture = createCubemap(numLevels);
+	std::vector<uint32_t> packed;
+	size_t bytes = 0;
+	for(int mip = 0; mip < numLevels; mip++)
+	{
+		// ping pong between the two levels
+		const CubeLevel& level = levels[mip % 2];
+		bytes += upload(level, mip, packed);
+		if(mip + 1 < numLevels)
+		{
+			downsample(level, levels[(mip + 1) % 2]);
+		}
+	}
+	texture.setSize(bytes, "RGB9_E5");
+	report(filename, levels[0].size, numLevels, bytes, sourceBytes, start);
+	return texture;
+}
+
+GlTexture loadPrefilteredCubemap(const std::vector<std::string>& filenames)
+{
+	const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	GlTexture texture;
+	int faceSize = 0;
+	size_t bytes = 0;
+	size_t sourceBytes = 0;
+	CubeLevel level;
+	std::vector<uint32_t> packed;
+	for(int mip = 0; mip < int(filenames.size()); mip++)
+	{
+		Equirect image;
+		if(!loadEquirect(filenames[mip], image))
+		{
+			return GlTexture();
+		}
+		sourceBytes += size_t(image.width) * image.height * 3 * sizeof(float);
+		if(mip == 0)
+		{
+			faceSize = floorPowerOfTwo(std::max(1, image.width / 4));
+			texture = createCubemap(int(filenames.size()));
+		}
+		// the files need not halve exactly, resample each to the size of its level
+		level.size = std::max(1, faceSize >> mip);
+		convert(image, level);
+		stbi_image_free(image.rgb);
+		bytes += upload(level, mip, packed);
+	}
+	if(texture != 0)
+	{
+		texture.setSize(bytes, "RGB9_E5");
+		report(filenames[0] + " and " + std::to_string(filenames.size() - 1) + " more", faceSize,
+		       int(filenames.size()), bytes, sourceBytes, start);
+	}
+	return texture;
+}
+} // namespace envmap
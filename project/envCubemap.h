@@ -0,0 +1,29 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "glResource.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Equirectangular HDR environment maps, converted to cubemaps when they are
+// loaded so the shaders can sample them by direction without acos and atan.
+// The conversion and the mip chain run on the CPU in parallel and the texels
+// are uploaded as RGB9E5, 4 bytes instead of the 12 of RGB32F. The shared
+// exponent keeps 9 bits of mantissa per channel, where R11G11B10F has 5 or 6.
+///////////////////////////////////////////////////////////////////////////////
+namespace envmap
+{
+/// Loads `filename` into a cubemap with a box filtered mip chain down to 1x1.
+/// A `faceSize` of 0 picks a quarter of the image width. Returns an empty handle on failure.
+GlTexture loadCubemap(const std::string& filename, int faceSize = 0);
+
+/// Loads one prefiltered image per mip level, level 0 first, into a cubemap whose
+/// face size halves from level to level
+GlTexture loadPrefilteredCubemap(const std::vector<std::string>& filenames);
+
+/// Shared exponent encoding of GL_RGB9_E5 (EXT_texture_shared_exponent),
+/// negative and NaN values become 0
+uint32_t packRgb9e5(float r, float g, float b);
+} // namespace envmap
@@ -2,10 +2,10 @@
 #include <cstdint>
 #include <labhelper.h>
 
-FboInfo::FboInfo(int numberOfColorBuffers)
-    : isComplete(false), framebufferId(0), depthBuffer(0), width(0), height(0)
+FboInfo::FboInfo(int numberOfColorBuffers, const char* owner)
+    : isComplete(false), width(0), height(0), owner(owner)
 {
-	colorTextureTargets.resize(numberOfColorBuffers, 0);
+	colorTextureTargets.resize(numberOfColorBuffers);
 };
 
 void FboInfo::resize(int w, int h)
@@ -20,7 +20,7 @@ void FboInfo::resize(int w, int h)
 	{
 		if(colorTextureTarget == 0)
 		{
-			glGenTextures(1, &colorTextureTarget);
+			colorTextureTarget = GlTexture(owner, GL_RESOURCE_SITE);
 			glBindTexture(GL_TEXTURE_2D, colorTextureTarget);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -31,7 +31,7 @@ void FboInfo::resize(int w, int h)
 
 	if(depthBuffer == 0)
 	{
-		glGenTextures(1, &depthBuffer);
+		depthBuffer = GlTexture(owner, GL_RESOURCE_SITE);
 		glBindTexture(GL_TEXTURE_2D, depthBuffer);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -46,11 +46,13 @@ void FboInfo::resize(int w, int h)
 	{
 		glBindTexture(GL_TEXTURE_2D, colorTextureTarget);
 		glTexImage2D(GL_TEXTURE_2D, 0, colorTargetType, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		colorTextureTarget.setTextureSize(colorTargetType, width, height);
 	}
 
 	glBindTexture(GL_TEXTURE_2D, depthBuffer);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
 	             nullptr);
+	depthBuffer.setTextureSize(GL_DEPTH_COMPONENT32, width, height);
 
 	///////////////////////////////////////////////////////////////////////
 	// Bind textures to framebuffer (if not already done)
@@ -60,7 +62,7 @@ void FboInfo::resize(int w, int h)
 		///////////////////////////////////////////////////////////////////////
 		// Generate and bind framebuffer
 		///////////////////////////////////////////////////////////////////////
-		glGenFramebuffers(1, &framebufferId);
+		framebufferId = GlFramebuffer(owner, GL_RESOURCE_SITE);
 		glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
 
 		// Bind the color textures as color attachments
@@ -99,3 +101,16 @@ bool FboInfo::checkFramebufferComplete(void)
 
 	return (status == GL_FRAMEBUFFER_COMPLETE);
 }
+
+void FboInfo::destroy()
+{
+	for(auto& colorTextureTarget : colorTextureTargets)
+	{
+		colorTextureTarget.reset();
+	}
+	depthBuffer.reset();
+	framebufferId.reset();
+	isComplete = false;
+	width = 0;
+	height = 0;
+}
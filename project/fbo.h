@@ -1,18 +1,22 @@
 #include <GL/glew.h>
 #include <vector>
+#include "glResource.h"
 
 class FboInfo {
 public:
-	GLuint framebufferId;
-	std::vector<GLuint> colorTextureTargets; 
-	GLuint depthBuffer;
+	GlFramebuffer framebufferId;
+	std::vector<GlTexture> colorTextureTargets; 
+	GlTexture depthBuffer;
 	int width;
 	int height;
 	bool isComplete;
 	GLenum colorTargetType = GL_RGBA16F;
+	const char* owner; // counted under this in glresource
 
-	FboInfo(int numberOfColorBuffers = 1);
+	FboInfo(int numberOfColorBuffers = 1, const char* owner = "Framebuffers");
 		
 	void resize(int w, int h);
 	bool checkFramebufferComplete(void);
+	/// Deletes the textures and the framebuffer, resize() creates them again
+	void destroy();
 };
@@ -0,0 +1,326 @@
+#include "frameCapture.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stb_image_write.h>
+
+namespace
+{
+int bytesPerPixel(FrameCapture::Format format)
+{
+	return format == FrameCapture::Exr ? 4 * sizeof(uint16_t) : 4;
+}
+
+float millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename T>
+void put(std::vector<uint8_t>& out, const T& value)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void putAttribute(std::vector<uint8_t>& out, const char* name, const char* type, const void* value, int32_t size)
+{
+	out.insert(out.end(), name, name + strlen(name) + 1);
+	out.insert(out.end(), type, type + strlen(type) + 1);
+	put(out, size);
+	out.insert(out.end(), static_cast<const uint8_t*>(value), static_cast<const uint8_t*>(value) + size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Builds an uncompressed scanline OpenEXR file with half float B, G and R
+/// channels (stored in alphabetical order) from bottom-up RGBA halfs, as
+/// glReadPixels returns them. Assumes a little endian host, like the format.
+///////////////////////////////////////////////////////////////////////////////
+void encodeExr(const uint16_t* rgba, int width, int height, std::vector<uint8_t>& out)
+{
+	out.clear();
+	put(out, int32_t(20000630)); // magic
+	put(out, int32_t(2));        // version, single part scanline
+
+	std::vector<uint8_t> channels;
+	for(const char* name : { "B", "G", "R" })
+	{
+		channels.insert(channels.end(), name, name + 2);
+		put(channels, int32_t(1)); // HALF
+		put(channels, int32_t(0)); // pLinear and reserved
+		put(channels, int32_t(1)); // x sampling
+		put(channels, int32_t(1)); // y sampling
+	}
+	channels.push_back(0);
+	putAttribute(out, "channels", "chlist", channels.data(), int32_t(channels.size()));
+	const uint8_t noCompression = 0, increasingY = 0;
+	putAttribute(out, "compression", "compression", &noCompression, 1);
+	const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+	putAttribute(out, "dataWindow", "box2i", window, sizeof(window));
+	putAttribute(out, "displayWindow", "box2i", window, sizeof(window));
+	putAttribute(out, "lineOrder", "lineOrder", &increasingY, 1);
+	const float one = 1.0f, center[2] = { 0.0f, 0.0f };
+	putAttribute(out, "pixelAspectRatio", "float", &one, sizeof(one));
+	putAttribute(out, "screenWindowCenter", "v2f", center, sizeof(center));
+	putAttribute(out, "screenWindowWidth", "float", &one, sizeof(one));
+	out.push_back(0);
+
+	// One scanline per chunk: y, size, then the line of each channel
+	const int32_t lineBytes = int32_t(width * 3 * sizeof(uint16_t));
+	const size_t table = out.size();
+	const size_t firstChunk = table + size_t(height) * sizeof(uint64_t);
+	out.resize(firstChunk + size_t(height) * (2 * sizeof(int32_t) + lineBytes));
+	for(int y = 0; y < height; y++)
+	{
+		const uint64_t offset = firstChunk + size_t(y) * (2 * sizeof(int32_t) + lineBytes);
+		memcpy(&out[table + y * sizeof(uint64_t)], &offset, sizeof(offset));
+		uint8_t* chunk = &out[offset];
+		memcpy(chunk, &y, sizeof(int32_t));
+		memcpy(chunk + sizeof(int32_t), &lineBytes, sizeof(int32_t));
+		uint16_t* line = reinterpret_cast<uint16_t*>(chunk + 2 * sizeof(int32_t));
+		const uint16_t* source = rgba + size_t(height - 1 - y) * width * 4;
+		for(int x = 0; x < width; x++)
+		{
+			line[x] = source[x * 4 + 2];
+			line[width + x] = source[x * 4 + 1];
+			line[2 * width + x] = source[x * 4 + 0];
+		}
+	}
+}
+} // namespace
+
+FrameCapture::FrameCapture() : m_next(0), m_oldest(0), m_inFlight(0), m_running(false), m_encoding(0)
+{
+	memset(&m_counters, 0, sizeof(m_counters));
+}
+
+FrameCapture::~FrameCapture()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	m_wake.notify_all();
+	for(std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void FrameCapture::start(int numWorkers)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_running = true;
+	for(int i = 0; i < numWorkers; i++)
+	{
+		m_workers.push_back(std::thread(&FrameCapture::run, this));
+	}
+}
+
+void FrameCapture::finish()
+{
+	poll(true);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	// The workers write what is queued before they return
+	m_wake.notify_all();
+	for(std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+	m_workers.clear();
+	m_ring.clear();
+}
+
+bool FrameCapture::capture(GLuint framebuffer, int width, int height, Format format, const std::string& path)
+{
+	if(m_ring.empty())
+	{
+		m_ring.resize(RingSize);
+	}
+	Readback& readback = m_ring[m_next];
+	if(m_inFlight == RingSize)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_counters.dropped++;
+		return false;
+	}
+
+	const size_t bytes = size_t(width) * height * bytesPerPixel(format);
+	if(readback.buffer == 0)
+	{
+		readback.buffer = GlBuffer("Capture", GL_RESOURCE_SITE);
+		readback.capacity = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	if(readback.capacity < bytes)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+		readback.capacity = bytes;
+		readback.buffer.setSize(bytes, "pixels");
+	}
+
+	// Into the buffer, so this only queues the copy
+	GLint previousRead = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glReadBuffer(framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, width, height, GL_RGBA, format == Exr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE, nullptr);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readback.width = width;
+	readback.height = height;
+	readback.format = format;
+	readback.path = path;
+	m_next = (m_next + 1) % RingSize;
+	m_inFlight++;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_counters.captured++;
+	m_counters.pendingReadbacks = m_inFlight;
+	return true;
+}
+
+void FrameCapture::poll(bool wait)
+{
+	// In the order they were captured, stopping at the first that is not done
+	while(m_inFlight > 0)
+	{
+		Readback& readback = m_ring[m_oldest];
+		const GLenum status = glClientWaitSync(readback.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+		                                       wait ? GL_TIMEOUT_IGNORED : 0);
+		if(status == GL_TIMEOUT_EXPIRED)
+		{
+			break;
+		}
+		glDeleteSync(readback.fence);
+		readback.fence = nullptr;
+		m_oldest = (m_oldest + 1) % RingSize;
+		m_inFlight--;
+
+		Job job;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_counters.pendingReadbacks = m_inFlight;
+			// Waiting on the workers here would stall the frame, so the capture is lost instead
+			const bool full = int(m_jobs.size()) + m_encoding >= MaxQueuedFrames;
+			if(status == GL_WAIT_FAILED || (full && !wait))
+			{
+				m_counters.dropped++;
+				continue;
+			}
+			if(!m_freeBuffers.empty())
+			{
+				job.pixels.swap(m_freeBuffers.back());
+				m_freeBuffers.pop_back();
+			}
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		const size_t bytes = size_t(readback.width) * readback.height * bytesPerPixel(readback.format);
+		job.pixels.resize(bytes);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+		if(pixels != nullptr)
+		{
+			memcpy(job.pixels.data(), pixels, bytes);
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		job.width = readback.width;
+		job.height = readback.height;
+		job.format = readback.format;
+		job.path = readback.path;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_counters.copyMs = millisecondsSince(start);
+			if(pixels == nullptr)
+			{
+				m_counters.failed++;
+				m_freeBuffers.push_back(std::move(job.pixels));
+				continue;
+			}
+			m_jobs.push_back(std::move(job));
+			m_counters.queuedFrames = int(m_jobs.size()) + m_encoding;
+		}
+		m_wake.notify_one();
+	}
+}
+
+FrameCapture::Counters FrameCapture::counters()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_counters;
+}
+
+void FrameCapture::run()
+{
+	std::vector<uint8_t> encoded;
+	for(;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this]() { return !m_running || !m_jobs.empty(); });
+			if(m_jobs.empty())
+			{
+				return;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			m_encoding++;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		const bool written = write(job, encoded);
+		if(!written)
+		{
+			std::cout << "Could not write capture " << job.path << ".\n";
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_encoding--;
+		m_counters.encodeMs = millisecondsSince(start);
+		m_counters.written += written ? 1 : 0;
+		m_counters.failed += written ? 0 : 1;
+		m_counters.queuedFrames = int(m_jobs.size()) + m_encoding;
+		m_freeBuffers.push_back(std::move(job.pixels));
+	}
+}
+
+bool FrameCapture::write(const Job& job, std::vector<uint8_t>& encoded)
+{
+	if(job.format == Exr)
+	{
+		encodeExr(reinterpret_cast<const uint16_t*>(job.pixels.data()), job.width, job.height, encoded);
+		FILE* file = fopen(job.path.c_str(), "wb");
+		if(file == nullptr)
+		{
+			return false;
+		}
+		const bool written = fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+		return fclose(file) == 0 && written;
+	}
+
+	// Top row first and without alpha, the back buffer's is not meaningful
+	encoded.resize(size_t(job.width) * job.height * 3);
+	for(int y = 0; y < job.height; y++)
+	{
+		const uint8_t* source = &job.pixels[size_t(job.height - 1 - y) * job.width * 4];
+		uint8_t* destination = &encoded[size_t(y) * job.width * 3];
+		for(int x = 0; x < job.width; x++)
+		{
+			destination[x * 3 + 0] = source[x * 4 + 0];
+			destination[x * 3 + 1] = source[x * 4 + 1];
+			destination[x * 3 + 2] = source[x * 4 + 2];
+		}
+	}
+	return stbi_write_png(job.path.c_str(), job.width, job.height, 3, encoded.data(), job.width * 3) != 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "glResource.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Captures frames without stalling the GL thread. capture() starts a
+// glReadPixels into the next pixel pack buffer of a ring and fences it, which
+// returns at once. poll(), called every frame, maps the buffers whose fence
+// has signalled, usually a frame or two later, copies the pixels out and
+// hands them to worker threads that flip and encode them as PNG or EXR.
+//
+// Nothing ever waits for the GPU or the encoders while frames are running: a
+// capture that finds its ring slot still in flight, or the encode queue
+// full, is dropped and counted instead, so a frame sequence costs about a
+// memcpy per frame on the GL thread.
+///////////////////////////////////////////////////////////////////////////////
+class FrameCapture
+{
+public:
+	enum Format
+	{
+		Png = 0, // 8 bit RGB of the presented frame, alpha dropped
+		Exr = 1  // half float RGB of the linear HDR scene
+	};
+
+	enum
+	{
+		RingSize = 4,       // readbacks in flight
+		MaxQueuedFrames = 8 // read back, waiting for an encoder
+	};
+
+	struct Counters
+	{
+		int pendingReadbacks;
+		int queuedFrames; // waiting for or being encoded
+		uint64_t captured;
+		uint64_t written;
+		uint64_t dropped; // ring slot busy or encode queue full
+		uint64_t failed;  // could not be written
+		float copyMs;     // map and copy of the last readback, on the GL thread
+		float encodeMs;   // last frame encoded, on a worker
+	};
+
+	FrameCapture();
+	~FrameCapture();
+
+	/// Starts `numWorkers` encoding threads
+	void start(int numWorkers);
+	/// GL thread: writes every frame still in flight, waits for the workers
+	/// and deletes the pixel pack buffers
+	void finish();
+
+	/// GL thread: starts reading back the color attachment 0 of `framebuffer`,
+	/// or the back buffer if it is 0, to be written to `path`. Returns false if
+	/// the frame was dropped.
+	bool capture(GLuint framebuffer, int width, int height, Format format, const std::string& path);
+	/// GL thread: hands finished readbacks to the workers, waiting for them if `wait`
+	void poll(bool wait = false);
+
+	Counters counters();
+
+private:
+	struct Readback
+	{
+		GlBuffer buffer;
+		size_t capacity;
+		GLsync fence;
+		int width;
+		int height;
+		Format format;
+		std::string path;
+	};
+
+	struct Job
+	{
+		std::vector<uint8_t> pixels;
+		int width;
+		int height;
+		Format format;
+		std::string path;
+	};
+
+	void run();
+	static bool write(const Job& job, std::vector<uint8_t>& encoded);
+
+	std::vector<Readback> m_ring;
+	int m_next;   // slot the next capture reads into
+	int m_oldest; // oldest slot in flight
+	int m_inFlight;
+
+	// Everything below is guarded by m_mutex
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_running;
+	std::vector<std::thread> m_workers;
+	std::deque<Job> m_jobs;
+	std::vector<std::vector<uint8_t>> m_freeBuffers;
+	int m_encoding;
+	Counters m_counters;
+};
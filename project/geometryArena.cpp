@@ -0,0 +1,357 @@
+#include "geometryArena.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <labhelper.h>
+
+using namespace glm;
+
+GeometryArena::GeometryArena()
+    : m_numInstances(0)
+    , m_numVisibleDraws(0)
+    , m_drawDataDirty(true)
+{
+}
+
+void GeometryArena::destroy()
+{
+	m_vertexBuffer.reset();
+	m_indexBuffer.reset();
+	m_drawIdBuffer.reset();
+	m_drawDataBuffer.reset();
+	m_materialBuffer.reset();
+	m_commandBuffer.reset();
+	m_vao.reset();
+}
+
+int GeometryArena::addModel(const CachedModel* model)
+{
+	const int instance = m_numInstances++;
+	const GLuint materialOffset = GLuint(m_materials.size());
+	const meshcache::Header& header = model->header();
+
+	for(uint32_t i = 0; i < header.numMaterials; i++)
+	{
+		const meshcache::Material& material = model->materials()[i];
+		MaterialData data;
+		data.color = vec4(material.color[0], material.color[1], material.color[2], 1.0f);
+		data.emission = vec4(material.emission[0], material.emission[1], material.emission[2], 0.0f);
+		data.metalness = material.metalness;
+		data.fresnel = material.fresnel;
+		data.shininess = material.shininess;
+		data.hasTextures = (model->colorTexture(i) != 0 ? 1 : 0) | (model->emissionTexture(i) != 0 ? 2 : 0);
+		m_materials.push_back(data);
+	}
+
+	const GLuint indexOffset = GLuint(m_indices.size());
+	const GLuint vertexOffset = GLuint(m_vertices.size());
+	m_vertices.insert(m_vertices.end(), model->vertices(), model->vertices() + header.numVertices);
+	m_indices.insert(m_indices.end(), model->indices(), model->indices() + header.numIndices);
+
+	for(uint32_t i = 0; i < header.numMeshes; i++)
+	{
+		const meshcache::Mesh& mesh = model->meshes()[i];
+		const vec3 boundsMin(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+		const vec3 boundsMax(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+
+		DrawData draw;
+		draw.modelMatrix = mat4(1.0f);
+		draw.normalMatrix = mat4(1.0f);
+		draw.boundingSphere = vec4(mesh.boundingSphere[0], mesh.boundingSphere[1], mesh.boundingSphere[2],
+		                           mesh.boundingSphere[3]);
+		draw.positionScale = vec4(max(0.5f * (boundsMax - boundsMin), vec3(1e-6f)), 0.0f);
+		draw.positionOffset = vec4(0.5f * (boundsMin + boundsMax), 0.0f);
+		draw.materialIdx = materialOffset + mesh.materialIdx;
+		draw.firstIndex = indexOffset + mesh.firstIndex;
+		draw.indexCount = mesh.indexCount;
+		draw.baseVertex = vertexOffset + mesh.baseVertex;
+
+		m_draws.push_back(draw);
+		m_drawInstance.push_back(instance);
+		m_drawColorTexture.push_back(model->colorTexture(mesh.materialIdx));
+		m_drawEmissionTexture.push_back(model->emissionTexture(mesh.materialIdx));
+	}
+	return instance;
+}
+
+void GeometryArena::upload()
+{
+	///////////////////////////////////////////////////////////////////////
+	// Sort the draws by texture set so that every set is one contiguous
+	// range of indirect commands
+	///////////////////////////////////////////////////////////////////////
+	std::vector<int> order(m_draws.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+		if(m_drawColorTexture[a] != m_drawColorTexture[b])
+		{
+			return m_drawColorTexture[a] < m_drawColorTexture[b];
+		}
+		return m_drawEmissionTexture[a] < m_drawEmissionTexture[b];
+	});
+
+	std::vector<DrawData> draws;
+	std::vector<int> drawInstance;
+	m_batches.clear();
+	for(int i = 0; i < int(order.size()); i++)
+	{
+		const int d = order[i];
+		draws.push_back(m_draws[d]);
+		drawInstance.push_back(m_drawInstance[d]);
+		if(m_batches.empty() || m_batches.back().colorTexture != m_drawColorTexture[d]
+		   || m_batches.back().emissionTexture != m_drawEmissionTexture[d])
+		{
+			m_batches.push_back({ m_drawColorTexture[d], m_drawEmissionTexture[d], i, 0 });
+		}
+		m_batches.back().numDraws++;
+	}
+	m_draws.swap(draws);
+	m_drawInstance.swap(drawInstance);
+
+	m_commands.resize(m_draws.size());
+	std::vector<GLuint> drawIds(m_draws.size());
+	for(GLuint i = 0; i < GLuint(m_draws.size()); i++)
+	{
+		m_commands[i] = { m_draws[i].indexCount, 1, m_draws[i].firstIndex, GLint(m_draws[i].baseVertex), i };
+		drawIds[i] = i;
+	}
+	m_numVisibleDraws = int(m_draws.size());
+
+	///////////////////////////////////////////////////////////////////////
+	// Vertex array: interleaved vertices plus an instanced draw id, which
+	// is fetched through the baseInstance of each indirect command
+	///////////////////////////////////////////////////////////////////////
+	m_vao = GlVertexArray("Scene geometry", GL_RESOURCE_SITE);
+	glBindVertexArray(m_vao);
+
+	m_vertexBuffer = GlBuffer("Scene geometry", GL_RESOURCE_SITE);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex), m_vertices.data(), GL_STATIC_DRAW);
+	m_vertexBuffer.setSize(m_vertices.size() * sizeof(Vertex), "vertices");
+	glVertexAttribPointer(0, 3, GL_SHORT, true, sizeof(Vertex), (void*)offsetof(Vertex, position));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_SHORT, true, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, false, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+	glEnableVertexAttribArray(2);
+
+	m_drawIdBuffer = GlBuffer("Scene geometry", GL_RESOURCE_SITE);
+	glBindBuffer(GL_ARRAY_BUFFER, m_drawIdBuffer);
+	glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), GL_STATIC_DRAW);
+	m_drawIdBuffer.setSize(drawIds.size() * sizeof(GLuint), "draw ids");
+	glVertexAttribIPointer(DrawIdAttribute, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+	glVertexAttribDivisor(DrawIdAttribute, 1);
+	glEnableVertexAttribArray(DrawIdAttribute);
+
+	m_indexBuffer = GlBuffer("Scene geometry", GL_RESOURCE_SITE);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLuint), m_indices.data(), GL_STATIC_DRAW);
+	m_indexBuffer.setSize(m_indices.size() * sizeof(GLuint), "uint32 indices");
+	glBindVertexArray(0);
+
+	///////////////////////////////////////////////////////////////////////
+	// Storage buffers
+	///////////////////////////////////////////////////////////////////////
+	m_drawDataBuffer = GlBuffer("Scene geometry", GL_RESOURCE_SITE);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_drawDataBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, m_draws.size() * sizeof(DrawData), m_draws.data(), GL_DYNAMIC_DRAW);
+	m_drawDataBuffer.setSize(m_draws.size() * sizeof(DrawData), "draw data");
+
+	m_materialBuffer = GlBuffer("Scene geometry", GL_RESOURCE_SITE);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_materialBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, m_materials.size() * sizeof(MaterialData), m_materials.data(),
+	             GL_STATIC_DRAW);
+	m_materialBuffer.setSize(m_materials.size() * sizeof(MaterialData), "materials");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	m_commandBuffer = GlBuffer("Scene geometry", GL_RESOURCE_SITE);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, m_commands.size() * sizeof(DrawCommand), m_commands.data(),
+	             GL_DYNAMIC_DRAW);
+	m_commandBuffer.setSize(m_commands.size() * sizeof(DrawCommand), "indirect commands");
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	m_drawDataDirty = false;
+	std::cout << "Geometry arena: " << m_vertices.size() << " vertices, " << m_indices.size() << " indices, "
+	          << m_draws.size() << " draws in " << m_batches.size() << " texture batches.\n";
+
+	// Everything lives on the gpu from here on
+	std::vector<Vertex>().swap(m_vertices);
+	std::vector<GLuint>().swap(m_indices);
+}
+
+void GeometryArena::setModelMatrix(int instance, const mat4& modelMatrix)
+{
+	const mat4 normalMatrix = inverse(transpose(modelMatrix));
+	for(size_t i = 0; i < m_draws.size(); i++)
+	{
+		if(m_drawInstance[i] == instance && m_draws[i].modelMatrix != modelMatrix)
+		{
+			m_draws[i].modelMatrix = modelMatrix;
+			m_draws[i].normalMatrix = normalMatrix;
+			m_drawDataDirty = true;
+		}
+	}
+}
+
+void GeometryArena::uploadDrawData()
+{
+	if(!m_drawDataDirty)
+	{
+		return;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_drawDataBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_draws.size() * sizeof(DrawData), m_draws.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	m_drawDataDirty = false;
+}
+
+void GeometryArena::buildCommandsCpu(const mat4& viewProjection)
+{
+	uploadDrawData();
+
+	vec4 planes[6];
+	extractFrustumPlanes(viewProjection, planes);
+
+	m_numVisibleDraws = 0;
+	for(size_t i = 0; i < m_draws.size(); i++)
+	{
+		const DrawData& draw = m_draws[i];
+		const vec3 center = vec3(draw.modelMatrix * vec4(vec3(draw.boundingSphere), 1.0f));
+		const float scale = max(length(vec3(draw.modelMatrix[0])),
+		                        max(length(vec3(draw.modelMatrix[1])), length(vec3(draw.modelMatrix[2]))));
+		const float radius = draw.boundingSphere.w * scale;
+
+		bool visible = true;
+		for(int p = 0; p < 6 && visible; p++)
+		{
+			visible = dot(vec3(planes[p]), center) + planes[p].w >= -radius;
+		}
+		m_commands[i].instanceCount = visible ? 1 : 0;
+		m_numVisibleDraws += visible ? 1 : 0;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, m_commands.size() * sizeof(DrawCommand), m_commands.data());
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GeometryArena::buildCommandsGpu(GLuint cullProgram, const mat4& viewProjection)
+{
+	uploadDrawData();
+
+	vec4 planes[6];
+	extractFrustumPlanes(viewProjection, planes);
+
+	glUseProgram(cullProgram);
+	glUniform4fv(glGetUniformLocation(cullProgram, "frustumPlanes"), 6, &planes[0].x);
+	glUniform1ui(glGetUniformLocation(cullProgram, "numDraws"), GLuint(m_draws.size()));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DrawDataBinding, m_drawDataBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CommandBinding, m_commandBuffer);
+	glDispatchCompute((GLuint(m_draws.size()) + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+	// The visible count stays on the gpu, we never read it back.
+	m_numVisibleDraws = -1;
+}
+
+void GeometryArena::submit(bool submitMaterials)
+{
+	glBindVertexArray(m_vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DrawDataBinding, m_drawDataBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MaterialBinding, m_materialBuffer);
+
+	if(!submitMaterials)
+	{
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, GLsizei(m_draws.size()), 0);
+	}
+	else
+	{
+		for(const Batch& batch : m_batches)
+		{
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, batch.colorTexture);
+			glActiveTexture(GL_TEXTURE5);
+			glBindTexture(GL_TEXTURE_2D, batch.emissionTexture);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			                            (void*)(batch.firstDraw * sizeof(DrawCommand)), batch.numDraws, 0);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+GLuint loadComputeShaderProgram(const std::string& computeShader, bool allow_errors)
+{
+	std::ifstream file(computeShader);
+	if(!file)
+	{
+		if(allow_errors)
+		{
+			std::cout << "Failed to open compute shader: " << computeShader << ".\n";
+			return 0;
+		}
+		labhelper::fatal_error("Failed to open compute shader: " + computeShader);
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+	const std::string sourceString = source.str();
+	const char* sourcePtr = sourceString.c_str();
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &sourcePtr, nullptr);
+	glCompileShader(shader);
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if(linked != GL_TRUE)
+	{
+		char log[4096];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		std::string message = computeShader + ":\n" + log;
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		message += log;
+		glDeleteShader(shader);
+		glDeleteProgram(program);
+		if(allow_errors)
+		{
+			std::cout << message << "\n";
+			return 0;
+		}
+		labhelper::fatal_error(message);
+	}
+	glDetachShader(program, shader);
+	glDeleteShader(shader);
+	return program;
+}
+
+void extractFrustumPlanes(const mat4& viewProjection, vec4 planes[6])
+{
+	// Gribb & Hartmann, rows of the (column major) matrix
+	vec4 row[4];
+	for(int i = 0; i < 4; i++)
+	{
+		row[i] = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+	planes[0] = row[3] + row[0];
+	planes[1] = row[3] - row[0];
+	planes[2] = row[3] + row[1];
+	planes[3] = row[3] - row[1];
+	planes[4] = row[3] + row[2];
+	planes[5] = row[3] - row[2];
+	for(int i = 0; i < 6; i++)
+	{
+		planes[i] = planes[i] / length(vec3(planes[i]));
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "glResource.h"
+#include "meshCache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// All static geometry of the scene packed into one vertex buffer and one index
+// buffer with a shared vertex format. Per draw transforms and material indices
+// live in shader storage buffers, and every pass is submitted with
+// glMultiDrawElementsIndirect. The indirect commands can either be written by
+// the CPU or by the culling compute shader (cullDraws.comp).
+///////////////////////////////////////////////////////////////////////////////
+class GeometryArena
+{
+public:
+	// Shader storage / vertex attribute bindings shared with the shaders.
+	enum Binding
+	{
+		DrawDataBinding = 0,
+		MaterialBinding = 1,
+		CommandBinding = 2,
+		DrawIdAttribute = 3
+	};
+
+	// Quantized vertices straight from the mesh cache
+	typedef meshcache::Vertex Vertex;
+
+	// std430 layout, must match `Draw` in shading.vert, shadow.vert and cullDraws.comp
+	struct DrawData
+	{
+		glm::mat4 modelMatrix;
+		glm::mat4 normalMatrix;
+		glm::vec4 boundingSphere; // object space center and radius
+		glm::vec4 positionScale;  // dequantizes the snorm positions of the mesh
+		glm::vec4 positionOffset;
+		GLuint materialIdx;
+		GLuint firstIndex;
+		GLuint indexCount;
+		GLuint baseVertex;
+	};
+
+	// std430 layout, must match `Material` in shading.frag
+	struct MaterialData
+	{
+		glm::vec4 color;
+		glm::vec4 emission;
+		float metalness;
+		float fresnel;
+		float shininess;
+		GLint hasTextures; // bit 0: color texture, bit 1: emission texture
+	};
+
+	// Layout defined by the GL spec for glMultiDrawElementsIndirect
+	struct DrawCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	GeometryArena();
+
+	/// Appends all meshes of `model` to the arena and returns the id of the new
+	/// instance, which is used to update its transform through setModelMatrix().
+	/// Must be called before upload().
+	int addModel(const CachedModel* model);
+
+	/// Creates the gpu buffers for all models added so far
+	void upload();
+	/// Deletes the gpu buffers
+	void destroy();
+
+	/// Sets the transform of all draws belonging to `instance`
+	void setModelMatrix(int instance, const glm::mat4& modelMatrix);
+
+	/// Writes the indirect commands on the CPU, culling the draws against the frustum of `viewProjection`
+	void buildCommandsCpu(const glm::mat4& viewProjection);
+
+	/// Writes the indirect commands with the culling compute program
+	void buildCommandsGpu(GLuint cullProgram, const glm::mat4& viewProjection);
+
+	/// Issues the draws with the current commands. If `submitMaterials` is set, the
+	/// material textures are bound and one multi draw is issued per texture set.
+	void submit(bool submitMaterials);
+
+	int numDraws() const { return int(m_draws.size()); }
+	int numVisibleDraws() const { return m_numVisibleDraws; }
+
+private:
+	struct Batch
+	{
+		GLuint colorTexture;
+		GLuint emissionTexture;
+		int firstDraw;
+		int numDraws;
+	};
+
+	void uploadDrawData();
+
+	std::vector<Vertex> m_vertices;
+	std::vector<GLuint> m_indices;
+	std::vector<DrawData> m_draws;
+	std::vector<int> m_drawInstance;
+	std::vector<GLuint> m_drawColorTexture;
+	std::vector<GLuint> m_drawEmissionTexture;
+	std::vector<MaterialData> m_materials;
+	std::vector<Batch> m_batches;
+	std::vector<DrawCommand> m_commands;
+	int m_numInstances;
+	std::atomic<int> m_numVisibleDraws; // read by the GUI on the main thread
+	bool m_drawDataDirty;
+
+	GlVertexArray m_vao;
+	GlBuffer m_vertexBuffer;
+	GlBuffer m_indexBuffer;
+	GlBuffer m_drawIdBuffer;
+	GlBuffer m_drawDataBuffer;
+	GlBuffer m_materialBuffer;
+	GlBuffer m_commandBuffer;
+};
+
+/// Compiles and links a program from a single compute shader. Returns 0 on failure
+/// if `allow_errors` is set, otherwise failing is fatal.
+GLuint loadComputeShaderProgram(const std::string& computeShader, bool allow_errors = false);
+
+/// Extracts the six normalized frustum planes (xyz = normal, w = distance) from a view projection matrix
+void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
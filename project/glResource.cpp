@@ -0,0 +1,335 @@
+#include "glResource.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <imgui.h>
+
+namespace
+{
+const char* KindNames[glresource::NumKinds] = { "buffer", "texture", "vertex array", "framebuffer", "program" };
+
+struct Allocation
+{
+	glresource::Kind kind;
+	GLuint name;
+	std::string owner;
+	glresource::Site site;
+	size_t bytes;
+	const char* format;
+};
+
+struct Budget
+{
+	size_t bytes;
+	bool warned;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Objects are created and deleted on the GL thread while the GUI reads the
+// totals on the main thread, so everything is behind one mutex. Allocated
+// once and never freed, handles in globals may be destroyed after it would be.
+///////////////////////////////////////////////////////////////////////////////
+struct Tracker
+{
+	std::mutex mutex;
+	std::unordered_map<uint64_t, Allocation> allocations;
+	std::map<std::string, Budget> budgets;
+};
+
+Tracker& tracker()
+{
+	static Tracker* instance = new Tracker;
+	return *instance;
+}
+
+uint64_t key(glresource::Kind kind, GLuint name)
+{
+	return (uint64_t(kind) << 32) | name;
+}
+
+struct FormatInfo
+{
+	GLenum format;
+	const char* name;
+	int bytesPerTexel;
+};
+
+const FormatInfo Formats[] = {
+	{ GL_R8, "R8", 1 },
+	{ GL_RG8, "RG8", 2 },
+	{ GL_RGB8, "RGB8", 4 }, // padded by most drivers
+	{ GL_RGBA8, "RGBA8", 4 },
+	{ GL_RGBA, "RGBA8", 4 },
+	{ GL_SRGB_ALPHA, "SRGB8_A8", 4 },
+	{ GL_SRGB8_ALPHA8, "SRGB8_A8", 4 },
+	{ GL_R16, "R16", 2 },
+	{ GL_RG16_SNORM, "RG16_SNORM", 4 },
+	{ GL_R16F, "R16F", 2 },
+	{ GL_RGBA16F, "RGBA16F", 8 },
+	{ GL_R32F, "R32F", 4 },
+	{ GL_RGBA32F, "RGBA32F", 16 },
+	{ GL_RGB9_E5, "RGB9_E5", 4 },
+	{ GL_DEPTH_COMPONENT32, "DEPTH32", 4 },
+	{ GL_DEPTH_COMPONENT32F, "DEPTH32F", 4 },
+	{ GL_DEPTH_COMPONENT24, "DEPTH24", 4 },
+};
+
+const FormatInfo* findFormat(GLenum internalFormat)
+{
+	for(const FormatInfo& info : Formats)
+	{
+		if(info.format == internalFormat)
+		{
+			return &info;
+		}
+	}
+	return nullptr;
+}
+
+std::string megabytes(size_t bytes)
+{
+	char text[32];
+	snprintf(text, sizeof(text), "%.2f MiB", bytes / (1024.0 * 1024.0));
+	return text;
+}
+} // namespace
+
+namespace glresource
+{
+GLuint create(Kind kind)
+{
+	GLuint name = 0;
+	switch(kind)
+	{
+	case Buffer:
+		glGenBuffers(1, &name);
+		break;
+	case Texture:
+		glGenTextures(1, &name);
+		break;
+	case VertexArray:
+		glGenVertexArrays(1, &name);
+		break;
+	case Framebuffer:
+		glGenFramebuffers(1, &name);
+		break;
+	case Program:
+		name = glCreateProgram();
+		break;
+	default:
+		break;
+	}
+	return name;
+}
+
+void destroy(Kind kind, GLuint name)
+{
+	switch(kind)
+	{
+	case Buffer:
+		glDeleteBuffers(1, &name);
+		break;
+	case Texture:
+		glDeleteTextures(1, &name);
+		break;
+	case VertexArray:
+		glDeleteVertexArrays(1, &name);
+		break;
+	case Framebuffer:
+		glDeleteFramebuffers(1, &name);
+		break;
+	case Program:
+		glDeleteProgram(name);
+		break;
+	default:
+		break;
+	}
+}
+
+void track(Kind kind, GLuint name, const char* owner, Site site)
+{
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	t.allocations[key(kind, name)] = Allocation{ kind, name, owner, site, 0, "" };
+}
+
+void untrack(Kind kind, GLuint name)
+{
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	t.allocations.erase(key(kind, name));
+}
+
+void setSize(Kind kind, GLuint name, size_t bytes, const char* format)
+{
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	auto it = t.allocations.find(key(kind, name));
+	if(it == t.allocations.end())
+	{
+		return;
+	}
+	it->second.bytes = bytes;
+	it->second.format = format;
+
+	auto budget = t.budgets.find(it->second.owner);
+	if(budget == t.budgets.end() || budget->second.warned)
+	{
+		return;
+	}
+	size_t ownerBytes = 0;
+	for(const auto& entry : t.allocations)
+	{
+		ownerBytes += entry.second.owner == it->second.owner ? entry.second.bytes : 0;
+	}
+	if(ownerBytes > budget->second.bytes)
+	{
+		budget->second.warned = true;
+		std::cout << "GPU memory of " << it->second.owner << " is " << megabytes(ownerBytes) << ", over its budget of "
+		          << megabytes(budget->second.bytes) << " (" << it->second.site.file << ":" << it->second.site.line
+		          << ").\n";
+	}
+}
+
+size_t textureBytes(GLenum internalFormat, int width, int height, int depth, int levels)
+{
+	const FormatInfo* info = findFormat(internalFormat);
+	const size_t bytesPerTexel = info != nullptr ? info->bytesPerTexel : 4;
+	size_t bytes = 0;
+	for(int level = 0; levels == 0 || level < levels; level++)
+	{
+		bytes += size_t(width) * height * depth * bytesPerTexel;
+		if(width == 1 && height == 1)
+		{
+			break;
+		}
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+	}
+	return bytes;
+}
+
+const char* formatName(GLenum internalFormat)
+{
+	const FormatInfo* info = findFormat(internalFormat);
+	return info != nullptr ? info->name : "unknown";
+}
+
+std::vector<OwnerUsage> usage()
+{
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	std::map<std::string, OwnerUsage> owners;
+	for(const auto& entry : t.allocations)
+	{
+		const Allocation& a = entry.second;
+		OwnerUsage& u = owners[a.owner];
+		if(u.owner.empty())
+		{
+			u = OwnerUsage{ a.owner, 0, 0, { 0 } };
+		}
+		u.bytes += a.bytes;
+		u.objects[a.kind]++;
+	}
+	std::vector<OwnerUsage> result;
+	for(auto& owner : owners)
+	{
+		auto budget = t.budgets.find(owner.first);
+		owner.second.budget = budget != t.budgets.end() ? budget->second.bytes : 0;
+		result.push_back(owner.second);
+	}
+	// largest first
+	std::sort(result.begin(), result.end(),
+	          [](const OwnerUsage& a, const OwnerUsage& b) { return a.bytes > b.bytes; });
+	return result;
+}
+
+size_t totalBytes()
+{
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	size_t bytes = 0;
+	for(const auto& entry : t.allocations)
+	{
+		bytes += entry.second.bytes;
+	}
+	return bytes;
+}
+
+void setBudget(const std::string& owner, size_t bytes)
+{
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	t.budgets[owner] = Budget{ bytes, false };
+}
+
+void gui()
+{
+	const std::vector<OwnerUsage> owners = usage();
+	size_t total = 0;
+	ImGui::Text("%-20s %12s %12s %s", "Owner", "Memory", "Budget", "Objects");
+	for(const OwnerUsage& u : owners)
+	{
+		total += u.bytes;
+		const std::string budget = u.budget > 0 ? megabytes(u.budget) : "-";
+		ImGui::Text("%-20s %12s %12s %d buf, %d tex, %d vao, %d fbo, %d prog%s", u.owner.c_str(),
+		            megabytes(u.bytes).c_str(), budget.c_str(), u.objects[Buffer], u.objects[Texture],
+		            u.objects[VertexArray], u.objects[Framebuffer], u.objects[Program],
+		            u.budget > 0 && u.bytes > u.budget ? "  OVER BUDGET" : "");
+	}
+	ImGui::Text("%-20s %12s", "Total", megabytes(total).c_str());
+}
+
+void logUsage()
+{
+	const std::vector<OwnerUsage> owners = usage();
+	size_t total = 0;
+	std::cout << "GPU memory by owner:\n";
+	for(const OwnerUsage& u : owners)
+	{
+		int objects = 0;
+		for(int kind = 0; kind < NumKinds; kind++)
+		{
+			objects += u.objects[kind];
+		}
+		total += u.bytes;
+		std::cout << "  " << u.owner << ": " << megabytes(u.bytes) << " in " << objects << " objects\n";
+	}
+	std::cout << "  total: " << megabytes(total) << "\n";
+}
+
+int reportLeaks()
+{
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	std::vector<const Allocation*> leaks;
+	for(const auto& entry : t.allocations)
+	{
+		leaks.push_back(&entry.second);
+	}
+	if(leaks.empty())
+	{
+		std::cout << "No GL objects leaked.\n";
+		return 0;
+	}
+	std::sort(leaks.begin(), leaks.end(), [](const Allocation* a, const Allocation* b) {
+		return a->owner != b->owner ? a->owner < b->owner : a->name < b->name;
+	});
+	std::cout << leaks.size() << " GL objects leaked:\n";
+	for(const Allocation* a : leaks)
+	{
+		std::cout << "  " << a->owner << ": " << KindNames[a->kind] << " " << a->name;
+		if(a->bytes > 0)
+		{
+			std::cout << ", " << a->format << " " << megabytes(a->bytes);
+		}
+		std::cout << ", created at " << a->site.file << ":" << a->site.line << "\n";
+	}
+	return int(leaks.size());
+}
+} // namespace glresource
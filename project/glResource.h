@@ -0,0 +1,138 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Bookkeeping for GL objects. Every GlHandle registers itself here with an
+// owner, the subsystem it is counted under, and the place it was created.
+// Owners report the bytes an object holds when they allocate its storage, so
+// the GPU memory of each subsystem can be shown, checked against a budget and
+// any object still alive at shutdown reported as a leak.
+///////////////////////////////////////////////////////////////////////////////
+namespace glresource
+{
+enum Kind
+{
+	Buffer = 0,
+	Texture,
+	VertexArray,
+	Framebuffer,
+	Program,
+	NumKinds
+};
+
+struct Site
+{
+	const char* file;
+	int line;
+};
+/// Creation site of a handle, the caller's file and line
+#define GL_RESOURCE_SITE (glresource::Site{ __FILE__, __LINE__ })
+
+GLuint create(Kind kind);
+void destroy(Kind kind, GLuint name);
+
+void track(Kind kind, GLuint name, const char* owner, Site site);
+void untrack(Kind kind, GLuint name);
+void setSize(Kind kind, GLuint name, size_t bytes, const char* format);
+
+/// Bytes of the first `levels` mip levels of a texture, `levels` 0 for the full chain
+size_t textureBytes(GLenum internalFormat, int width, int height, int depth = 1, int levels = 1);
+const char* formatName(GLenum internalFormat);
+
+struct OwnerUsage
+{
+	std::string owner;
+	size_t bytes;
+	size_t budget; // 0 if there is none
+	int objects[NumKinds];
+};
+std::vector<OwnerUsage> usage();
+size_t totalBytes();
+
+/// Logs a warning the first time `owner` holds more than `bytes`
+void setBudget(const std::string& owner, size_t bytes);
+
+void gui();
+void logUsage();
+/// Prints every object that is still alive with its owner and creation site. Returns how many.
+int reportLeaks();
+} // namespace glresource
+
+///////////////////////////////////////////////////////////////////////////////
+// Owning, move-only GL object name. Converts to GLuint so it can be passed to
+// GL calls as is. Must be reset while the context is current, so objects that
+// outlive main's cleanup should not hold one.
+///////////////////////////////////////////////////////////////////////////////
+template <glresource::Kind K>
+class GlHandle
+{
+public:
+	GlHandle() : m_name(0) {}
+	/// Creates a new object counted under `owner`
+	GlHandle(const char* owner, glresource::Site site) : m_name(glresource::create(K))
+	{
+		glresource::track(K, m_name, owner, site);
+	}
+	~GlHandle() { reset(); }
+
+	GlHandle(GlHandle&& other) noexcept : m_name(other.m_name) { other.m_name = 0; }
+	GlHandle& operator=(GlHandle&& other) noexcept
+	{
+		if(this != &other)
+		{
+			reset();
+			m_name = other.m_name;
+			other.m_name = 0;
+		}
+		return *this;
+	}
+	GlHandle(const GlHandle&) = delete;
+	GlHandle& operator=(const GlHandle&) = delete;
+
+	/// Takes ownership of an object created elsewhere, such as a program from labhelper
+	static GlHandle adopt(GLuint name, const char* owner, glresource::Site site)
+	{
+		GlHandle handle;
+		handle.m_name = name;
+		if(name != 0)
+		{
+			glresource::track(K, name, owner, site);
+		}
+		return handle;
+	}
+
+	GLuint get() const { return m_name; }
+	operator GLuint() const { return m_name; }
+
+	/// Deletes the object, if there is one
+	void reset()
+	{
+		if(m_name != 0)
+		{
+			glresource::untrack(K, m_name);
+			glresource::destroy(K, m_name);
+			m_name = 0;
+		}
+	}
+
+	/// Records the storage the object holds now
+	void setSize(size_t bytes, const char* format) const { glresource::setSize(K, m_name, bytes, format); }
+	void setTextureSize(GLenum internalFormat, int width, int height, int depth = 1, int levels = 1) const
+	{
+		setSize(glresource::textureBytes(internalFormat, width, height, depth, levels),
+		        glresource::formatName(internalFormat));
+	}
+
+private:
+	GLuint m_name;
+};
+
+typedef GlHandle<glresource::Buffer> GlBuffer;
+typedef GlHandle<glresource::Texture> GlTexture;
+typedef GlHandle<glresource::VertexArray> GlVertexArray;
+typedef GlHandle<glresource::Framebuffer> GlFramebuffer;
+typedef GlHandle<glresource::Program> GlProgram;
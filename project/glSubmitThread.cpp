@@ -0,0 +1,102 @@
+#include "glSubmitThread.h"
+
+#include <chrono>
+#include <labhelper.h>
+
+GLSubmitThread::GLSubmitThread()
+    : m_window(nullptr)
+    , m_context(nullptr)
+    , m_recordIndex(0)
+    , m_pending(-1)
+    , m_inFlight{ false, false }
+    , m_stopping(false)
+    , m_replayTime(0.0f)
+    , m_recordedBytes(0)
+    , m_numCommands(0)
+{
+}
+
+GLSubmitThread::~GLSubmitThread()
+{
+	stop();
+}
+
+void GLSubmitThread::start(SDL_Window* window)
+{
+	m_window = window;
+	m_context = SDL_GL_GetCurrentContext();
+	m_stopping = false;
+	SDL_GL_MakeCurrent(m_window, nullptr);
+	m_thread = std::thread(&GLSubmitThread::run, this);
+}
+
+void GLSubmitThread::stop()
+{
+	if(!m_thread.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+	SDL_GL_MakeCurrent(m_window, m_context);
+}
+
+CommandList& GLSubmitThread::beginFrame()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_condition.wait(lock, [this] { return !m_inFlight[m_recordIndex]; });
+	return m_lists[m_recordIndex];
+}
+
+void GLSubmitThread::submitFrame()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_condition.wait(lock, [this] { return m_pending < 0; });
+	m_recordedBytes = m_lists[m_recordIndex].recordedBytes();
+	m_numCommands = m_lists[m_recordIndex].numCommands();
+	m_pending = m_recordIndex;
+	m_inFlight[m_recordIndex] = true;
+	m_recordIndex ^= 1;
+	lock.unlock();
+	m_condition.notify_all();
+}
+
+void GLSubmitThread::run()
+{
+	SDL_GL_MakeCurrent(m_window, m_context);
+	for(;;)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this] { return m_pending >= 0 || m_stopping; });
+			if(m_pending < 0)
+			{
+				break;
+			}
+			index = m_pending;
+			m_pending = -1;
+		}
+		// the main thread may be waiting to queue the next frame
+		m_condition.notify_all();
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		m_lists[index].replay();
+		std::chrono::duration<float, std::milli> replayTime = std::chrono::high_resolution_clock::now() - startTime;
+		m_replayTime = replayTime.count();
+
+		SDL_GL_SwapWindow(m_window);
+		m_lists[index].reset();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_inFlight[index] = false;
+		}
+		m_condition.notify_all();
+	}
+	SDL_GL_MakeCurrent(m_window, nullptr);
+}
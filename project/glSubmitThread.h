@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "commandList.h"
+
+struct SDL_Window;
+
+///////////////////////////////////////////////////////////////////////////////
+// Owns the GL context and replays recorded frames on a dedicated thread.
+// The main thread records frame N+1 into one command list while this thread
+// replays frame N from the other and swaps the window buffers.
+///////////////////////////////////////////////////////////////////////////////
+class GLSubmitThread
+{
+public:
+	GLSubmitThread();
+	~GLSubmitThread();
+
+	/// Moves the GL context current on the calling thread to the submission thread
+	void start(SDL_Window* window);
+
+	/// Replays what is still queued, stops the thread and makes the context current on the caller again
+	void stop();
+
+	/// Returns the list to record the next frame into, waiting until its previous replay finished
+	CommandList& beginFrame();
+
+	/// Queues the list returned by beginFrame() for replay followed by a buffer swap
+	void submitFrame();
+
+	/// Milliseconds spent replaying the last frame, not counting the swap
+	float replayTime() const { return m_replayTime; }
+	/// Size and command count of the last submitted frame
+	size_t recordedBytes() const { return m_recordedBytes; }
+	size_t numCommands() const { return m_numCommands; }
+
+private:
+	void run();
+
+	SDL_Window* m_window;
+	void* m_context;
+
+	CommandList m_lists[2];
+	int m_recordIndex;
+	int m_pending; // list waiting for the thread, -1 if none
+	bool m_inFlight[2];
+	bool m_stopping;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::thread m_thread;
+
+	std::atomic<float> m_replayTime;
+	size_t m_recordedBytes;
+	size_t m_numCommands;
+};
@@ -0,0 +1,172 @@
+#include "headlessContext.h"
+
+#include <GL/glew.h>
+#include <iostream>
+
+#if defined(HAVE_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#elif defined(HAVE_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+HeadlessContext::HeadlessContext() : m_display(nullptr), m_context(nullptr)
+{
+}
+
+HeadlessContext::~HeadlessContext()
+{
+	destroy();
+}
+
+#if defined(HAVE_EGL) || defined(HAVE_OSMESA)
+namespace
+{
+bool initGlew()
+{
+	glewExperimental = GL_TRUE;
+	GLenum error = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// GLEW built for GLX complains without an X display, the entry points are loaded anyway
+	if(error == GLEW_ERROR_NO_GLX_DISPLAY)
+	{
+		error = GLEW_OK;
+	}
+#endif
+	if(error != GLEW_OK)
+	{
+		std::cout << "glewInit failed: " << glewGetErrorString(error) << std::endl;
+		return false;
+	}
+	return true;
+}
+} // namespace
+#endif
+
+#if defined(HAVE_EGL)
+
+bool HeadlessContext::create(int width, int height)
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay != nullptr)
+	{
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if(display == EGL_NO_DISPLAY)
+	{
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+	{
+		std::cout << "Failed to initialize an EGL display" << std::endl;
+		return false;
+	}
+	if(!eglBindAPI(EGL_OPENGL_API))
+	{
+		std::cout << "EGL display does not support desktop OpenGL" << std::endl;
+		eglTerminate(display);
+		return false;
+	}
+
+	// No surface is ever created, but a config is still needed unless the
+	// display supports EGL_KHR_no_config_context
+	const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config = nullptr;
+	EGLint numConfigs = 0;
+	eglChooseConfig(display, configAttributes, &config, 1, &numConfigs);
+
+	const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION,
+		                                 4,
+		                                 EGL_CONTEXT_MINOR_VERSION,
+		                                 3,
+		                                 EGL_CONTEXT_OPENGL_PROFILE_MASK,
+		                                 EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		                                 EGL_NONE };
+	EGLContext context = eglCreateContext(display, numConfigs > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+	                                      contextAttributes);
+	if(context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		std::cout << "Failed to create a surfaceless OpenGL 4.3 context (EGL error 0x" << std::hex << eglGetError()
+		          << std::dec << ")" << std::endl;
+		if(context != EGL_NO_CONTEXT)
+		{
+			eglDestroyContext(display, context);
+		}
+		eglTerminate(display);
+		return false;
+	}
+	m_display = display;
+	m_context = context;
+	return initGlew();
+}
+
+void HeadlessContext::destroy()
+{
+	if(m_context == nullptr)
+	{
+		return;
+	}
+	eglMakeCurrent(EGLDisplay(m_display), EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(EGLDisplay(m_display), EGLContext(m_context));
+	eglTerminate(EGLDisplay(m_display));
+	m_display = m_context = nullptr;
+}
+
+#elif defined(HAVE_OSMESA)
+
+bool HeadlessContext::create(int width, int height)
+{
+	const int attributes[] = { OSMESA_FORMAT,
+		                       OSMESA_RGBA,
+		                       OSMESA_DEPTH_BITS,
+		                       24,
+		                       OSMESA_PROFILE,
+		                       OSMESA_CORE_PROFILE,
+		                       OSMESA_CONTEXT_MAJOR_VERSION,
+		                       4,
+		                       OSMESA_CONTEXT_MINOR_VERSION,
+		                       3,
+		                       0 };
+	OSMesaContext context = OSMesaCreateContextAttribs(attributes, nullptr);
+	if(context == nullptr)
+	{
+		std::cout << "Failed to create an OSMesa OpenGL 4.3 context" << std::endl;
+		return false;
+	}
+	m_buffer.resize(size_t(width) * height * 4);
+	if(!OSMesaMakeCurrent(context, m_buffer.data(), GL_UNSIGNED_BYTE, width, height))
+	{
+		std::cout << "Failed to make the OSMesa context current" << std::endl;
+		OSMesaDestroyContext(context);
+		return false;
+	}
+	m_context = context;
+	return initGlew();
+}
+
+void HeadlessContext::destroy()
+{
+	if(m_context == nullptr)
+	{
+		return;
+	}
+	OSMesaDestroyContext(OSMesaContext(m_context));
+	m_context = nullptr;
+	m_buffer.clear();
+}
+
+#else
+
+bool HeadlessContext::create(int, int)
+{
+	std::cout << "Built without EGL or OSMesa, headless rendering is not available" << std::endl;
+	return false;
+}
+
+void HeadlessContext::destroy()
+{
+}
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenGL context without a window, for running benchmarks on machines with
+// no display or GPU (Mesa llvmpipe). Uses a surfaceless EGL display when
+// built with HAVE_EGL and OSMesa when built with HAVE_OSMESA. There is no
+// default framebuffer worth drawing to, so render into an FboInfo.
+///////////////////////////////////////////////////////////////////////////////
+class HeadlessContext
+{
+public:
+	HeadlessContext();
+	~HeadlessContext();
+
+	/// Creates a 4.3 core context, makes it current and initializes GLEW
+	bool create(int width, int height);
+	void destroy();
+
+private:
+	void* m_display;
+	void* m_context;
+	std::vector<unsigned char> m_buffer; // OSMesa needs a color buffer to make current
+};
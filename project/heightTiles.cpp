@@ -0,0 +1,366 @@
+#include "heightTiles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include <stb_image.h>
+#include "parallelFor.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const char Magic[8] = { 'H', 'T', 'I', 'L', 'E', 'S', '\0', '\0' };
+const uint64_t DataOffset = 4096;
+
+/// Fills the tile at `x`, `y` of `level` with tileSize x tileSize heights
+typedef std::function<void(int level, uint32_t x, uint32_t y, uint16_t* heights)> TileGenerator;
+
+heighttiles::Header makeHeader(uint32_t width, uint32_t height, uint32_t tileSize, float texelSize, float minHeight,
+                               float maxHeight)
+{
+	heighttiles::Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = heighttiles::Version;
+	header.tileSize = tileSize;
+	header.width = width;
+	header.height = height;
+	header.minHeight = minHeight;
+	header.maxHeight = maxHeight;
+	header.texelSize = texelSize;
+
+	// Tiles start on a page boundary, so release() can drop whole tiles.
+	// Levels are added until a single tile covers everything.
+	static_assert(sizeof(heighttiles::Header) <= DataOffset, "Header must fit before the tiles");
+	uint64_t offset = DataOffset;
+	const uint64_t tileBytes = uint64_t(tileSize) * tileSize * sizeof(uint16_t);
+	for(int level = 0; level < heighttiles::MaxLevels; level++)
+	{
+		header.tilesX[level] = heighttiles::tilesForLevel(width, tileSize, level);
+		header.tilesY[level] = heighttiles::tilesForLevel(height, tileSize, level);
+		header.levelOffset[level] = offset;
+		offset += tileBytes * header.tilesX[level] * header.tilesY[level];
+		header.numLevels = level + 1;
+		if(header.tilesX[level] == 1 && header.tilesY[level] == 1)
+		{
+			break;
+		}
+	}
+	return header;
+}
+
+/// Writes the header and then every level, one row of tiles at a time with
+/// the tiles of a row generated in parallel
+bool writeTiles(const std::string& path, const heighttiles::Header& header, const TileGenerator& generate)
+{
+	std::ofstream file(path, std::ios::binary);
+	if(!file)
+	{
+		std::cout << "Failed to write height tiles: " << path << ".\n";
+		return false;
+	}
+	std::vector<char> start(DataOffset, 0);
+	memcpy(start.data(), &header, sizeof(header));
+	file.write(start.data(), start.size());
+
+	const size_t tileTexels = size_t(header.tileSize) * header.tileSize;
+	std::vector<uint16_t> row;
+	for(uint32_t level = 0; level < header.numLevels; level++)
+	{
+		row.resize(tileTexels * header.tilesX[level]);
+		for(uint32_t y = 0; y < header.tilesY[level]; y++)
+		{
+			parallelFor(header.tilesX[level], 1, [&](size_t first, size_t last) {
+				for(size_t x = first; x < last; x++)
+				{
+					generate(level, uint32_t(x), y, &row[x * tileTexels]);
+				}
+			});
+			file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(uint16_t));
+		}
+	}
+	if(!file)
+	{
+		std::cout << "Failed to write height tiles: " << path << ".\n";
+		return false;
+	}
+	return true;
+}
+} // namespace
+
+namespace heighttiles
+{
+float proceduralHeight(double x, double y)
+{
+	// Octaves of rotated sine ridges, cheap enough to generate gigabytes of
+	// terrain and to recompute when checking what was streamed
+	double h = 0.0;
+	double amplitude = 0.5;
+	double frequency = 1.0 / 2048.0;
+	for(int octave = 0; octave < 6; octave++)
+	{
+		const double angle = 0.7 * octave;
+		const double u = (x * cos(angle) - y * sin(angle)) * frequency;
+		const double v = (x * sin(angle) + y * cos(angle)) * frequency;
+		h += amplitude * sin(u + 1.3 * octave) * cos(v * 1.1 + 0.5 * octave);
+		amplitude *= 0.5;
+		frequency *= 2.07;
+	}
+	return std::max(0.0f, std::min(1.0f, float(0.5 + h)));
+}
+
+bool writeProcedural(const std::string& path, uint32_t texels, uint32_t tileSize, float texelSize)
+{
+	const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	const Header header = makeHeader(texels, texels, tileSize, texelSize, -50.0f, 250.0f);
+	const bool written = writeTiles(path, header, [tileSize](int level, uint32_t tx, uint32_t ty, uint16_t* heights) {
+		// coarser levels point sample the same function
+		const double spacing = double(1u << level);
+		for(uint32_t j = 0; j < tileSize; j++)
+		{
+			for(uint32_t i = 0; i < tileSize; i++)
+			{
+				heights[j * tileSize + i] =
+				    heighttiles::quantize(proceduralHeight((tx * tileSize + i) * spacing, (ty * tileSize + j) * spacing));
+			}
+		}
+	});
+	if(written)
+	{
+		const uint64_t tileBytes = uint64_t(tileSize) * tileSize * sizeof(uint16_t);
+		const uint64_t bytes =
+		    header.levelOffset[header.numLevels - 1]
+		    + tileBytes * header.tilesX[header.numLevels - 1] * header.tilesY[header.numLevels - 1];
+		std::chrono::duration<float> time = std::chrono::high_resolution_clock::now() - start;
+		std::cout << "Wrote procedural terrain " << path << ": " << texels << "x" << texels << ", " << header.numLevels
+		          << " levels, " << bytes / (1024 * 1024) << " MiB in " << time.count() << " s.\n";
+	}
+	return written;
+}
+
+bool convertImage(const std::string& imagePath, const std::string& path, uint32_t tileSize, float texelSize,
+                  float heightScale)
+{
+	int width, height, components;
+	stbi_set_flip_vertically_on_load(true);
+	float* data = stbi_loadf(imagePath.c_str(), &width, &height, &components, 1);
+	stbi_set_flip_vertically_on_load(false);
+	if(data == nullptr)
+	{
+		std::cout << "Failed to load image: " << imagePath << ".\n";
+		return false;
+	}
+	const float minValue = *std::min_element(data, data + size_t(width) * height);
+	const float maxValue = std::max(*std::max_element(data, data + size_t(width) * height), minValue + 1e-6f);
+	const Header header =
+	    makeHeader(width, height, tileSize, texelSize, minValue * heightScale, maxValue * heightScale);
+
+	// 2x2 box filtered levels, normalized to [0, 1]
+	struct Image
+	{
+		int width, height;
+		std::vector<float> heights;
+	};
+	std::vector<Image> levels(header.numLevels);
+	levels[0].width = width;
+	levels[0].height = height;
+	levels[0].heights.resize(size_t(width) * height);
+	for(size_t i = 0; i < levels[0].heights.size(); i++)
+	{
+		levels[0].heights[i] = (data[i] - minValue) / (maxValue - minValue);
+	}
+	stbi_image_free(data);
+	for(uint32_t l = 1; l < header.numLevels; l++)
+	{
+		const Image& source = levels[l - 1];
+		Image& level = levels[l];
+		level.width = (source.width + 1) / 2;
+		level.height = (source.height + 1) / 2;
+		level.heights.resize(size_t(level.width) * level.height);
+		for(int y = 0; y < level.height; y++)
+		{
+			for(int x = 0; x < level.width; x++)
+			{
+				const int x1 = std::min(2 * x + 1, source.width - 1);
+				const int y1 = std::min(2 * y + 1, source.height - 1);
+				const float* above = &source.heights[size_t(2 * y) * source.width];
+				const float* below = &source.heights[size_t(y1) * source.width];
+				level.heights[size_t(y) * level.width + x] =
+				    0.25f * (above[2 * x] + above[x1] + below[2 * x] + below[x1]);
+			}
+		}
+	}
+
+	const bool written = writeTiles(path, header, [&](int l, uint32_t tx, uint32_t ty, uint16_t* heights) {
+		// tiles past the edge repeat the last texel
+		const Image& level = levels[l];
+		for(uint32_t j = 0; j < tileSize; j++)
+		{
+			const int y = std::min(int(ty * tileSize + j), level.height - 1);
+			for(uint32_t i = 0; i < tileSize; i++)
+			{
+				const int x = std::min(int(tx * tileSize + i), level.width - 1);
+				heights[j * tileSize + i] = heighttiles::quantize(level.heights[size_t(y) * level.width + x]);
+			}
+		}
+	});
+	if(written)
+	{
+		std::cout << "Converted " << imagePath << " to height tiles " << path << ".\n";
+	}
+	return written;
+}
+} // namespace heighttiles
+
+///////////////////////////////////////////////////////////////////////////////
+// TiledHeightFile
+///////////////////////////////////////////////////////////////////////////////
+TiledHeightFile::TiledHeightFile()
+    : m_mapping(nullptr)
+    , m_mappingSize(0)
+#ifdef _WIN32
+    , m_file(nullptr)
+    , m_fileMapping(nullptr)
+#endif
+    , m_header(nullptr)
+{
+}
+
+TiledHeightFile::~TiledHeightFile()
+{
+	close();
+}
+
+bool TiledHeightFile::open(const std::string& path)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                          FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* mapping = fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if(mapping == nullptr)
+	{
+		if(fileMapping)
+		{
+			CloseHandle(fileMapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_fileMapping = fileMapping;
+	m_mapping = mapping;
+	m_mappingSize = size_t(size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		return false;
+	}
+	m_mapping = mapping;
+	m_mappingSize = size_t(info.st_size);
+#endif
+
+	const heighttiles::Header* header = static_cast<const heighttiles::Header*>(m_mapping);
+	bool valid = m_mappingSize >= sizeof(heighttiles::Header) && memcmp(header->magic, Magic, sizeof(Magic)) == 0
+	             && header->version == heighttiles::Version && header->tileSize > 0 && header->numLevels > 0
+	             && header->numLevels <= heighttiles::MaxLevels;
+	for(uint32_t level = 0; valid && level < header->numLevels; level++)
+	{
+		const uint64_t tileBytes = uint64_t(header->tileSize) * header->tileSize * sizeof(uint16_t);
+		const uint64_t levelBytes = tileBytes * header->tilesX[level] * header->tilesY[level];
+		valid = header->levelOffset[level] <= m_mappingSize && levelBytes <= m_mappingSize - header->levelOffset[level];
+	}
+	if(!valid)
+	{
+		std::cout << "Not a valid height tile file: " << path << ".\n";
+		close();
+		return false;
+	}
+	m_header = header;
+	return true;
+}
+
+void TiledHeightFile::close()
+{
+	if(m_mapping == nullptr)
+	{
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(m_mapping);
+	CloseHandle(m_fileMapping);
+	CloseHandle(m_file);
+	m_file = m_fileMapping = nullptr;
+#else
+	munmap(m_mapping, m_mappingSize);
+#endif
+	m_mapping = nullptr;
+	m_mappingSize = 0;
+	m_header = nullptr;
+}
+
+const uint16_t* TiledHeightFile::tile(int level, int x, int y) const
+{
+	if(level < 0 || level >= int(m_header->numLevels) || x < 0 || y < 0 || x >= int(m_header->tilesX[level])
+	   || y >= int(m_header->tilesY[level]))
+	{
+		return nullptr;
+	}
+	const size_t index = size_t(y) * m_header->tilesX[level] + x;
+	return reinterpret_cast<const uint16_t*>(static_cast<const char*>(m_mapping) + m_header->levelOffset[level]
+	                                         + index * tileBytes());
+}
+
+void TiledHeightFile::release(int level, int x, int y) const
+{
+#ifndef _WIN32
+	// Whole pages inside the tile only, the neighbours may still be read
+	const uint16_t* data = tile(level, x, y);
+	if(data == nullptr)
+	{
+		return;
+	}
+	const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+	const uintptr_t begin = (reinterpret_cast<uintptr_t>(data) + pageSize - 1) & ~(pageSize - 1);
+	const uintptr_t end = (reinterpret_cast<uintptr_t>(data) + tileBytes()) & ~(pageSize - 1);
+	if(end > begin)
+	{
+		madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+	}
+#endif
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+///////////////////////////////////////////////////////////////////////////////
+// Tiled on-disk height format for terrains too large to load at once. Heights
+// are unorm16 between the header's min and max height, stored in square tiles
+// of tileSize x tileSize texels, tile after tile in row-major order. Each level
+// halves the resolution of the one before, down to the level that fits in one
+// tile, so a streamer can page in coarse tiles for distant terrain. Files are
+// read through a memory mapping and only the tiles that are used are touched.
+///////////////////////////////////////////////////////////////////////////////
+namespace heighttiles
+{
+const uint32_t Version = 1;
+const int MaxLevels = 16;
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t tileSize;
+	uint32_t width; // level 0 texels
+	uint32_t height;
+	uint32_t numLevels;
+	float minHeight;
+	float maxHeight;
+	float texelSize; // world units between level 0 texels
+	uint32_t tilesX[MaxLevels];
+	uint32_t tilesY[MaxLevels];
+	uint64_t levelOffset[MaxLevels];
+};
+
+/// Tiles per side of `level` for a level 0 size of `texels`
+inline uint32_t tilesForLevel(uint32_t texels, uint32_t tileSize, int level)
+{
+	const uint32_t levelTexels = (texels + (1u << level) - 1) >> level;
+	return (levelTexels + tileSize - 1) / tileSize;
+}
+
+/// Stored value of a height in [0, 1]
+inline uint16_t quantize(float height)
+{
+	return uint16_t((height < 0.0f ? 0.0f : height > 1.0f ? 1.0f : height) * 65535.0f + 0.5f);
+}
+
+/// Height in [0, 1] of the procedural test terrain at level 0 texel `x`, `y`
+float proceduralHeight(double x, double y);
+
+/// Writes a procedural terrain of `texels` x `texels` heights, generating tiles
+/// in parallel. Returns false if the file could not be written.
+bool writeProcedural(const std::string& path, uint32_t texels, uint32_t tileSize = 256, float texelSize = 1.0f);
+
+/// Converts a height image that fits in memory, building the coarser levels with a box filter
+bool convertImage(const std::string& imagePath, const std::string& path, uint32_t tileSize = 256,
+                  float texelSize = 1.0f, float heightScale = 100.0f);
+} // namespace heighttiles
+
+class TiledHeightFile
+{
+public:
+	TiledHeightFile();
+	~TiledHeightFile();
+
+	/// Maps `path` and validates the header and the size of every level
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const { return m_header != nullptr; }
+
+	const heighttiles::Header& header() const { return *m_header; }
+	size_t tileBytes() const { return size_t(m_header->tileSize) * m_header->tileSize * sizeof(uint16_t); }
+
+	/// Start of the tile in the mapping, nullptr outside the level. Reading it may page the file in.
+	const uint16_t* tile(int level, int x, int y) const;
+	/// Tells the OS the pages of the tile are not needed any more, so resident memory stays bounded
+	void release(int level, int x, int y) const;
+
+private:
+	void* m_mapping;
+	size_t m_mappingSize;
+#ifdef _WIN32
+	void* m_file;
+	void* m_fileMapping;
+#endif
+	const heighttiles::Header* m_header;
+};
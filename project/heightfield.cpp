@@ -1,26 +1,249 @@
 
 #include "heightfield.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <stdint.h>
 #include <vector>
 #include <glm/glm.hpp>
 #include <stb_image.h>
+#include "parallelFor.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHTFIELD_BAKE_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace glm;
 using std::string;
 
+namespace
+{
+typedef std::chrono::high_resolution_clock Clock;
+
+float millisecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Row kernels. Each output texel reads the 3x3 heights around it, rows above
+// and below are clamped at the edges by the caller and columns here. The SIMD
+// kernel does the same float operations in the same order as the scalar one,
+// so the two agree exactly.
+///////////////////////////////////////////////////////////////////////////////
+struct BakeRow
+{
+	const float* above;
+	const float* row;
+	const float* below;
+	int width;
+	float gradientScale;  // heightScale / (8 texelSize), Sobel weights sum to 8 per side
+	float curvatureScale; // -heightScale / texelSize, positive on ridges
+	int16_t* normals;
+	uint8_t* slopeCurvature;
+};
+
+void bakeTexel(const BakeRow& r, int i)
+{
+	const int left = std::max(i - 1, 0);
+	const int right = std::min(i + 1, r.width - 1);
+	const float sx = ((r.above[right] + 2.0f * r.row[right]) + r.below[right])
+	                 - ((r.above[left] + 2.0f * r.row[left]) + r.below[left]);
+	const float sz = ((r.below[left] + 2.0f * r.below[i]) + r.below[right])
+	                 - ((r.above[left] + 2.0f * r.above[i]) + r.above[right]);
+	const float gx = sx * r.gradientScale;
+	const float gz = sz * r.gradientScale;
+	const float gradient = std::sqrt(gx * gx + gz * gz);
+	const float length = std::sqrt(gx * gx + gz * gz + 1.0f);
+	const float laplacian = ((r.above[i] + r.below[i]) + (r.row[left] + r.row[right])) - 4.0f * r.row[i];
+	const float curvature = clamp(laplacian * r.curvatureScale, -1.0f, 1.0f);
+
+	r.normals[2 * i + 0] = int16_t(std::nearbyint(clamp(-gx / length, -1.0f, 1.0f) * 32767.0f));
+	r.normals[2 * i + 1] = int16_t(std::nearbyint(clamp(-gz / length, -1.0f, 1.0f) * 32767.0f));
+	r.slopeCurvature[2 * i + 0] = uint8_t(std::nearbyint(std::min(gradient / length, 1.0f) * 255.0f));
+	r.slopeCurvature[2 * i + 1] = uint8_t(std::nearbyint((curvature * 0.5f + 0.5f) * 255.0f));
+}
+
+#ifdef HEIGHTFIELD_BAKE_SSE2
+/// Texels [i, i + 4), all with both neighbours inside the row
+void bakeTexels4(const BakeRow& r, int i)
+{
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 aboveLeft = _mm_loadu_ps(r.above + i - 1);
+	const __m128 aboveCenter = _mm_loadu_ps(r.above + i);
+	const __m128 aboveRight = _mm_loadu_ps(r.above + i + 1);
+	const __m128 rowLeft = _mm_loadu_ps(r.row + i - 1);
+	const __m128 rowCenter = _mm_loadu_ps(r.row + i);
+	const __m128 rowRight = _mm_loadu_ps(r.row + i + 1);
+	const __m128 belowLeft = _mm_loadu_ps(r.below + i - 1);
+	const __m128 belowCenter = _mm_loadu_ps(r.below + i);
+	const __m128 belowRight = _mm_loadu_ps(r.below + i + 1);
+
+	const __m128 sx =
+	    _mm_sub_ps(_mm_add_ps(_mm_add_ps(aboveRight, _mm_mul_ps(two, rowRight)), belowRight),
+	               _mm_add_ps(_mm_add_ps(aboveLeft, _mm_mul_ps(two, rowLeft)), belowLeft));
+	const __m128 sz =
+	    _mm_sub_ps(_mm_add_ps(_mm_add_ps(belowLeft, _mm_mul_ps(two, belowCenter)), belowRight),
+	               _mm_add_ps(_mm_add_ps(aboveLeft, _mm_mul_ps(two, aboveCenter)), aboveRight));
+	const __m128 gx = _mm_mul_ps(sx, _mm_set1_ps(r.gradientScale));
+	const __m128 gz = _mm_mul_ps(sz, _mm_set1_ps(r.gradientScale));
+	const __m128 squared = _mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gz, gz));
+	const __m128 gradient = _mm_sqrt_ps(squared);
+	const __m128 length = _mm_sqrt_ps(_mm_add_ps(squared, _mm_set1_ps(1.0f)));
+	const __m128 laplacian =
+	    _mm_sub_ps(_mm_add_ps(_mm_add_ps(aboveCenter, belowCenter), _mm_add_ps(rowLeft, rowRight)),
+	               _mm_mul_ps(_mm_set1_ps(4.0f), rowCenter));
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minusOne = _mm_set1_ps(-1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 nx = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_sub_ps(zero, gx), length), minusOne), one);
+	const __m128 nz = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_sub_ps(zero, gz), length), minusOne), one);
+	const __m128 slope = _mm_min_ps(_mm_div_ps(gradient, length), one);
+	const __m128 curvature =
+	    _mm_min_ps(_mm_max_ps(_mm_mul_ps(laplacian, _mm_set1_ps(r.curvatureScale)), minusOne), one);
+
+	// _mm_cvtps_epi32 rounds to nearest even like nearbyint, then interleave into RG pairs
+	const __m128 snorm = _mm_set1_ps(32767.0f);
+	const __m128 unorm = _mm_set1_ps(255.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i nx16 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(nx, snorm)), _mm_setzero_si128());
+	const __m128i nz16 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(nz, snorm)), _mm_setzero_si128());
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(r.normals + 2 * i), _mm_unpacklo_epi16(nx16, nz16));
+
+	const __m128i slope16 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(slope, unorm)), _mm_setzero_si128());
+	const __m128i curvature16 = _mm_packs_epi32(
+	    _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(curvature, half), half), unorm)), _mm_setzero_si128());
+	const __m128i pairs = _mm_packus_epi16(_mm_unpacklo_epi16(slope16, curvature16), _mm_setzero_si128());
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(r.slopeCurvature + 2 * i), pairs);
+}
+#endif
+
+void bakeRow(const BakeRow& r, bool simd)
+{
+	int i = 0;
+	if(r.width > 0)
+	{
+		bakeTexel(r, i++);
+	}
+#ifdef HEIGHTFIELD_BAKE_SSE2
+	// the last texel clamps its right neighbour, so it is left to the scalar kernel
+	for(; simd && i + 4 < r.width; i += 4)
+	{
+		bakeTexels4(r, i);
+	}
+#endif
+	for(; i < r.width; i++)
+	{
+		bakeTexel(r, i);
+	}
+}
+
+void uploadMap(GlTexture& texture, const char* owner, GLint internalFormat, int width, int height, GLenum type,
+               const void* data)
+{
+	if(!texture)
+	{
+		texture = GlTexture(owner, GL_RESOURCE_SITE);
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	// RG8 rows are not 4 byte aligned for odd widths
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RG, type, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	texture.setTextureSize(internalFormat, width, height, 1, 0);
+}
+} // namespace
+
+void bakeHeightFieldMaps(const float* heights, int width, int height, float texelSize, float heightScale,
+                         HeightFieldMaps& maps, bool simd, size_t rowsPerTask)
+{
+	maps.normals.resize(2 * size_t(width) * height);
+	maps.slopeCurvature.resize(2 * size_t(width) * height);
+	parallelFor(size_t(height), rowsPerTask, [&](size_t first, size_t last) {
+		for(size_t j = first; j < last; j++)
+		{
+			BakeRow r;
+			r.above = heights + size_t(j > 0 ? j - 1 : j) * width;
+			r.row = heights + j * width;
+			r.below = heights + size_t(int(j) + 1 < height ? j + 1 : j) * width;
+			r.width = width;
+			r.gradientScale = heightScale / (8.0f * texelSize);
+			r.curvatureScale = -heightScale / texelSize;
+			r.normals = &maps.normals[2 * j * width];
+			r.slopeCurvature = &maps.slopeCurvature[2 * j * width];
+			bakeRow(r, simd);
+		}
+	});
+}
+
+void benchmarkHeightFieldBake(int size)
+{
+	printf("Heightfield bake, %dx%d, %d threads\n", size, size, parallelThreadCount());
+	std::vector<float> heights(size_t(size) * size);
+	parallelFor(size_t(size), 64, [&](size_t first, size_t last) {
+		for(size_t j = first; j < last; j++)
+		{
+			for(int i = 0; i < size; i++)
+			{
+				const float x = float(i) / size;
+				const float y = float(j) / size;
+				heights[j * size + i] = 0.5f + 0.25f * std::sin(40.0f * x) * std::cos(31.0f * y)
+				                        + 0.1f * std::sin(300.0f * (x + y)) + 0.02f * std::sin(2000.0f * x * y);
+			}
+		}
+	});
+
+	const float texelSize = 1000.0f / size;
+	const float heightScale = 100.0f;
+	HeightFieldMaps scalar, simd;
+	// warm up the allocations, then one range on the calling thread for the serial runs
+	bakeHeightFieldMaps(heights.data(), size, size, texelSize, heightScale, simd);
+	bakeHeightFieldMaps(heights.data(), size, size, texelSize, heightScale, scalar, false);
+
+	Clock::time_point start = Clock::now();
+	bakeHeightFieldMaps(heights.data(), size, size, texelSize, heightScale, scalar, false, size);
+	const float scalarMs = millisecondsSince(start);
+	start = Clock::now();
+	bakeHeightFieldMaps(heights.data(), size, size, texelSize, heightScale, simd, true, size);
+	const float simdMs = millisecondsSince(start);
+	start = Clock::now();
+	bakeHeightFieldMaps(heights.data(), size, size, texelSize, heightScale, simd);
+	const float parallelMs = millisecondsSince(start);
+
+	size_t mismatches = 0;
+	for(size_t i = 0; i < scalar.normals.size(); i++)
+	{
+		mismatches += scalar.normals[i] != simd.normals[i] || scalar.slopeCurvature[i] != simd.slopeCurvature[i];
+	}
+	const double megaTexels = double(size) * size / 1e6;
+	printf("%-22s %10s %14s\n", "", "ms", "Mtexels/s");
+	printf("%-22s %10.1f %14.1f\n", "scalar, 1 thread", scalarMs, megaTexels / scalarMs * 1000.0);
+	printf("%-22s %10.1f %14.1f\n", "SIMD, 1 thread", simdMs, megaTexels / simdMs * 1000.0);
+	printf("%-22s %10.1f %14.1f   %.2fx over 1 thread\n", "SIMD, all threads", parallelMs,
+	       megaTexels / parallelMs * 1000.0, simdMs / parallelMs);
+	printf("%zu values differ between the scalar and SIMD kernels\n", mismatches);
+}
+
 HeightField::HeightField(void)
     : m_meshResolution(0)
-    , m_vao(UINT32_MAX)
-    , m_positionBuffer(UINT32_MAX)
-    , m_uvBuffer(UINT32_MAX)
-    , m_indexBuffer(UINT32_MAX)
     , m_numIndices(0)
-    , m_texid_hf(UINT32_MAX)
-    , m_texid_diffuse(UINT32_MAX)
+    , m_owner("Heightfield")
     , m_heightFieldPath("")
     , m_diffuseTexturePath("")
+    , m_worldSize(2.0f)
+    , m_heightScale(1.0f)
+    , m_bakeMs(0.0f)
 {
 }
 
@@ -35,9 +258,9 @@ void HeightField::loadHeightField(const std::string& heigtFieldPath)
 		return;
 	}
 
-	if(m_texid_hf == UINT32_MAX)
+	if(!m_texid_hf)
 	{
-		glGenTextures(1, &m_texid_hf);
+		m_texid_hf = GlTexture(m_owner, GL_RESOURCE_SITE);
 	}
 	glBindTexture(GL_TEXTURE_2D, m_texid_hf);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -47,9 +270,21 @@ void HeightField::loadHeightField(const std::string& heigtFieldPath)
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT,
 	             data); // just one component (float)
+	m_texid_hf.setTextureSize(GL_R32F, width, height);
+
+	// Derived maps, so the shaders shade from one fetch instead of differencing heights
+	const Clock::time_point start = Clock::now();
+	HeightFieldMaps maps;
+	bakeHeightFieldMaps(data, width, height, m_worldSize / width, m_heightScale, maps);
+	m_bakeMs = millisecondsSince(start);
+	stbi_image_free(data);
+	uploadMap(m_texid_normal, m_owner, GL_RG16_SNORM, width, height, GL_SHORT, maps.normals.data());
+	uploadMap(m_texid_slope, m_owner, GL_RG8, width, height, GL_UNSIGNED_BYTE, maps.slopeCurvature.data());
 
 	m_heightFieldPath = heigtFieldPath;
 	std::cout << "Successfully loaded heigh field texture: " << heigtFieldPath << ".\n";
+	std::cout << "Baked normal, slope and curvature maps of " << width << "x" << height << " in " << m_bakeMs
+	          << " ms on " << parallelThreadCount() << " threads.\n";
 }
 
 void HeightField::loadDiffuseTexture(const std::string& diffusePath)
@@ -63,9 +298,9 @@ void HeightField::loadDiffuseTexture(const std::string& diffusePath)
 		return;
 	}
 
-	if(m_texid_diffuse == UINT32_MAX)
+	if(!m_texid_diffuse)
 	{
-		glGenTextures(1, &m_texid_diffuse);
+		m_texid_diffuse = GlTexture(m_owner, GL_RESOURCE_SITE);
 	}
 
 	glBindTexture(GL_TEXTURE_2D, m_texid_diffuse);
@@ -76,6 +311,9 @@ void HeightField::loadDiffuseTexture(const std::string& diffusePath)
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data); // plain RGB
 	glGenerateMipmap(GL_TEXTURE_2D);
+	m_texid_diffuse.setTextureSize(GL_RGB8, width, height, 1, 0);
+	stbi_image_free(data);
+	m_diffuseTexturePath = diffusePath;
 
 	std::cout << "Successfully loaded diffuse texture: " << diffusePath << ".\n";
 }
@@ -85,14 +323,83 @@ void HeightField::generateMesh(int tesselation)
 {
 	// generate a mesh in range -1 to 1 in x and z
 	// (y is 0 but will be altered in height field vertex shader)
+	m_meshResolution = tesselation;
+	const int verticesPerSide = tesselation + 1;
+	std::vector<vec3> positions;
+	std::vector<vec2> uvs;
+	positions.reserve(verticesPerSide * verticesPerSide);
+	uvs.reserve(verticesPerSide * verticesPerSide);
+	for(int z = 0; z < verticesPerSide; z++)
+	{
+		for(int x = 0; x < verticesPerSide; x++)
+		{
+			const vec2 uv = vec2(float(x), float(z)) / float(tesselation);
+			positions.push_back(vec3(uv.x * 2.0f - 1.0f, 0.0f, uv.y * 2.0f - 1.0f));
+			uvs.push_back(uv);
+		}
+	}
+	std::vector<uint32_t> indices;
+	indices.reserve(tesselation * tesselation * 6);
+	for(int z = 0; z < tesselation; z++)
+	{
+		for(int x = 0; x < tesselation; x++)
+		{
+			const uint32_t corner = z * verticesPerSide + x;
+			indices.push_back(corner);
+			indices.push_back(corner + verticesPerSide);
+			indices.push_back(corner + 1);
+			indices.push_back(corner + 1);
+			indices.push_back(corner + verticesPerSide);
+			indices.push_back(corner + verticesPerSide + 1);
+		}
+	}
+	m_numIndices = GLuint(indices.size());
+
+	if(!m_vao)
+	{
+		m_vao = GlVertexArray(m_owner, GL_RESOURCE_SITE);
+		m_positionBuffer = GlBuffer(m_owner, GL_RESOURCE_SITE);
+		m_uvBuffer = GlBuffer(m_owner, GL_RESOURCE_SITE);
+		m_indexBuffer = GlBuffer(m_owner, GL_RESOURCE_SITE);
+	}
+	glBindVertexArray(m_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_positionBuffer);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(vec3), positions.data(), GL_STATIC_DRAW);
+	m_positionBuffer.setSize(positions.size() * sizeof(vec3), "vec3 positions");
+	glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, m_uvBuffer);
+	glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(vec2), uvs.data(), GL_STATIC_DRAW);
+	m_uvBuffer.setSize(uvs.size() * sizeof(vec2), "vec2 uvs");
+	glVertexAttribPointer(2, 2, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(2);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+	m_indexBuffer.setSize(indices.size() * sizeof(uint32_t), "uint32 indices");
+	glBindVertexArray(0);
 }
 
 void HeightField::submitTriangles(void)
 {
-	if(m_vao == UINT32_MAX)
+	if(!m_vao)
 	{
 		std::cout << "No vertex array is generated, cannot draw anything.\n";
 		return;
 	}
+	glBindVertexArray(m_vao);
+	glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+}
 
-}
\ No newline at end of file
+void HeightField::destroy(void)
+{
+	m_texid_hf.reset();
+	m_texid_diffuse.reset();
+	m_texid_normal.reset();
+	m_texid_slope.reset();
+	m_vao.reset();
+	m_positionBuffer.reset();
+	m_uvBuffer.reset();
+	m_indexBuffer.reset();
+	m_numIndices = 0;
+}
@@ -5,13 +5,33 @@ precision highp float;
 
 
 in vec2 texCoord;
+in vec3 viewSpacePosition;
 layout(location = 0) out vec4 fragmentColor;
 
-// This simple fragment shader is meant to be used for debug purposes
-// When the geometry is ok, we will migrate to use shading.frag instead.
+///////////////////////////////////////////////////////////////////////////////
+// Maps baked by HeightField::loadHeightField
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 1) uniform sampler2D normalMap; // x and z of the world space normal
+layout(binding = 2) uniform sampler2D slopeMap;  // sine of the slope angle, curvature biased to [0, 1]
+
+uniform mat4 normalMatrix; // world to view space for normals
+uniform vec3 viewSpaceLightPosition;
 
 void main()
 {
-	//fragmentColor = vec4(texCoord.xy, 0.0, 1.0);
-	fragmentColor = vec4(1, 1, 1, 1);
+	vec2 xz = texture(normalMap, texCoord).rg;
+	vec3 worldNormal = vec3(xz.x, sqrt(max(0.0, 1.0 - dot(xz, xz))), xz.y);
+	vec3 n = normalize((normalMatrix * vec4(worldNormal, 0.0)).xyz);
+	vec3 wi = normalize(viewSpaceLightPosition - viewSpacePosition);
+
+	// rock on steep slopes, darker in hollows
+	vec2 slopeCurvature = texture(slopeMap, texCoord).rg;
+	float curvature = slopeCurvature.y * 2.0 - 1.0;
+	vec3 grass = vec3(0.30, 0.42, 0.18);
+	vec3 rock = vec3(0.45, 0.42, 0.40);
+	vec3 albedo = mix(grass, rock, smoothstep(0.5, 0.7, slopeCurvature.x));
+	float occlusion = clamp(1.0 + 0.5 * curvature, 0.5, 1.0);
+
+	vec3 color = albedo * (0.15 + max(dot(n, wi), 0.0)) * occlusion;
+	fragmentColor = vec4(color, 1.0);
 }
@@ -1,23 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <GL/glew.h>
+#include "glResource.h"
+
+/// Maps derived from a heightfield, one entry per height texel in row-major order
+struct HeightFieldMaps
+{
+	std::vector<int16_t> normals;        // snorm16 x and z of the world space normal, y is positive
+	std::vector<uint8_t> slopeCurvature; // unorm8 sine of the slope angle, and curvature mapped from [-1, 1]
+};
+
+/// Bakes the maps of a `width` x `height` heightfield with Sobel gradients and a
+/// Laplacian for the curvature. `texelSize` is the world distance between
+/// texels and `heightScale` the world height of a height of 1. Rows are split
+/// across parallelFor, `simd` is only for comparing against the scalar kernel.
+void bakeHeightFieldMaps(const float* heights, int width, int height, float texelSize, float heightScale,
+                         HeightFieldMaps& maps, bool simd = true, size_t rowsPerTask = 16);
+
+/// Times bakeHeightFieldMaps on a `size` x `size` procedural heightfield, scalar
+/// and SIMD on one thread and SIMD on all threads, and checks they agree
+void benchmarkHeightFieldBake(int size);
 
 class HeightField
 {
 public:
 	int m_meshResolution; // triangles edges per quad side
-	GLuint m_texid_hf;
-	GLuint m_texid_diffuse;
-	GLuint m_vao;
-	GLuint m_positionBuffer;
-	GLuint m_uvBuffer;
-	GLuint m_indexBuffer;
+	GlTexture m_texid_hf;
+	GlTexture m_texid_diffuse;
+	GlTexture m_texid_normal; // RG16_SNORM, see HeightFieldMaps
+	GlTexture m_texid_slope;  // RG8, see HeightFieldMaps
+	GlVertexArray m_vao;
+	GlBuffer m_positionBuffer;
+	GlBuffer m_uvBuffer;
+	GlBuffer m_indexBuffer;
 	GLuint m_numIndices;
+	const char* m_owner; // GL objects are counted under this in glresource
 	std::string m_heightFieldPath;
 	std::string m_diffuseTexturePath;
+	float m_worldSize;   // world units across the mesh, the maps are baked for this
+	float m_heightScale; // world height of a height of 1
+	float m_bakeMs;
 
 	HeightField(void);
 
-	/// Load height field
+	/// Load height field and bake its normal, slope and curvature maps
 	void loadHeightField(const std::string& heigtFieldPath);
 
 	/// Load diffuse map
@@ -28,4 +58,7 @@ public:
 
 	/// Render height map
 	void submitTriangles(void);
+
+	/// Delete the textures and the mesh
+	void destroy(void);
 };
@@ -13,15 +13,20 @@ uniform mat4 normalMatrix;
 uniform mat4 modelViewMatrix;
 uniform mat4 modelViewProjectionMatrix;
 
+layout(binding = 0) uniform sampler2D heightMap;
+uniform float height_scale; // world height of a height of 1, the model matrix only scales x and z
+
 ///////////////////////////////////////////////////////////////////////////////
 // Output to fragment shader
 ///////////////////////////////////////////////////////////////////////////////
 out vec2 texCoord;
 out vec3 viewSpacePosition;
-out vec3 viewSpaceNormal;
 
 void main()
 {
-	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+	float height = textureLod(heightMap, texCoordIn, 0.0).r;
+	vec4 displaced = vec4(position.x, height * height_scale, position.z, 1.0);
+	gl_Position = modelViewProjectionMatrix * displaced;
+	viewSpacePosition = (modelViewMatrix * displaced).xyz;
 	texCoord = texCoordIn;
 }
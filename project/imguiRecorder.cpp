@@ -0,0 +1,219 @@
+#include "imguiRecorder.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <imgui.h>
+#include <labhelper.h>
+#include "commandList.h"
+
+struct ImGuiRecorder::DrawList
+{
+	const ImDrawVert* vertices;
+	int numVertices;
+	const ImDrawIdx* indices;
+	int numIndices;
+	const ImDrawCmd* commands;
+	int numCommands;
+};
+
+namespace
+{
+// ImGui calls back through a plain function pointer
+ImGuiRecorder* s_recorder = nullptr;
+
+const char* vertexShaderSource = R"(#version 330
+uniform mat4 projectionMatrix;
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 texCoordIn;
+layout(location = 2) in vec4 colorIn;
+out vec2 texCoord;
+out vec4 color;
+void main()
+{
+	texCoord = texCoordIn;
+	color = colorIn;
+	gl_Position = projectionMatrix * vec4(position, 0.0, 1.0);
+}
+)";
+
+const char* fragmentShaderSource = R"(#version 330
+uniform sampler2D fontTexture;
+in vec2 texCoord;
+in vec4 color;
+layout(location = 0) out vec4 fragmentColor;
+void main()
+{
+	fragmentColor = color * texture(fontTexture, texCoord);
+}
+)";
+
+GLuint compileShader(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+	GLint compiled = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if(compiled != GL_TRUE)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		labhelper::fatal_error(std::string("ImGui shader failed to compile:\n") + log);
+	}
+	return shader;
+}
+} // namespace
+
+ImGuiRecorder::ImGuiRecorder()
+    : m_target(nullptr), m_deviceObjectsRecorded(false)
+{
+}
+
+void ImGuiRecorder::record(CommandList& commands)
+{
+	if(!m_deviceObjectsRecorded)
+	{
+		commands.record([this]() { createDeviceObjects(); });
+		m_deviceObjectsRecorded = true;
+	}
+
+	m_target = &commands;
+	s_recorder = this;
+	ImGui::GetIO().RenderDrawListsFn = &ImGuiRecorder::captureDrawLists;
+	ImGui::Render();
+	m_target = nullptr;
+}
+
+void ImGuiRecorder::captureDrawLists(ImDrawData* drawData)
+{
+	ImGuiRecorder* recorder = s_recorder;
+	CommandList& commands = *recorder->m_target;
+	const ImGuiIO& io = ImGui::GetIO();
+
+	// Deep copy, ImGui reuses its buffers as soon as the next frame starts
+	const int numLists = drawData->CmdListsCount;
+	DrawList* lists = static_cast<DrawList*>(commands.allocate(numLists * sizeof(DrawList), alignof(DrawList)));
+	for(int i = 0; i < numLists; i++)
+	{
+		const ImDrawList* source = drawData->CmdLists[i];
+		lists[i].vertices = commands.copy(source->VtxBuffer.Data, source->VtxBuffer.Size);
+		lists[i].numVertices = source->VtxBuffer.Size;
+		lists[i].indices = commands.copy(source->IdxBuffer.Data, source->IdxBuffer.Size);
+		lists[i].numIndices = source->IdxBuffer.Size;
+		lists[i].commands = commands.copy(source->CmdBuffer.Data, source->CmdBuffer.Size);
+		lists[i].numCommands = source->CmdBuffer.Size;
+	}
+
+	const float width = io.DisplaySize.x;
+	const float height = io.DisplaySize.y;
+	const float scaleX = io.DisplayFramebufferScale.x;
+	const float scaleY = io.DisplayFramebufferScale.y;
+	commands.record([recorder, lists, numLists, width, height, scaleX, scaleY]() {
+		recorder->draw(lists, numLists, width, height, scaleX, scaleY);
+	});
+}
+
+void ImGuiRecorder::createDeviceObjects()
+{
+	GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
+	GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
+	m_program = GlProgram("UI", GL_RESOURCE_SITE);
+	glAttachShader(m_program, vertexShader);
+	glAttachShader(m_program, fragmentShader);
+	glLinkProgram(m_program);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	m_vao = GlVertexArray("UI", GL_RESOURCE_SITE);
+	glBindVertexArray(m_vao);
+	m_vertexBuffer = GlBuffer("UI", GL_RESOURCE_SITE);
+	m_indexBuffer = GlBuffer("UI", GL_RESOURCE_SITE);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(ImDrawVert), (void*)offsetof(ImDrawVert, pos));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(ImDrawVert), (void*)offsetof(ImDrawVert, uv));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, true, sizeof(ImDrawVert), (void*)offsetof(ImDrawVert, col));
+	glEnableVertexAttribArray(2);
+	glBindVertexArray(0);
+}
+
+void ImGuiRecorder::destroy()
+{
+	m_vertexBuffer.reset();
+	m_indexBuffer.reset();
+	m_vao.reset();
+	m_program.reset();
+	m_deviceObjectsRecorded = false;
+}
+
+void ImGuiRecorder::draw(const DrawList* lists, int numLists, float displayWidth, float displayHeight,
+                         float scaleX, float scaleY)
+{
+	const int framebufferWidth = int(displayWidth * scaleX);
+	const int framebufferHeight = int(displayHeight * scaleY);
+	if(framebufferWidth == 0 || framebufferHeight == 0)
+	{
+		return;
+	}
+
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_SCISSOR_TEST);
+	glActiveTexture(GL_TEXTURE0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, framebufferWidth, framebufferHeight);
+
+	const float projection[4][4] = { { 2.0f / displayWidth, 0.0f, 0.0f, 0.0f },
+		                             { 0.0f, -2.0f / displayHeight, 0.0f, 0.0f },
+		                             { 0.0f, 0.0f, -1.0f, 0.0f },
+		                             { -1.0f, 1.0f, 0.0f, 1.0f } };
+	glUseProgram(m_program);
+	glUniform1i(glGetUniformLocation(m_program, "fontTexture"), 0);
+	glUniformMatrix4fv(glGetUniformLocation(m_program, "projectionMatrix"), 1, GL_FALSE, &projection[0][0]);
+	glBindVertexArray(m_vao);
+
+	const GLenum indexType = sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	size_t vertexBytes = 0, indexBytes = 0;
+	for(int i = 0; i < numLists; i++)
+	{
+		const DrawList& list = lists[i];
+		vertexBytes = std::max(vertexBytes, list.numVertices * sizeof(ImDrawVert));
+		indexBytes = std::max(indexBytes, list.numIndices * sizeof(ImDrawIdx));
+		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, list.numVertices * sizeof(ImDrawVert), list.vertices, GL_STREAM_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, list.numIndices * sizeof(ImDrawIdx), list.indices, GL_STREAM_DRAW);
+
+		size_t indexOffset = 0;
+		for(int c = 0; c < list.numCommands; c++)
+		{
+			const ImDrawCmd& command = list.commands[c];
+			// User callbacks need the original ImDrawList, which does not survive until the replay
+			if(command.UserCallback == nullptr)
+			{
+				glBindTexture(GL_TEXTURE_2D, GLuint(intptr_t(command.TextureId)));
+				glScissor(int(command.ClipRect.x * scaleX), int(framebufferHeight - command.ClipRect.w * scaleY),
+				          int((command.ClipRect.z - command.ClipRect.x) * scaleX),
+				          int((command.ClipRect.w - command.ClipRect.y) * scaleY));
+				glDrawElements(GL_TRIANGLES, GLsizei(command.ElemCount), indexType,
+				               (void*)(indexOffset * sizeof(ImDrawIdx)));
+			}
+			indexOffset += command.ElemCount;
+		}
+	}
+	// the buffers are respecified per list, count the largest as what they hold
+	m_vertexBuffer.setSize(vertexBytes, "ImDrawVert");
+	m_indexBuffer.setSize(indexBytes, "ImDrawIdx");
+
+	// Back to the state the rest of the frame expects
+	glBindVertexArray(0);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+}
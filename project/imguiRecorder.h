@@ -0,0 +1,39 @@
+#pragma once
+
+#include <GL/glew.h>
+#include "glResource.h"
+
+class CommandList;
+struct ImDrawData;
+
+///////////////////////////////////////////////////////////////////////////////
+// Records the ImGui draw lists into a command list instead of drawing them
+// directly, so the GUI can be built on the main thread and rendered on the
+// thread that owns the GL context. Draws with its own small GL renderer.
+///////////////////////////////////////////////////////////////////////////////
+class ImGuiRecorder
+{
+public:
+	ImGuiRecorder();
+
+	/// Ends the current ImGui frame and records its draw lists into `commands`
+	void record(CommandList& commands);
+
+	/// Frees the GL objects, needs the GL context
+	void destroy();
+
+private:
+	struct DrawList;
+
+	static void captureDrawLists(ImDrawData* drawData);
+	void createDeviceObjects();
+	void draw(const DrawList* lists, int numLists, float displayWidth, float displayHeight, float scaleX,
+	          float scaleY);
+
+	CommandList* m_target;
+	bool m_deviceObjectsRecorded;
+	GlProgram m_program;
+	GlVertexArray m_vao;
+	GlBuffer m_vertexBuffer;
+	GlBuffer m_indexBuffer;
+};
@@ -9,6 +9,8 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 #include <cstdlib>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <iostream>
 
 #include <labhelper.h>
 #include <imgui.h>
@@ -18,10 +20,23 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 #include <glm/gtx/transform.hpp>
 using namespace glm;
 
-#include <Model.h>
 #include "hdr.h"
 #include "fbo.h"
 #include "ParticleSystem.h"
+#include "geometryArena.h"
+#include "simulation.h"
+#include "glSubmitThread.h"
+#include "imguiRecorder.h"
+#include "profiler.h"
+#include "benchScript.h"
+#include "headlessContext.h"
+#include "spatialGrid.h"
+#include "envCubemap.h"
+#include "heightfield.h"
+#include "terrainStreamer.h"
+#include "frameCapture.h"
+#include "dynamicResolution.h"
+#include "shaderReloader.h"
 #include <stb_image.h>
 using std::min;
 using std::max;
@@ -36,6 +51,22 @@ float deltaTime = 0.0f;
 bool showUI = false;
 int windowWidth, windowHeight;
 
+// The GL context lives on this thread, frames are recorded into command lists for it
+GLSubmitThread glThread;
+ImGuiRecorder imguiRecorder;
+
+// Per pass CPU and GPU timings
+Profiler profiler;
+int shadowPass, backgroundPass, scenePass, particlePreparePass, particleDepthPass, particlePass,
+    particleUpsamplePass, presentPass, uiPass;
+
+// Framebuffer the camera view is drawn to, the window or the benchmark's offscreen target
+GLuint renderTarget = 0;
+
+// Interactive input is written to a benchmark script when started with --record-script
+bool recordingScript = false;
+BenchScript recordedScript;
+
 // Mouse input
 ivec2 g_prevMouseCoords = { -1, -1 };
 bool g_isMouseDragging = false;
@@ -43,23 +74,27 @@ bool g_isMouseDragging = false;
 ///////////////////////////////////////////////////////////////////////////////
 // Shader programs
 ///////////////////////////////////////////////////////////////////////////////
-GLuint shaderProgram;       
-GLuint simpleShaderProgram; // Shader used to draw the shadow map 
-GLuint backgroundProgram; 
-GLuint particleShaderProgram; 
+GlProgram shaderProgram;       
+GlProgram simpleShaderProgram; // Shader used to draw the light source
+GlProgram shadowShaderProgram; // Shader used to draw the shadow map
+GlProgram cullProgram;         // Compute shader writing the indirect draw commands
+GlProgram backgroundProgram; 
+GlProgram particleShaderProgram; 
+GlProgram particleOitProgram;
+GlProgram particleResolveProgram;
 //GLuint basicShaderProgram;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Environment
 ///////////////////////////////////////////////////////////////////////////////
 float environment_multiplier = 1.5f;
-GLuint environmentMap, irradianceMap, reflectionMap;
+GlTexture environmentMap, irradianceMap, reflectionMap;
 const std::string envmap_base_name = "001";
 ///////////////////////////////////////////////////////////////////////////////
 // Light source copy from labs before
 ///////////////////////////////////////////////////////////////////////////////
 vec3 lightPosition; 
-float lightAzimuth = 0.f; 
+float lightAzimuth = 0.f; // interpolated from the simulation every frame
 float lightZenith = 45.f; 
 float lightDistance = 55.f; 
 bool animateLight = false; 
@@ -78,7 +113,7 @@ enum ClampMode
 	Edge = 1,
 	Border = 2
 };
-FboInfo shadowMapFB;
+FboInfo shadowMapFB(1, "Shadow map");
 int shadowMapResolution = 512;
 int shadowMapClampMode = ClampMode::Border; // ClampMode::Edge
 bool shadowMapClampBorderShadowed = false;
@@ -101,53 +136,124 @@ vec3 worldUp(0.0f, 1.0f, 0.0f);
 ///////////////////////////////////////////////////////////////////////////////
 // Models
 ///////////////////////////////////////////////////////////////////////////////
-labhelper::Model* fighterModel = nullptr;
-labhelper::Model* landingpadModel = nullptr;
+CachedModel* fighterModel = nullptr;
+CachedModel* landingpadModel = nullptr;
+
+// All models packed into one set of buffers, drawn with multi draw indirect
+GeometryArena sceneArena;
+int fighterInstance;
+int landingpadInstance;
+bool useGpuCulling = false;
+
+// Landing pad triangles binned for the particles to bounce off
+TriangleGrid landingpadCollider;
 
 mat4 roomModelMatrix;
 mat4 landingPadModelMatrix;
 mat4 fighterModelMatrix;
 
-//like task1. add translation and rotation matrix for ship 
-mat4 T(1.0f), R(1.0f); 
-
-float shipSpeed = 50; 
-// Particles
-ParticleSystem particle_system(10000); 
-mat4 particleRotationMatrix; 
-GLuint explosionTexture; //particles texture
-
-void loadShaders(bool is_reload)
+// Ship, light and particles are simulated at a fixed rate on their own thread
+const int maxParticles = 2000000;
+Simulation simulation(maxParticles);
+uint32_t shipControls = 0; // ShipControl bits last sent to the simulation
+
+// Particles, simulated by `simulation` and drawn through this one
+ParticleSystem particle_system(maxParticles); 
+GlTexture explosionTexture; //particles texture
+int particlesPerTick = 1;
+int numParticles = 0;
+bool particleCollision = true;
+float particleRepulsionRadius = 0.0f;
+float particleGridBuildMs = 0.0f;
+float particleGridQueryMs = 0.0f;
+
+// How the particles are composited over the scene
+enum ParticleMode
 {
-	GLuint shader = labhelper::loadShaderProgram("../project/simple.vert", "../project/simple.frag",
-	                                             is_reload);
-	if(shader != 0)
-	{
-		simpleShaderProgram = shader;
-	}
+	SortedBlend = 0, // sorted back to front on the cpu, alpha blended
+	WeightedOit = 1  // unsorted, weighted blended order-independent transparency
+};
+int particleMode = SortedBlend;
+// ParticleVertexFormat uploaded each frame, ParticleFloat4 is kept for comparison
+int particleFormat = ParticlePacked;
 
-	shader = labhelper::loadShaderProgram("../project/fullscreenQuad.vert", "../project/background.frag",
-	                                      is_reload);
-	if(shader != 0)
-	{
-		backgroundProgram = shader;
-	}
+///////////////////////////////////////////////////////////////////////////////
+// The camera view is drawn here and copied to the render target at the end,
+// so passes after the scene can read its depth
+///////////////////////////////////////////////////////////////////////////////
+FboInfo sceneFB;
+// Accumulation and revealage targets for WeightedOit
+FboInfo particleOitFB(2, "Particles");
+// Particles drawn at 1/particleDivisor of the window size, 1 draws them straight into sceneFB
+int particleDivisor = 1;
+FboInfo particleLowResFB(1, "Particles");
+GlProgram depthDownsampleProgram;
+GlProgram particleUpsampleProgram;
+
+// The camera view is rendered at a fraction of the window size that keeps the
+// GPU time within a budget, then upscaled. The targets above are allocated at
+// the window size and drawn with a viewport, so the scale changes freely.
+DynamicResolution dynamicResolution;
+float upscaleSharpness = 0.5f;
+GlProgram upscaleProgram;
 
-	shader = labhelper::loadShaderProgram("../project/shading.vert", "../project/shading.frag", is_reload);
-	if(shader != 0)
-	{
-		shaderProgram = shader;
-	}
-	//shader = labhelper::loadShaderProgram("../project/basic.vert", "../project/basic.frag", false);
-	//if (shader != 0)
-	//{
-	//	basicShaderProgram = shader;
-	//}//
+///////////////////////////////////////////////////////////////////////////////
+// Terrain streamed from a tile file given with --terrain, drawn as one grid
+// per resident clipmap level
+///////////////////////////////////////////////////////////////////////////////
+TerrainStreamer terrain;
+HeightField terrainMesh;
+GlProgram terrainProgram;
+std::string terrainPath;
+const int terrainUploadsPerFrame = 8;
+
+// Heightfield image given with --heightfield, drawn with its baked normal, slope and curvature maps
+HeightField heightfield;
+GlProgram heightfieldProgram;
+std::string heightfieldPath;
+mat4 heightfieldModelMatrix;
+
+///////////////////////////////////////////////////////////////////////////////
+// Every shader program and the files it is built from, a compute shader if
+// there is no fragment shader. The reloader rebuilds a program in the
+// background when one of its files changes.
+///////////////////////////////////////////////////////////////////////////////
+struct ShaderFiles
+{
+	GlProgram* program;
+	const char* vertexShader;
+	const char* fragmentShader;
+};
+const ShaderFiles shaderFiles[] = {
+	{ &simpleShaderProgram, "../project/simple.vert", "../project/simple.frag" },
+	{ &shadowShaderProgram, "../project/shadow.vert", "../project/simple.frag" },
+	{ &cullProgram, "../project/cullDraws.comp", nullptr },
+	{ &backgroundProgram, "../project/fullscreenQuad.vert", "../project/background.frag" },
+	{ &shaderProgram, "../project/shading.vert", "../project/shading.frag" },
+	//{ &basicShaderProgram, "../project/basic.vert", "../project/basic.frag" },
+	{ &particleShaderProgram, "../project/particle.vert", "../project/particle.frag" },
+	{ &particleOitProgram, "../project/particle.vert", "../project/particleOit.frag" },
+	{ &particleResolveProgram, "../project/fullscreenQuad.vert", "../project/particleResolve.frag" },
+	{ &depthDownsampleProgram, "../project/fullscreenQuad.vert", "../project/depthDownsample.frag" },
+	{ &particleUpsampleProgram, "../project/fullscreenQuad.vert", "../project/particleUpsample.frag" },
+	{ &upscaleProgram, "../project/fullscreenQuad.vert", "../project/upscale.frag" },
+	{ &terrainProgram, "../project/terrainClipmap.vert", "../project/terrainClipmap.frag" },
+	{ &heightfieldProgram, "../project/heightfield.vert", "../project/heightfield.frag" },
+};
+ShaderReloader shaderReloader;
 
-	shader = labhelper::loadShaderProgram("../project/particle.vert", "../project/particle.frag", false);
-	if (shader != 0)
+void loadShaders()
+{
+	for(const ShaderFiles& files : shaderFiles)
 	{
-		particleShaderProgram = shader;
+		const GLuint shader =
+		    files.fragmentShader != nullptr
+		        ? labhelper::loadShaderProgram(files.vertexShader, files.fragmentShader, false)
+		        : loadComputeShaderProgram(files.vertexShader);
+		if(shader != 0)
+		{
+			*files.program = GlProgram::adopt(shader, "Shaders", GL_RESOURCE_SITE);
+		}
 	}
 }
 
@@ -163,18 +269,33 @@ void initialize()
 	///////////////////////////////////////////////////////////////////////
 	//		Load Shaders
 	///////////////////////////////////////////////////////////////////////
-	loadShaders(false);
+	loadShaders();
+	for(const ShaderFiles& files : shaderFiles)
+	{
+		shaderReloader.add(files.program, files.vertexShader, files.fragmentShader ? files.fragmentShader : "");
+	}
 
 	///////////////////////////////////////////////////////////////////////
 	// Load models and set up model matrices
 	///////////////////////////////////////////////////////////////////////
-	fighterModel = labhelper::loadModelFromOBJ("../scenes/space-ship.obj");
-	landingpadModel = labhelper::loadModelFromOBJ("../scenes/landingpad.obj");
+	fighterModel = CachedModel::load("../scenes/space-ship.obj");
+	landingpadModel = CachedModel::load("../scenes/landingpad.obj");
+	if(fighterModel == nullptr || landingpadModel == nullptr)
+	{
+		labhelper::fatal_error("Failed to load the scene models");
+	}
 
 	roomModelMatrix = mat4(1.0f);
 	fighterModelMatrix = translate(15.0f * worldUp);
 	landingPadModelMatrix = mat4(1.0f);
 
+	fighterInstance = sceneArena.addModel(fighterModel);
+	landingpadInstance = sceneArena.addModel(landingpadModel);
+	sceneArena.upload();
+
+	landingpadCollider.build(*landingpadModel, landingPadModelMatrix, 2.0f);
+	simulation.setCollider(&landingpadCollider);
+
 	///////////////////////////////////////////////////////////////////////
 	// Load environment map
 	///////////////////////////////////////////////////////////////////////
@@ -183,9 +304,13 @@ void initialize()
 	for(int i = 0; i < roughnesses; i++)
 		filenames.push_back("../scenes/envmaps/" + envmap_base_name + "_dl_" + std::to_string(i) + ".hdr");
 
-	environmentMap = labhelper::loadHdrTexture("../scenes/envmaps/" + envmap_base_name + ".hdr");
-	irradianceMap = labhelper::loadHdrTexture("../scenes/envmaps/" + envmap_base_name + "_irradiance.hdr");
-	reflectionMap = labhelper::loadHdrMipmapTexture(filenames);
+	environmentMap = envmap::loadCubemap("../scenes/envmaps/" + envmap_base_name + ".hdr");
+	irradianceMap = envmap::loadCubemap("../scenes/envmaps/" + envmap_base_name + "_irradiance.hdr");
+	reflectionMap = envmap::loadPrefilteredCubemap(filenames);
+	if(environmentMap == 0 || irradianceMap == 0 || reflectionMap == 0)
+	{
+		labhelper::fatal_error("Failed to load the environment maps");
+	}
 
 
 	///////////////////////////////////////////////////////////////////////
@@ -206,13 +331,49 @@ void initialize()
 	// Particles
 	particle_system.init_gpu_data();
 
+	// Terrain
+	if(!terrainPath.empty())
+	{
+		if(!terrain.open(terrainPath))
+		{
+			labhelper::fatal_error("Failed to open the terrain " + terrainPath);
+		}
+		terrain.createTexture();
+		terrainMesh.m_owner = "Terrain";
+		terrainMesh.generateMesh(256);
+	}
+	if(!heightfieldPath.empty())
+	{
+		// 1 km across, below the landing pad
+		heightfield.m_worldSize = 1000.0f;
+		heightfield.m_heightScale = 100.0f;
+		heightfield.loadHeightField(heightfieldPath);
+		heightfield.generateMesh(512);
+		heightfieldModelMatrix = translate(vec3(0.0f, -110.0f, 0.0f)) * scale(vec3(500.0f, 1.0f, 500.0f));
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Profiler passes, in the order they run
+	///////////////////////////////////////////////////////////////////////
+	shadowPass = profiler.addPass("Shadow map", Profiler::GLThread);
+	backgroundPass = profiler.addPass("Background", Profiler::GLThread);
+	scenePass = profiler.addPass("Scene", Profiler::GLThread);
+	particlePreparePass = profiler.addPass("Particle prepare", Profiler::MainThread);
+	particleDepthPass = profiler.addPass("Particle depth", Profiler::GLThread);
+	particlePass = profiler.addPass("Particles", Profiler::GLThread);
+	particleUpsamplePass = profiler.addPass("Particle upsample", Profiler::GLThread);
+	presentPass = profiler.addPass("Present", Profiler::GLThread);
+	uiPass = profiler.addPass("UI", Profiler::GLThread);
+	profiler.createQueries();
+
 	// Load Explosion (thrust) texture
 	int expw, exph, expcomp;
 	unsigned char* expimage = stbi_load("../scenes/textures/explosion.png", &expw, &exph, &expcomp, STBI_rgb_alpha);
 
-	glGenTextures(1, &explosionTexture);
+	explosionTexture = GlTexture("Particles", GL_RESOURCE_SITE);
 	glBindTexture(GL_TEXTURE_2D, explosionTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, expw, exph, 0, GL_RGBA, GL_UNSIGNED_BYTE, expimage);
+	explosionTexture.setTextureSize(GL_RGBA, expw, exph, 1, 0);
 	free(expimage);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -223,8 +384,105 @@ void initialize()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16.0f);
+
+	glresource::logUsage();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Print Screen captures one frame and F9 starts and stops a frame sequence.
+// Frames are read back and written on worker threads, see FrameCapture.
+///////////////////////////////////////////////////////////////////////////////
+FrameCapture frameCapture;
+bool screenshotRequested = false;
+bool captureSequence = false;
+int captureFormat = FrameCapture::Png;
+std::string capturePrefix = "capture";
+int screenshotIndex = 0;
+int sequenceIndex = 0; // sequences started
+int sequenceFrame = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Deletes everything initialize() and the frames created, while the context
+/// is still current, then reports whatever is left as leaked
+///////////////////////////////////////////////////////////////////////////////
+void destroyGpuResources()
+{
+	GlProgram* programs[] = { &shaderProgram,           &simpleShaderProgram,    &shadowShaderProgram,
+		                      &cullProgram,             &backgroundProgram,      &particleShaderProgram,
+		                      &particleOitProgram,      &particleResolveProgram, &depthDownsampleProgram,
+		                      &particleUpsampleProgram, &terrainProgram,         &heightfieldProgram,
+		                      &upscaleProgram };
+	for(GlProgram* program : programs)
+	{
+		program->reset();
+	}
+	environmentMap.reset();
+	irradianceMap.reset();
+	reflectionMap.reset();
+	explosionTexture.reset();
+
+	shadowMapFB.destroy();
+	sceneFB.destroy();
+	particleOitFB.destroy();
+	particleLowResFB.destroy();
+
+	sceneArena.destroy();
+	particle_system.destroy_gpu_data();
+	terrain.destroyTexture();
+	terrainMesh.destroy();
+	heightfield.destroy();
+	imguiRecorder.destroy();
+
+	// Models own their textures
+	delete fighterModel;
+	delete landingpadModel;
+	fighterModel = nullptr;
+	landingpadModel = nullptr;
+
+	glresource::reportLeaks();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Everything a frame reads from the globals, copied when it is recorded so
+/// the main thread can go on with the next frame while this one is replayed
+///////////////////////////////////////////////////////////////////////////////
+struct FrameState
+{
+	GLuint framebuffer;
+	// The camera view is rendered at renderWidth x renderHeight into targets of
+	// outputWidth x outputHeight, the window size it is upscaled to
+	int renderWidth;
+	int renderHeight;
+	int outputWidth;
+	int outputHeight;
+	float upscaleSharpness;
+	mat4 viewMatrix;
+	mat4 projMatrix;
+	mat4 lightViewMatrix;
+	mat4 lightProjMatrix;
+	vec3 cameraPosition;
+	vec3 lightPosition;
+	mat4 fighterModelMatrix;
+	mat4 landingPadModelMatrix;
+	float environment_multiplier;
+	bool useGpuCulling;
+	int particleMode;
+	int particleFormat;
+	int particleDivisor;
+
+	int shadowMapResolution;
+	int shadowMapClampMode;
+	bool shadowMapClampBorderShadowed;
+	bool usePolygonOffset;
+	bool useHardwarePCF;
+	float polygonOffset_factor;
+	float polygonOffset_units;
+
+	bool drawTerrain;
+	bool drawHeightField;
+	TerrainStreamer::ValidRegion terrainRegions[heighttiles::MaxLevels];
+};
+
 void debugDrawLight(const glm::mat4& viewMatrix,
                     const glm::mat4& projectionMatrix,
                     const glm::vec3& worldSpaceLightPos)
@@ -240,12 +498,83 @@ void debugDrawLight(const glm::mat4& viewMatrix,
 
 
 
-void drawBackground(const mat4& viewMatrix, const mat4& projectionMatrix)
+///////////////////////////////////////////////////////////////////////////////
+/// Draws a grid over the valid region of every level, finest first. Each grid
+/// discards what the finer one before it covers.
+///////////////////////////////////////////////////////////////////////////////
+void drawTerrain(const FrameState& frame)
+{
+	const heighttiles::Header& header = terrain.header();
+	vec4 regions[heighttiles::MaxLevels];
+	for(int level = 0; level < heighttiles::MaxLevels; level++)
+	{
+		const TerrainStreamer::ValidRegion& region = frame.terrainRegions[level];
+		regions[level] = region.valid ? vec4(region.min, region.max) : vec4(1.0f, 1.0f, 0.0f, 0.0f);
+	}
+
+	glUseProgram(terrainProgram);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.texture());
+	glUniform4fv(glGetUniformLocation(terrainProgram, "valid_region"), heighttiles::MaxLevels, &regions[0].x);
+	labhelper::setUniformSlow(terrainProgram, "modelViewProjectionMatrix", frame.projMatrix * frame.viewMatrix);
+	labhelper::setUniformSlow(terrainProgram, "modelViewMatrix", frame.viewMatrix);
+	labhelper::setUniformSlow(terrainProgram, "normalMatrix", inverse(transpose(frame.viewMatrix)));
+	labhelper::setUniformSlow(terrainProgram, "clipmap_size", float(header.tileSize * TerrainStreamer::WindowTiles));
+	labhelper::setUniformSlow(terrainProgram, "num_levels", int(header.numLevels));
+	labhelper::setUniformSlow(terrainProgram, "texel_size", header.texelSize);
+	glUniform2f(glGetUniformLocation(terrainProgram, "terrain_size"), float(header.width), float(header.height));
+	// keep the terrain below the landing pad
+	const float offset = -header.maxHeight - 10.0f;
+	glUniform2f(glGetUniformLocation(terrainProgram, "height_range"), header.minHeight + offset,
+	            header.maxHeight + offset);
+
+	vec4 inner(1.0f, 1.0f, 0.0f, 0.0f);
+	for(int level = 0; level < int(header.numLevels); level++)
+	{
+		if(!frame.terrainRegions[level].valid)
+		{
+			continue;
+		}
+		const float scale = float(1 << level);
+		const vec2 lo = frame.terrainRegions[level].min * scale;
+		const vec2 hi = frame.terrainRegions[level].max * scale;
+		labhelper::setUniformSlow(terrainProgram, "clipmap_level", level);
+		glUniform2f(glGetUniformLocation(terrainProgram, "grid_center"), 0.5f * (lo.x + hi.x), 0.5f * (lo.y + hi.y));
+		glUniform2f(glGetUniformLocation(terrainProgram, "grid_half_extent"), 0.5f * (hi.x - lo.x),
+		            0.5f * (hi.y - lo.y));
+		labhelper::setUniformSlow(terrainProgram, "inner_region", inner);
+		terrainMesh.submitTriangles();
+		inner = vec4(lo, hi);
+	}
+}
+
+void drawHeightField(const FrameState& frame)
+{
+	glUseProgram(heightfieldProgram);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, heightfield.m_texid_hf);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, heightfield.m_texid_normal);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, heightfield.m_texid_slope);
+	glActiveTexture(GL_TEXTURE0);
+	labhelper::setUniformSlow(heightfieldProgram, "modelViewProjectionMatrix",
+	                          frame.projMatrix * frame.viewMatrix * heightfieldModelMatrix);
+	labhelper::setUniformSlow(heightfieldProgram, "modelViewMatrix", frame.viewMatrix * heightfieldModelMatrix);
+	// the baked normals are in world space
+	labhelper::setUniformSlow(heightfieldProgram, "normalMatrix", inverse(transpose(frame.viewMatrix)));
+	labhelper::setUniformSlow(heightfieldProgram, "height_scale", heightfield.m_heightScale);
+	labhelper::setUniformSlow(heightfieldProgram, "viewSpaceLightPosition",
+	                          vec3(frame.viewMatrix * vec4(frame.lightPosition, 1.0f)));
+	heightfield.submitTriangles();
+}
+
+void drawBackground(const FrameState& frame)
 {
 	glUseProgram(backgroundProgram);
-	labhelper::setUniformSlow(backgroundProgram, "environment_multiplier", environment_multiplier);
-	labhelper::setUniformSlow(backgroundProgram, "inv_PV", inverse(projectionMatrix * viewMatrix));
-	labhelper::setUniformSlow(backgroundProgram, "camera_pos", cameraPosition);
+	labhelper::setUniformSlow(backgroundProgram, "environment_multiplier", frame.environment_multiplier);
+	labhelper::setUniformSlow(backgroundProgram, "inv_PV", inverse(frame.projMatrix * frame.viewMatrix));
+	labhelper::setUniformSlow(backgroundProgram, "camera_pos", frame.cameraPosition);
 	labhelper::drawFullScreenQuad();
 }
 
@@ -254,116 +583,90 @@ void drawBackground(const mat4& viewMatrix, const mat4& projectionMatrix)
 /// This function is used to draw the main objects on the scene
 ///////////////////////////////////////////////////////////////////////////////
 void drawScene(GLuint currentShaderProgram,
+               const FrameState& frame,
                const mat4& viewMatrix,
                const mat4& projectionMatrix,
-               const mat4& lightViewMatrix,
-               const mat4& lightProjectionMatrix)
+               bool submitMaterials)
 {
+	// Cull against the current view and write the indirect commands for this pass
+	sceneArena.setModelMatrix(landingpadInstance, frame.landingPadModelMatrix);
+	sceneArena.setModelMatrix(fighterInstance, frame.fighterModelMatrix);
+	if(frame.useGpuCulling)
+	{
+		sceneArena.buildCommandsGpu(cullProgram, projectionMatrix * viewMatrix);
+	}
+	else
+	{
+		sceneArena.buildCommandsCpu(projectionMatrix * viewMatrix);
+	}
+
 	glUseProgram(currentShaderProgram);
 	// Light source
-	vec4 viewSpaceLightPosition = viewMatrix * vec4(lightPosition, 1.0f);
+	vec4 viewSpaceLightPosition = viewMatrix * vec4(frame.lightPosition, 1.0f);
 	labhelper::setUniformSlow(currentShaderProgram, "point_light_color", point_light_color);
 	labhelper::setUniformSlow(currentShaderProgram, "point_light_intensity_multiplier",
 	                          point_light_intensity_multiplier);
 	labhelper::setUniformSlow(currentShaderProgram, "viewSpaceLightPosition", vec3(viewSpaceLightPosition));
 	labhelper::setUniformSlow(currentShaderProgram, "viewSpaceLightDir",
-	                          normalize(vec3(viewMatrix * vec4(-lightPosition, 0.0f))));
+	                          normalize(vec3(viewMatrix * vec4(-frame.lightPosition, 0.0f))));
 
-	mat4 lightMatrix = translate(vec3(0.5f)) * scale(vec3(0.5f)) * lightProjectionMatrix * lightViewMatrix * inverse(viewMatrix);
+	mat4 lightMatrix = translate(vec3(0.5f)) * scale(vec3(0.5f)) * frame.lightProjMatrix * frame.lightViewMatrix * inverse(viewMatrix);
 	labhelper::setUniformSlow(currentShaderProgram, "lightMatrix", lightMatrix);
 
 	// Environment
-	labhelper::setUniformSlow(currentShaderProgram, "environment_multiplier", environment_multiplier);
+	labhelper::setUniformSlow(currentShaderProgram, "environment_multiplier", frame.environment_multiplier);
 
 	// camera
 	labhelper::setUniformSlow(currentShaderProgram, "viewInverse", inverse(viewMatrix));
+	labhelper::setUniformSlow(currentShaderProgram, "viewMatrix", viewMatrix);
+	labhelper::setUniformSlow(currentShaderProgram, "projectionMatrix", projectionMatrix);
+	labhelper::setUniformSlow(currentShaderProgram, "viewProjectionMatrix", projectionMatrix * viewMatrix);
 
-	// landing pad
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewProjectionMatrix",
-	                          projectionMatrix * viewMatrix * landingPadModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewMatrix", viewMatrix * landingPadModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
-	                          inverse(transpose(viewMatrix * landingPadModelMatrix)));
-
-	labhelper::render(landingpadModel);
-
-	// Fighter
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewProjectionMatrix",
-	                          projectionMatrix * viewMatrix * fighterModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewMatrix", viewMatrix * fighterModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
-	                          inverse(transpose(viewMatrix * fighterModelMatrix)));
-
-	labhelper::render(fighterModel);
+	// landing pad and fighter, one multi draw per pass
+	sceneArena.submit(submitMaterials);
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////
-/// This function will be called once per frame, so the code to set up
-/// the scene for rendering should go here
+/// Renders the shadow map from the light
 ///////////////////////////////////////////////////////////////////////////////
-void display(void)
+void drawShadowMap(const FrameState& frame)
 {
-	///////////////////////////////////////////////////////////////////////////
-	// Check if window size has changed and resize buffers as needed
-	///////////////////////////////////////////////////////////////////////////
-	{
-		int w, h;
-		SDL_GetWindowSize(g_window, &w, &h);
-		if(w != windowWidth || h != windowHeight)
-		{
-			windowWidth = w;
-			windowHeight = h;
-		}
-	}
-
-
-	///////////////////////////////////////////////////////////////////////////
-	// setup matrices
-	///////////////////////////////////////////////////////////////////////////
-	mat4 projMatrix = perspective(radians(45.0f), float(windowWidth) / float(windowHeight), 5.0f, 2000.0f);
-	mat4 viewMatrix = lookAt(cameraPosition, cameraPosition + cameraDirection, worldUp);
-
-    mat3 lightRot = rotate(radians(lightAzimuth), vec3(0, 1, 0)) * rotate(radians(lightZenith), vec3(0, 0, 1));
-	lightPosition = lightRot * vec3(lightDistance, 0, 0);
-	mat4 lightViewMatrix = lookAt(lightPosition, vec3(0.0f), worldUp);
-	mat4 lightProjMatrix = perspective(radians(45.0f), 1.0f, 25.0f, 100.0f);
-
 	///////////////////////////////////////////////////////////////////////////
 	// Bind the environment map(s) to unused texture units
 	///////////////////////////////////////////////////////////////////////////
 	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, environmentMap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
 	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, irradianceMap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
 	glActiveTexture(GL_TEXTURE8);
-	glBindTexture(GL_TEXTURE_2D, reflectionMap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, reflectionMap);
 	glActiveTexture(GL_TEXTURE0);
 
 
 	
 	// Set up shadow map parameters
 ///////////////////////////////////////////////////////////////////////////
-	if (shadowMapFB.width != shadowMapResolution || shadowMapFB.height != shadowMapResolution) {
-		shadowMapFB.resize(shadowMapResolution, shadowMapResolution);
+	if (shadowMapFB.width != frame.shadowMapResolution || shadowMapFB.height != frame.shadowMapResolution) {
+		shadowMapFB.resize(frame.shadowMapResolution, frame.shadowMapResolution);
 	}
 
 	// Control the clamp mode
-	if (shadowMapClampMode == ClampMode::Edge) {
+	if (frame.shadowMapClampMode == ClampMode::Edge) {
 		glBindTexture(GL_TEXTURE_2D, shadowMapFB.depthBuffer);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	}
 
-	if (shadowMapClampMode == ClampMode::Border) {
+	if (frame.shadowMapClampMode == ClampMode::Border) {
 		glBindTexture(GL_TEXTURE_2D, shadowMapFB.depthBuffer);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		vec4 border(shadowMapClampBorderShadowed ? 0.f : 1.f);
+		vec4 border(frame.shadowMapClampBorderShadowed ? 0.f : 1.f);
 		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, &border.x);
 	}
 
-	if (useHardwarePCF) {
+	if (frame.useHardwarePCF) {
 		glBindTexture(GL_TEXTURE_2D, shadowMapFB.depthBuffer);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -382,9 +685,9 @@ void display(void)
 	///////////////////////////////////////////////////////////////////////////
 	// Draw Shadow Map
 	///////////////////////////////////////////////////////////////////////////
-	if (usePolygonOffset) {
+	if (frame.usePolygonOffset) {
 		glEnable(GL_POLYGON_OFFSET_FILL);
-		glPolygonOffset(polygonOffset_factor, polygonOffset_units);
+		glPolygonOffset(frame.polygonOffset_factor, frame.polygonOffset_units);
 	}
 
 	// bind and clear frame buffer
@@ -395,62 +698,444 @@ void display(void)
 
 	glActiveTexture(GL_TEXTURE10);
 	glBindTexture(GL_TEXTURE_2D, shadowMapFB.depthBuffer);
-	drawScene(simpleShaderProgram, lightViewMatrix, lightProjMatrix, lightViewMatrix, lightProjMatrix);
+	drawScene(shadowShaderProgram, frame, frame.lightViewMatrix, frame.lightProjMatrix, false);
 
 	/*labhelper::Material& screen = landingpadModel->m_materials[8];
 	screen.m_emission_texture.gl_id = shadowMapFB.colorTextureTargets[0];*/
 
-	if (usePolygonOffset) {
+	if (frame.usePolygonOffset) {
 		glDisable(GL_POLYGON_OFFSET_FILL);
 	}
-
-	///////////////////////////////////////////////////////////////////////////
-	// Draw from camera
-	///////////////////////////////////////////////////////////////////////////
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, windowWidth, windowHeight);
-	glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	drawBackground(viewMatrix, projMatrix);
-	drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
-	debugDrawLight(viewMatrix, projMatrix, vec3(lightPosition));
+}
 
 
-	// Particles
+///////////////////////////////////////////////////////////////////////////////
+/// Draws the particles into `target`, which is frame.renderWidth x
+/// frame.renderHeight. Alpha is accumulated as well, so a target cleared to
+/// transparent ends up holding premultiplied color.
+///////////////////////////////////////////////////////////////////////////////
+void drawParticles(const FrameState& frame, const FboInfo& target, const void* particles, int numParticles)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebufferId);
+	glViewport(0, 0, frame.renderWidth, frame.renderHeight);
 	glEnable(GL_PROGRAM_POINT_SIZE);//allow dynamic sizing
 	// Enable blending.
 	glEnable(GL_BLEND);/////allow transparency
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	// The low resolution depth is read again by the upsample, keep it clean
+	glDepthMask(GL_FALSE);
 
 	glUseProgram(particleShaderProgram);// selects the particle shader 
-	glBindTexture(GL_TEXTURE_2D, explosionTexture);///bind the loaded explosion
 	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, explosionTexture);///bind the loaded explosion
 	labhelper::setUniformSlow(particleShaderProgram, "P",
-		projMatrix);//particle position
+		frame.projMatrix);//particle position
 
-	labhelper::setUniformSlow(particleShaderProgram, "screen_x", float(windowWidth));//for scale the window
-	labhelper::setUniformSlow(particleShaderProgram, "screen_y", float(windowHeight));
+	labhelper::setUniformSlow(particleShaderProgram, "screen_x", float(frame.renderWidth));//for scale the window
+	labhelper::setUniformSlow(particleShaderProgram, "screen_y", float(frame.renderHeight));
 
-	
-		const float theta = labhelper::uniform_randf(0.f, 2.f * M_PI); 
-		const float u = labhelper::uniform_randf(0.95f, 1.f);  
-		vec3 rand = vec3(u, sqrt(1.f - u * u) * cosf(theta), sqrt(1.f - u * u) * sinf(theta)); 
-		//control the velocity and direction
-		Particle p; 
-		p.pos = fighterModelMatrix * vec4(10.0f, 1.0f, 0.0f, 1.0f);              //bind to ship location 
-		p.velocity = particleRotationMatrix * vec4(rand, 1.0f) * 30.0f; 
-		p.lifetime = 0.f; 
-		p.life_length = 3.f;
-
-		particle_system.spawn(p); 
-	
-
-	particle_system.process_particles(deltaTime);
-	particle_system.submit_to_gpu(viewMatrix);
+	particle_system.submit_to_gpu(particles, numParticles, ParticleVertexFormat(frame.particleFormat));
+	glDepthMask(GL_TRUE);
 	glDisable(GL_BLEND);
 	glDisable(GL_PROGRAM_POINT_SIZE);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Weighted blended order-independent transparency (McGuire and Bavoil 2013).
+/// Particles add their weighted color into an accumulation target and
+/// multiply their transmittance into a revealage target, both of which are
+/// independent of draw order, then a full-screen pass composites the
+/// weighted average color over `target`, premultiplied.
+///////////////////////////////////////////////////////////////////////////////
+void drawParticlesOit(const FrameState& frame, const FboInfo& target, const void* particles, int numParticles)
+{
+	if(particleOitFB.width != frame.outputWidth || particleOitFB.height != frame.outputHeight)
+	{
+		particleOitFB.resize(frame.outputWidth, frame.outputHeight);
+	}
+
+	// Particles are depth tested against the target but never write depth
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebufferId);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, particleOitFB.framebufferId);
+	glBlitFramebuffer(0, 0, frame.renderWidth, frame.renderHeight, 0, 0, frame.renderWidth, frame.renderHeight,
+	                  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, particleOitFB.framebufferId);
+	glViewport(0, 0, frame.renderWidth, frame.renderHeight);
+	const float clearAccumulation[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const float clearRevealage[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glClearBufferfv(GL_COLOR, 0, clearAccumulation);
+	glClearBufferfv(GL_COLOR, 1, clearRevealage);
+
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND);
+	glBlendFunci(0, GL_ONE, GL_ONE);
+	glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+
+	glUseProgram(particleOitProgram);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, explosionTexture);
+	labhelper::setUniformSlow(particleOitProgram, "P", frame.projMatrix);
+	labhelper::setUniformSlow(particleOitProgram, "screen_x", float(frame.renderWidth));
+	labhelper::setUniformSlow(particleOitProgram, "screen_y", float(frame.renderHeight));
+	particle_system.submit_to_gpu(particles, numParticles, ParticleVertexFormat(frame.particleFormat));
+
+	glDisable(GL_PROGRAM_POINT_SIZE);
+	glDepthMask(GL_TRUE);
+
+	// target * revealage + average * (1 - revealage)
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebufferId);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(particleResolveProgram);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, particleOitFB.colorTextureTargets[1]);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, particleOitFB.colorTextureTargets[0]);
+	labhelper::drawFullScreenQuad();
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reduced resolution particles. The scene depth is downsampled into
+/// particleLowResFB, particles are drawn there at 1/divisor the window size,
+/// then composited over the scene with a nearest-depth upsample.
+///////////////////////////////////////////////////////////////////////////////
+FrameState lowResolutionFrame(const FrameState& frame)
+{
+	FrameState lowRes = frame;
+	lowRes.renderWidth = max(1, frame.renderWidth / frame.particleDivisor);
+	lowRes.renderHeight = max(1, frame.renderHeight / frame.particleDivisor);
+	lowRes.outputWidth = max(1, frame.outputWidth / frame.particleDivisor);
+	lowRes.outputHeight = max(1, frame.outputHeight / frame.particleDivisor);
+	return lowRes;
+}
+
+void downsampleSceneDepth(const FrameState& frame)
+{
+	const FrameState lowRes = lowResolutionFrame(frame);
+	if(particleLowResFB.width != lowRes.outputWidth || particleLowResFB.height != lowRes.outputHeight)
+	{
+		particleLowResFB.resize(lowRes.outputWidth, lowRes.outputHeight);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, particleLowResFB.framebufferId);
+	glViewport(0, 0, lowRes.renderWidth, lowRes.renderHeight);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthFunc(GL_ALWAYS);
+	glUseProgram(depthDownsampleProgram);
+	labhelper::setUniformSlow(depthDownsampleProgram, "factor", frame.particleDivisor);
+	glUniform2i(glGetUniformLocation(depthDownsampleProgram, "sceneSize"), frame.renderWidth, frame.renderHeight);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, sceneFB.depthBuffer);
+	labhelper::drawFullScreenQuad();
+	glDepthFunc(GL_LESS);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	const float transparent[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearBufferfv(GL_COLOR, 0, transparent);
+}
+
+void upsampleParticles(const FrameState& frame)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFB.framebufferId);
+	glViewport(0, 0, frame.renderWidth, frame.renderHeight);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_DEPTH_TEST);
+
+	glUseProgram(particleUpsampleProgram);
+	glUniform2f(glGetUniformLocation(particleUpsampleProgram, "depthUnproject"), frame.projMatrix[2][2],
+	            frame.projMatrix[3][2]);
+	labhelper::setUniformSlow(particleUpsampleProgram, "edgeThreshold", 0.1f);
+	const FrameState lowRes = lowResolutionFrame(frame);
+	glUniform2f(glGetUniformLocation(particleUpsampleProgram, "sceneSize"), float(frame.renderWidth),
+	            float(frame.renderHeight));
+	glUniform2f(glGetUniformLocation(particleUpsampleProgram, "lowResSize"), float(lowRes.renderWidth),
+	            float(lowRes.renderHeight));
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, sceneFB.depthBuffer);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, particleLowResFB.depthBuffer);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, particleLowResFB.colorTextureTargets[0]);
+	labhelper::drawFullScreenQuad();
+
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the finished camera view to the window or benchmark target, with
+/// the sharpening upscale if it was rendered at a lower resolution
+///////////////////////////////////////////////////////////////////////////////
+void presentScene(const FrameState& frame)
+{
+	if(frame.renderWidth == frame.outputWidth && frame.renderHeight == frame.outputHeight)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFB.framebufferId);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frame.framebuffer);
+		glBlitFramebuffer(0, 0, frame.renderWidth, frame.renderHeight, 0, 0, frame.renderWidth,
+		                  frame.renderHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, frame.framebuffer);
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, frame.framebuffer);
+	glViewport(0, 0, frame.outputWidth, frame.outputHeight);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(upscaleProgram);
+	glUniform2f(glGetUniformLocation(upscaleProgram, "renderSize"), float(frame.renderWidth),
+	            float(frame.renderHeight));
+	glUniform2f(glGetUniformLocation(upscaleProgram, "outputSize"), float(frame.outputWidth),
+	            float(frame.outputHeight));
+	labhelper::setUniformSlow(upscaleProgram, "sharpness", frame.upscaleSharpness);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, sceneFB.colorTextureTargets[0]);
+	labhelper::drawFullScreenQuad();
+	glEnable(GL_DEPTH_TEST);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Records the readback of this frame if a screenshot was asked for or a
+/// sequence is running, and the hand off of earlier readbacks to the encoders
+///////////////////////////////////////////////////////////////////////////////
+void recordCapture(CommandList& commands, const FrameState* frame)
+{
+	commands.record([]() { frameCapture.poll(); });
+	if(!screenshotRequested && !captureSequence)
+	{
+		return;
+	}
+	screenshotRequested = false;
+
+	char name[512];
+	const char* extension = captureFormat == FrameCapture::Exr ? "exr" : "png";
+	if(captureSequence)
+	{
+		snprintf(name, sizeof(name), "%s_seq%02d_%06d.%s", capturePrefix.c_str(), sequenceIndex, sequenceFrame++,
+		         extension);
+	}
+	else
+	{
+		snprintf(name, sizeof(name), "%s_%04d.%s", capturePrefix.c_str(), screenshotIndex++, extension);
+	}
+	const char* path = commands.copy(name, strlen(name) + 1);
+	const FrameCapture::Format format = FrameCapture::Format(captureFormat);
+	commands.record([frame, path, format]() {
+		// EXR keeps the linear HDR scene at the resolution it was rendered at, PNG what was presented
+		if(format == FrameCapture::Exr)
+		{
+			frameCapture.capture(sceneFB.framebufferId, frame->renderWidth, frame->renderHeight, format, path);
+		}
+		else
+		{
+			frameCapture.capture(frame->framebuffer, frame->outputWidth, frame->outputHeight, format, path);
+		}
+	});
+}
+
 
+///////////////////////////////////////////////////////////////////////////////
+/// This function will be called once per frame, so the code to set up
+/// the scene for rendering should go here. It only records the GL work into
+/// `commands`, which the GL thread replays while the next frame is recorded.
+///////////////////////////////////////////////////////////////////////////////
+void display(CommandList& commands, uint64_t frameIndex)
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Check if window size has changed and resize buffers as needed
+	///////////////////////////////////////////////////////////////////////////
+	if(g_window != nullptr)
+	{
+		int w, h;
+		SDL_GetWindowSize(g_window, &w, &h);
+		if(w != windowWidth || h != windowHeight)
+		{
+			windowWidth = w;
+			windowHeight = h;
+		}
+	}
+
+
+	///////////////////////////////////////////////////////////////////////////
+	// Pick the render resolution from the GPU time of the last frame read back
+	///////////////////////////////////////////////////////////////////////////
+	uint64_t measuredFrame;
+	float measuredGpuMs;
+	if(profiler.latestGpuFrame(measuredFrame, measuredGpuMs))
+	{
+		dynamicResolution.update(measuredFrame, measuredGpuMs, frameIndex);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Interpolate the simulated state between its last two ticks
+	///////////////////////////////////////////////////////////////////////////
+	const SimSnapshot& snapshot = simulation.latestSnapshot();
+	const float alpha = snapshot.alpha(simulation.now());
+	fighterModelMatrix = snapshot.shipMatrix(alpha);
+	lightAzimuth = snapshot.lightAzimuthAt(alpha);
+
+	///////////////////////////////////////////////////////////////////////////
+	// setup matrices
+	///////////////////////////////////////////////////////////////////////////
+	mat4 projMatrix = perspective(radians(45.0f), float(windowWidth) / float(windowHeight), 5.0f, 2000.0f);
+	mat4 viewMatrix = lookAt(cameraPosition, cameraPosition + cameraDirection, worldUp);
+
+    mat3 lightRot = rotate(radians(lightAzimuth), vec3(0, 1, 0)) * rotate(radians(lightZenith), vec3(0, 0, 1));
+	lightPosition = lightRot * vec3(lightDistance, 0, 0);
+	mat4 lightViewMatrix = lookAt(lightPosition, vec3(0.0f), worldUp);
+	mat4 lightProjMatrix = perspective(radians(45.0f), 1.0f, 25.0f, 100.0f);
+
+	FrameState state;
+	state.framebuffer = renderTarget;
+	state.renderWidth = dynamicResolution.scaled(windowWidth);
+	state.renderHeight = dynamicResolution.scaled(windowHeight);
+	state.outputWidth = windowWidth;
+	state.outputHeight = windowHeight;
+	state.upscaleSharpness = upscaleSharpness;
+	state.viewMatrix = viewMatrix;
+	state.projMatrix = projMatrix;
+	state.lightViewMatrix = lightViewMatrix;
+	state.lightProjMatrix = lightProjMatrix;
+	state.cameraPosition = cameraPosition;
+	state.lightPosition = lightPosition;
+	state.fighterModelMatrix = fighterModelMatrix;
+	state.landingPadModelMatrix = landingPadModelMatrix;
+	state.environment_multiplier = environment_multiplier;
+	state.useGpuCulling = useGpuCulling;
+	state.particleMode = particleMode;
+	state.particleFormat = particleFormat;
+	state.particleDivisor = particleDivisor;
+	state.shadowMapResolution = shadowMapResolution;
+	state.shadowMapClampMode = shadowMapClampMode;
+	state.shadowMapClampBorderShadowed = shadowMapClampBorderShadowed;
+	state.usePolygonOffset = usePolygonOffset;
+	state.useHardwarePCF = useHardwarePCF;
+	state.polygonOffset_factor = polygonOffset_factor;
+	state.polygonOffset_units = polygonOffset_units;
+	state.drawHeightField = !heightfield.m_heightFieldPath.empty();
+	state.drawTerrain = terrain.isOpen();
+	if(state.drawTerrain)
+	{
+		// Decide the wanted tiles now, the GL thread uploads what has been read by the time it replays
+		const TerrainStreamer::Windows windows = terrain.update(terrain.worldToTexel(cameraPosition));
+		terrain.validRegions(state.terrainRegions);
+		commands.record([windows]() { terrain.upload(terrainUploadsPerFrame, windows); });
+	}
+	const FrameState* frame = commands.copy(&state, 1);
+
+	///////////////////////////////////////////////////////////////////////////
+	// Draw Shadow Map
+	///////////////////////////////////////////////////////////////////////////
+	commands.record([frame, frameIndex]() {
+		Profiler::Scope scope(profiler, frameIndex, shadowPass);
+		drawShadowMap(*frame);
+	});
+
+	///////////////////////////////////////////////////////////////////////////
+	// Draw from camera
+	///////////////////////////////////////////////////////////////////////////
+	commands.record([frame, frameIndex]() {
+		Profiler::Scope scope(profiler, frameIndex, backgroundPass);
+		if(sceneFB.width != frame->outputWidth || sceneFB.height != frame->outputHeight)
+		{
+			sceneFB.resize(frame->outputWidth, frame->outputHeight);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneFB.framebufferId);
+		glViewport(0, 0, frame->renderWidth, frame->renderHeight);
+		glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		drawBackground(*frame);
+	});
+	commands.record([frame, frameIndex]() {
+		Profiler::Scope scope(profiler, frameIndex, scenePass);
+		drawScene(shaderProgram, *frame, frame->viewMatrix, frame->projMatrix, true);
+		if(frame->drawTerrain)
+		{
+			drawTerrain(*frame);
+		}
+		if(frame->drawHeightField)
+		{
+			drawHeightField(*frame);
+		}
+		debugDrawLight(frame->viewMatrix, frame->projMatrix, frame->lightPosition);
+	});
+
+
+	// Particles are transformed and sorted here, the GL thread only uploads them.
+	// The snapshot is one tick ahead of the interpolated render time.
+	{
+		Profiler::Scope scope(profiler, frameIndex, particlePreparePass);
+		numParticles = particle_system.prepare_gpu_data(snapshot.particles, viewMatrix,
+		                                                (alpha - 1.0f) * Simulation::TickLength,
+		                                                particleMode == SortedBlend, ParticleVertexFormat(particleFormat));
+		particleGridBuildMs = snapshot.gridBuildMs;
+		particleGridQueryMs = snapshot.gridQueryMs;
+	}
+	const int count = numParticles;
+	const size_t particleBytes = count * ParticleSystem::vertex_size(ParticleVertexFormat(particleFormat));
+	void* particleData = commands.allocate(particleBytes, alignof(vec4));
+	memcpy(particleData, particle_system.gpu_data(), particleBytes);
+	const void* particles = particleData;
+	if(particleDivisor > 1)
+	{
+		commands.record([frame, frameIndex]() {
+			Profiler::Scope scope(profiler, frameIndex, particleDepthPass);
+			downsampleSceneDepth(*frame);
+		});
+	}
+	commands.record([frame, frameIndex, particles, count]() {
+		Profiler::Scope scope(profiler, frameIndex, particlePass);
+		const bool lowRes = frame->particleDivisor > 1;
+		const FrameState target = lowRes ? lowResolutionFrame(*frame) : *frame;
+		const FboInfo& targetFB = lowRes ? particleLowResFB : sceneFB;
+		if(frame->particleMode == WeightedOit)
+		{
+			drawParticlesOit(target, targetFB, particles, count);
+		}
+		else
+		{
+			drawParticles(target, targetFB, particles, count);
+		}
+	});
+	if(particleDivisor > 1)
+	{
+		commands.record([frame, frameIndex]() {
+			Profiler::Scope scope(profiler, frameIndex, particleUpsamplePass);
+			upsampleParticles(*frame);
+		});
+	}
+
+	commands.record([frame, frameIndex]() {
+		Profiler::Scope scope(profiler, frameIndex, presentPass);
+		presentScene(*frame);
+	});
+
+	// Before the GUI is drawn over the frame
+	recordCapture(commands, frame);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Queues input for the simulation, recording it if a script is being recorded
+///////////////////////////////////////////////////////////////////////////////
+bool sendToSimulation(const SimCommand& command)
+{
+	if(!simulation.pushCommand(command))
+	{
+		return false;
+	}
+	if(recordingScript)
+	{
+		recordedScript.recordInput(int(currentTime / recordedScript.timestep), command);
+	}
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -478,7 +1163,13 @@ bool handleEvents(void)
 		}
 		else if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_PRINTSCREEN)
 		{
-			labhelper::saveScreenshot();
+			screenshotRequested = true;
+		}
+		else if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_F9)
+		{
+			captureSequence = !captureSequence;
+			sequenceIndex += captureSequence ? 1 : 0;
+			sequenceFrame = 0;
 		}
 		if(event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT
 		   && (!showUI || !io.WantCaptureMouse))
@@ -553,48 +1244,24 @@ bool handleEvents(void)
 		{
 			cameraPosition += cameraSpeed * deltaTime * worldUp;
 		}
-		// control ship translation and rotation
-		const float rotateSpeed = 4.f; 
-		vec3 ship_forward = vec3(-1, 0, 0); 
-		vec3 ship_up = vec3(0, 1, 0); 
-		if (state[SDL_SCANCODE_UP])  
-		{ 
-			ship_forward = R * vec4(ship_forward, 0.0f); 
-			T = translate(ship_forward * shipSpeed * deltaTime) * T; 
-		} 
-		if (state[SDL_SCANCODE_DOWN]) 
-		{ 
-			ship_forward = R * vec4(ship_forward, 0.0f);  
-			T = translate(-ship_forward * shipSpeed * deltaTime) * T; 
-		} 
-		if (state[SDL_SCANCODE_LEFT]) 
-		{ 
-			R = rotate(rotateSpeed * deltaTime, vec3(0, 1, 0)) * R; 
-		} 
-		if (state[SDL_SCANCODE_RIGHT]) 
-		{
-			R = rotate(-rotateSpeed * deltaTime, vec3(0, 1, 0)) * R; 
-		} 
-		if (state[SDL_SCANCODE_SPACE]) 
-		{ 
-			T = translate(ship_up * shipSpeed * deltaTime) * T; 
-		} 
-		if (state[SDL_SCANCODE_X]) 
-		{ 
-			T = translate(-ship_up * shipSpeed * deltaTime) * T; 
-		} 
-		 
-		fighterModelMatrix = T * R; 
-	} 
-	particleRotationMatrix = R; 
-	const float light_rotation_speed = 90.f; 
-
-	//light control
-	if (animateLight) 
-	{ 
-		lightAzimuth += deltaTime * light_rotation_speed; 
-		lightAzimuth = fmodf(lightAzimuth, 360.f); 
-	} 
+	}
+
+	// Ship controls are simulated on the simulation thread, only send what is held down
+	uint32_t controls = 0;
+	if(!io.WantCaptureKeyboard)
+	{
+		const uint8_t* state = SDL_GetKeyboardState(nullptr);
+		controls |= state[SDL_SCANCODE_UP] ? ShipForward : 0;
+		controls |= state[SDL_SCANCODE_DOWN] ? ShipBackward : 0;
+		controls |= state[SDL_SCANCODE_LEFT] ? ShipTurnLeft : 0;
+		controls |= state[SDL_SCANCODE_RIGHT] ? ShipTurnRight : 0;
+		controls |= state[SDL_SCANCODE_SPACE] ? ShipUp : 0;
+		controls |= state[SDL_SCANCODE_X] ? ShipDown : 0;
+	}
+	if(controls != shipControls && sendToSimulation({ SimCommand::SetShipControls, controls, 0.0f }))
+	{
+		shipControls = controls;
+	}
 
 	return quitEvent;
 }
@@ -608,24 +1275,348 @@ void gui()
 
 
 
-	ImGui::Checkbox("Animate light", &animateLight);
-	ImGui::SliderFloat("Light Azimuth", &lightAzimuth, 0.0f, 360.0f);
+	if(ImGui::Checkbox("Animate light", &animateLight))
+	{
+		sendToSimulation({ SimCommand::SetAnimateLight, 0, animateLight ? 1.0f : 0.0f });
+	}
+	float azimuth = lightAzimuth;
+	if(ImGui::SliderFloat("Light Azimuth", &azimuth, 0.0f, 360.0f))
+	{
+		sendToSimulation({ SimCommand::SetLightAzimuth, 0, azimuth });
+	}
 	ImGui::SliderFloat("Light Zenith", &lightZenith, 0.0f, 90.0f);
+	ImGui::Checkbox("GPU draw culling", &useGpuCulling);
+
+	ImGui::Text("Particles: %d", numParticles);
+	if(ImGui::SliderInt("Particles per tick", &particlesPerTick, 1, 20000))
+	{
+		sendToSimulation({ SimCommand::SetParticlesPerTick, 0, float(particlesPerTick) });
+	}
+	if(ImGui::Checkbox("Particle collision", &particleCollision))
+	{
+		sendToSimulation({ SimCommand::SetParticleCollision, 0, particleCollision ? 1.0f : 0.0f });
+	}
+	if(ImGui::SliderFloat("Particle repulsion radius", &particleRepulsionRadius, 0.0f, 2.0f))
+	{
+		sendToSimulation({ SimCommand::SetParticleRepulsion, 0, particleRepulsionRadius });
+	}
+	if(particleRepulsionRadius > 0.0f)
+	{
+		ImGui::Text("Neighbour grid: rebuild %.2f ms, query %.2f ms", particleGridBuildMs, particleGridQueryMs);
+	}
+	ImGui::RadioButton("Sorted blending", &particleMode, SortedBlend);
+	ImGui::SameLine();
+	ImGui::RadioButton("Weighted blended OIT", &particleMode, WeightedOit);
+	ImGui::Text("Particle resolution");
+	ImGui::SameLine();
+	ImGui::RadioButton("Full", &particleDivisor, 1);
+	ImGui::SameLine();
+	ImGui::RadioButton("Half", &particleDivisor, 2);
+	ImGui::SameLine();
+	ImGui::RadioButton("Quarter", &particleDivisor, 4);
+	ImGui::Text("Particle vertices");
+	ImGui::SameLine();
+	ImGui::RadioButton("vec4", &particleFormat, ParticleFloat4);
+	ImGui::SameLine();
+	ImGui::RadioButton("Packed half/unorm16", &particleFormat, ParticlePacked);
+	ImGui::Text("Particle upload: %.1f KiB/frame, pack %.3f ms, glBufferSubData %.3f ms",
+	            particle_system.upload_bytes() / 1024.0f, particle_system.pack_ms(), particle_system.upload_ms());
+	if(terrain.isOpen())
+	{
+		const TerrainStreamer::Counters c = terrain.counters();
+		ImGui::Text("Terrain tiles: %d resident, %d wanted, %d queued", c.residentTiles, c.wantedTiles, c.queuedTiles);
+		ImGui::Text("Terrain streaming: %.1f MB/s, %d read, %d uploaded, %d cancelled, %d stall frames",
+		            c.bandwidthMBs, int(c.tilesRead), int(c.tilesUploaded), int(c.cancelledTiles), int(c.stallFrames));
+		ImGui::Text("Terrain memory: %.1f MiB buffers, %.1f MiB texture", c.bufferBytes / (1024.0f * 1024.0f),
+		            c.textureBytes / (1024.0f * 1024.0f));
+	}
+	if(!heightfield.m_heightFieldPath.empty())
+	{
+		ImGui::Text("Heightfield maps baked in %.1f ms", heightfield.m_bakeMs);
+	}
+	if(sceneArena.numVisibleDraws() >= 0)
+	{
+		ImGui::Text("Draws: %d / %d visible", sceneArena.numVisibleDraws(), sceneArena.numDraws());
+	}
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
 	ImGui::GetIO().Framerate);
+	ImGui::Text("Command list: %d commands, %.1f KiB, replay %.3f ms", int(glThread.numCommands()),
+	            glThread.recordedBytes() / 1024.0f, glThread.replayTime());
 	
 	//ImGui::SliderFloat("Particle Life Length", &particleLifeLength, 0.0f, 5.0f);  // life_length
 
-	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
-		ImGui::GetIO().Framerate);
-	
+	ImGui::Checkbox("Dynamic resolution", &dynamicResolution.m_enabled);
+	ImGui::SliderFloat("GPU budget (ms)", &dynamicResolution.m_targetMs, 2.0f, 50.0f);
+	ImGui::SliderFloat("Min resolution scale", &dynamicResolution.m_minScale, 0.25f, 1.0f);
+	ImGui::SliderFloat("Max resolution scale", &dynamicResolution.m_maxScale, 0.25f, 1.0f);
+	ImGui::SliderFloat("Upscale sharpness", &upscaleSharpness, 0.0f, 1.0f);
+	ImGui::Text("Rendering %dx%d (%.0f%%), smoothed GPU time %.2f ms, %d scale changes",
+	            dynamicResolution.scaled(windowWidth), dynamicResolution.scaled(windowHeight),
+	            dynamicResolution.scale() * 100.0f, dynamicResolution.m_smoothedMs, dynamicResolution.m_changes);
+	if(ImGui::Checkbox("Capture frame sequence (F9)", &captureSequence) && captureSequence)
+	{
+		sequenceIndex++;
+		sequenceFrame = 0;
+	}
+	ImGui::SameLine();
+	ImGui::RadioButton("PNG", &captureFormat, FrameCapture::Png);
+	ImGui::SameLine();
+	ImGui::RadioButton("EXR", &captureFormat, FrameCapture::Exr);
+	const FrameCapture::Counters capture = frameCapture.counters();
+	ImGui::Text("Capture: %d reading back, %d encoding, %d written, %d dropped, %d failed", capture.pendingReadbacks,
+	            capture.queuedFrames, int(capture.written), int(capture.dropped), int(capture.failed));
+	ImGui::Text("Capture copy %.3f ms on the GL thread, encode %.1f ms on a worker", capture.copyMs,
+	            capture.encodeMs);
+
+	const ShaderReloader::Counters shaders = shaderReloader.counters();
+	ImGui::Text("Shader reload: %d files watched, %d pending, %d reloaded, %d failed%s", shaders.watchedFiles,
+	            shaders.pending, int(shaders.reloaded), int(shaders.failed),
+	            shaders.parallel ? ", parallel compile" : "");
+	ImGui::SameLine();
+	if(ImGui::Button("Reload all"))
+	{
+		shaderReloader.reloadAll();
+	}
+
+	if(ImGui::CollapsingHeader("Profiler"))
+	{
+		profiler.gui();
+	}
+	if(ImGui::CollapsingHeader("GPU memory"))
+	{
+		glresource::gui();
+	}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Replays a benchmark script offscreen at a fixed timestep and writes the
+/// per frame CPU and GPU timings to <outputPrefix>.csv and .json. Frames
+/// listed in the script are hashed and compared. Returns the exit code.
+///////////////////////////////////////////////////////////////////////////////
+int runBenchmark(const std::string& scriptFile, const std::string& outputPrefix)
+{
+	BenchScript script;
+	if(!BenchScript::load(scriptFile, script))
+	{
+		return 1;
+	}
+
+	HeadlessContext context;
+	if(!context.create(script.width, script.height))
+	{
+		return 1;
+	}
+	std::cout << "Benchmark " << scriptFile << ": " << script.frames << " frames at " << script.width << "x"
+	          << script.height << " on " << glGetString(GL_RENDERER) << std::endl;
+
+	initialize();
+
+	FboInfo target(1, "Benchmark");
+	target.colorTargetType = GL_RGBA8;
+	target.resize(script.width, script.height);
+	renderTarget = target.framebufferId;
+	windowWidth = script.width;
+	windowHeight = script.height;
+	// Rendered at the script's size whatever the GPU time, so the image hashes are reproducible
+	dynamicResolution.m_enabled = false;
+
+	simulation.startManual();
+	profiler.setKeepAll(true);
+
+	// Recorded and replayed on this thread, there is no window to present to
+	CommandList commands;
+	std::vector<uint8_t> pixels(size_t(script.width) * script.height * 4);
+	size_t nextEvent = 0;
+	size_t nextHash = 0;
+	int failedHashes = 0;
+	double particleBytes = 0.0, particlePackMs = 0.0, particleUploadMs = 0.0;
+	for(int i = 0; i < script.frames; i++)
+	{
+		for(; nextEvent < script.events.size() && script.events[nextEvent].frame <= i; nextEvent++)
+		{
+			simulation.pushCommand(script.events[nextEvent].command);
+		}
+		script.cameraAt(i, cameraPosition, cameraDirection);
+		simulation.advance(script.timestep);
+
+		const uint64_t frameIndex = profiler.beginFrame();
+		commands.record([frameIndex]() { profiler.beginGpuFrame(frameIndex); });
+		display(commands, frameIndex);
+		commands.replay();
+		commands.reset();
+		particleBytes += particle_system.upload_bytes();
+		particlePackMs += particle_system.pack_ms();
+		particleUploadMs += particle_system.upload_ms();
+
+		// The readback stalls, so frames with a hash check are slower than the rest
+		for(; nextHash < script.hashes.size() && script.hashes[nextHash].frame <= i; nextHash++)
+		{
+			const BenchScript::HashCheck& check = script.hashes[nextHash];
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebufferId);
+			glReadBuffer(GL_COLOR_ATTACHMENT0);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, 0, script.width, script.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			const uint64_t hash = meshcache::hash(pixels.data(), pixels.size());
+
+			char line[128];
+			snprintf(line, sizeof(line), "frame %d image hash %016llx", i, (unsigned long long)hash);
+			std::cout << line;
+			if(check.hasExpected && check.expected != hash)
+			{
+				snprintf(line, sizeof(line), " MISMATCH, expected %016llx", (unsigned long long)check.expected);
+				std::cout << line;
+				failedHashes++;
+			}
+			std::cout << std::endl;
+		}
+	}
+	profiler.flush();
+	profiler.printSummary();
+	if(script.frames > 0)
+	{
+		char line[256];
+		snprintf(line, sizeof(line),
+		         "Particle vertices (%s): %.1f KiB/frame, pack %.3f ms/frame, glBufferSubData %.3f ms/frame",
+		         particleFormat == ParticlePacked ? "packed" : "vec4", particleBytes / 1024.0 / script.frames,
+		         particlePackMs / script.frames, particleUploadMs / script.frames);
+		std::cout << line << std::endl;
+	}
+	profiler.exportCsv(outputPrefix + ".csv");
+	profiler.exportChromeTrace(outputPrefix + ".json");
+
+	profiler.destroy();
+	target.destroy();
+	destroyGpuResources();
+	context.destroy();
+
+	if(failedHashes > 0)
+	{
+		std::cout << failedHashes << " image hashes did not match" << std::endl;
+		return 2;
+	}
+	return 0;
 }
 
 int main(int argc, char* argv[])
 {
+	std::string benchScript, benchOutput = "bench", recordScript, terrainTest;
+	float terrainTestGigabytes = 2.0f;
+	bool gridBenchmark = false;
+	int bakeBenchmarkSize = 0;
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+		{
+			benchScript = argv[++i];
+		}
+		else if(strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc)
+		{
+			benchOutput = argv[++i];
+		}
+		else if(strcmp(argv[i], "--record-script") == 0 && i + 1 < argc)
+		{
+			recordScript = argv[++i];
+		}
+		else if(strcmp(argv[i], "--particle-format") == 0 && i + 1 < argc
+		        && (strcmp(argv[i + 1], "vec4") == 0 || strcmp(argv[i + 1], "packed") == 0))
+		{
+			particleFormat = strcmp(argv[++i], "packed") == 0 ? ParticlePacked : ParticleFloat4;
+		}
+		else if(strcmp(argv[i], "--grid-bench") == 0)
+		{
+			gridBenchmark = true;
+		}
+		else if(strcmp(argv[i], "--bake-bench") == 0)
+		{
+			bakeBenchmarkSize = i + 1 < argc && atoi(argv[i + 1]) > 0 ? atoi(argv[++i]) : 8192;
+		}
+		else if(strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc && strchr(argv[i + 1], '=') != nullptr)
+		{
+			// owner=MiB, warns when the owner's objects grow past it
+			const std::string budget = argv[++i];
+			const size_t split = budget.find('=');
+			glresource::setBudget(budget.substr(0, split), size_t(atof(budget.c_str() + split + 1) * 1024 * 1024));
+		}
+		else if(strcmp(argv[i], "--gpu-target") == 0 && i + 1 < argc)
+		{
+			// GPU time budget in ms for dynamic resolution, 0 renders at the window size
+			dynamicResolution.m_targetMs = float(atof(argv[++i]));
+			dynamicResolution.m_enabled = dynamicResolution.m_targetMs > 0.0f;
+		}
+		else if(strcmp(argv[i], "--capture-prefix") == 0 && i + 1 < argc)
+		{
+			capturePrefix = argv[++i];
+		}
+		else if(strcmp(argv[i], "--capture-exr") == 0)
+		{
+			captureFormat = FrameCapture::Exr;
+		}
+		else if(strcmp(argv[i], "--heightfield") == 0 && i + 1 < argc)
+		{
+			heightfieldPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--terrain") == 0 && i + 1 < argc)
+		{
+			terrainPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--terrain-test") == 0 && i + 1 < argc)
+		{
+			terrainTest = argv[++i];
+			if(i + 1 < argc && atof(argv[i + 1]) > 0.0)
+			{
+				terrainTestGigabytes = float(atof(argv[++i]));
+			}
+		}
+		else if(strcmp(argv[i], "--terrain-convert") == 0 && i + 2 < argc)
+		{
+			const std::string image = argv[++i];
+			const std::string output = argv[++i];
+			return heighttiles::convertImage(image, output) ? 0 : 1;
+		}
+		else
+		{
+			std::cout << "Usage: " << argv[0]
+			          << " [--bench script [--bench-out prefix]] [--record-script script] [--grid-bench]"
+			          << " [--particle-format vec4|packed] [--terrain file.tiles] [--terrain-test file.tiles [GiB]]"
+			          << " [--terrain-convert image file.tiles] [--heightfield image] [--bake-bench [size]]"
+			          << " [--gpu-budget owner=MiB]... [--capture-prefix prefix] [--capture-exr]"
+			          << " [--gpu-target ms]" << std::endl;
+			return 1;
+		}
+	}
+	if(!terrainTest.empty())
+	{
+		return testTerrainStreaming(terrainTest, terrainTestGigabytes);
+	}
+	if(bakeBenchmarkSize > 0)
+	{
+		benchmarkHeightFieldBake(bakeBenchmarkSize);
+		return 0;
+	}
+	if(gridBenchmark)
+	{
+		benchmarkSpatialGrid();
+		return 0;
+	}
+	if(!benchScript.empty())
+	{
+		return runBenchmark(benchScript, benchOutput);
+	}
+	recordingScript = !recordScript.empty();
+	recordedScript.frames = 0;
+
 	g_window = labhelper::init_window_SDL("OpenGL Project");
 
 	initialize();
+	simulation.start();
+	frameCapture.start(std::max(2, int(std::thread::hardware_concurrency()) / 2));
+	shaderReloader.start();
+
+	// Hand the GL context to the submission thread. ImGui's own GL objects are
+	// created first, as its NewFrame would otherwise create them on this thread.
+	ImGui_ImplSdlGL3_CreateDeviceObjects();
+	glThread.start(g_window);
 
 	bool stopRendering = false;
 	auto startTime = std::chrono::system_clock::now();
@@ -643,9 +1634,17 @@ int main(int argc, char* argv[])
 
 		// check events (keyboard among other)
 		stopRendering = handleEvents();
+		if(recordingScript)
+		{
+			recordedScript.recordCamera(int(currentTime / recordedScript.timestep), cameraPosition, cameraDirection);
+		}
 
-		// render to window
-		display();
+		// record the frame, waiting for the GL thread if it is still replaying this list
+		CommandList& commands = glThread.beginFrame();
+		const uint64_t frameIndex = profiler.beginFrame();
+		commands.record([frameIndex]() { profiler.beginGpuFrame(frameIndex); });
+		commands.record([]() { shaderReloader.poll(); });
+		display(commands, frameIndex);
 
 		// Render overlay GUI.
 		if(showUI)
@@ -653,15 +1652,31 @@ int main(int argc, char* argv[])
 			gui();
 		}
 
-		// Render the GUI.
-		ImGui::Render();
+		// Record the GUI.
+		commands.record([frameIndex]() { profiler.beginPass(frameIndex, uiPass); });
+		imguiRecorder.record(commands);
+		commands.record([frameIndex]() { profiler.endPass(frameIndex, uiPass); });
+
+		// Replayed on the GL thread, which then swaps front and back buffer.
+		glThread.submitFrame();
+	}
+	// Take the GL context back for cleanup
+	glThread.stop();
+	profiler.destroy();
+	simulation.stop();
 
-		// Swap front and back buffer. This frame will now been displayed.
-		SDL_GL_SwapWindow(g_window);
+	if(recordingScript)
+	{
+		SDL_GetWindowSize(g_window, &recordedScript.width, &recordedScript.height);
+		recordedScript.save(recordScript);
 	}
-	// Free Models
-	labhelper::freeModel(fighterModel);
-	labhelper::freeModel(landingpadModel);
+
+	// Write the frames still being captured, stop streaming and free the GL
+	// objects before the context goes away
+	frameCapture.finish();
+	shaderReloader.stop();
+	terrain.close();
+	destroyGpuResources();
 
 	// Shut down everything. This includes the window and all other subsystems.
 	labhelper::shutDown(g_window);
@@ -0,0 +1,789 @@
+#include "meshCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <labhelper.h>
+#include <Model.h>
+#include <stb_image.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace glm;
+
+namespace meshcache
+{
+uint64_t hash(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t h = seed;
+	for(size_t i = 0; i < size; i++)
+	{
+		h = (h ^ bytes[i]) * 1099511628211ull;
+	}
+	return h;
+}
+} // namespace meshcache
+
+namespace
+{
+const char Magic[8] = { 'M', 'E', 'S', 'H', 'B', 'I', 'N', '\0' };
+// Size of the simulated FIFO vertex cache the index reordering targets
+const int VertexCacheSize = 16;
+
+bool readFile(const std::string& path, std::vector<char>& contents)
+{
+	std::ifstream file(path, std::ios::binary);
+	if(!file)
+	{
+		return false;
+	}
+	contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+std::string directoryOf(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+struct SourceStamp
+{
+	uint64_t size;
+	int64_t time;
+};
+
+/// Size and modification time of the obj file, false if it does not exist
+bool stampSource(const std::string& objPath, SourceStamp& stamp)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if(!GetFileAttributesExA(objPath.c_str(), GetFileExInfoStandard, &info))
+	{
+		return false;
+	}
+	stamp.size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	stamp.time = int64_t((uint64_t(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime);
+#else
+	struct stat info;
+	if(stat(objPath.c_str(), &info) != 0)
+	{
+		return false;
+	}
+	stamp.size = uint64_t(info.st_size);
+#ifdef __linux__
+	stamp.time = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#else
+	stamp.time = int64_t(info.st_mtime) * 1000000000;
+#endif
+#endif
+	return true;
+}
+
+/// Rewrites the source stamp of an existing cache, whose source was touched but not changed
+void restampCache(const std::string& cachePath, const SourceStamp& stamp)
+{
+	std::fstream file(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+	file.seekp(offsetof(meshcache::Header, sourceSize));
+	file.write(reinterpret_cast<const char*>(&stamp.size), sizeof(stamp.size));
+	file.write(reinterpret_cast<const char*>(&stamp.time), sizeof(stamp.time));
+}
+
+/// Hashes the obj file together with every material library it references.
+/// Returns 0 if the obj file cannot be read.
+uint64_t hashSource(const std::string& objPath)
+{
+	std::vector<char> obj;
+	if(!readFile(objPath, obj))
+	{
+		return 0;
+	}
+	uint64_t h = meshcache::hash(&meshcache::Version, sizeof(meshcache::Version));
+	h = meshcache::hash(obj.data(), obj.size(), h);
+
+	std::istringstream lines(std::string(obj.begin(), obj.end()));
+	std::string line;
+	while(std::getline(lines, line))
+	{
+		if(line.compare(0, 7, "mtllib ") == 0)
+		{
+			std::string name = line.substr(7);
+			name.erase(name.find_last_not_of(" \r\n\t") + 1);
+			std::vector<char> mtl;
+			if(readFile(directoryOf(objPath) + name, mtl))
+			{
+				h = meshcache::hash(mtl.data(), mtl.size(), h);
+			}
+		}
+	}
+	return h;
+}
+
+int16_t quantizeSnorm(float v)
+{
+	return int16_t(std::round(clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+vec2 octEncode(vec3 n)
+{
+	n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+	if(n.z < 0.0f)
+	{
+		return vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+		            (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	}
+	return vec2(n.x, n.y);
+}
+
+struct PackedVertexHash
+{
+	size_t operator()(const meshcache::Vertex& v) const { return size_t(meshcache::hash(&v, sizeof(v))); }
+};
+
+struct PackedVertexEqual
+{
+	bool operator()(const meshcache::Vertex& a, const meshcache::Vertex& b) const
+	{
+		return memcmp(&a, &b, sizeof(a)) == 0;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reorders a triangle list for the post transform vertex cache with Tipsify
+/// (Sander, Nehab and Barczak 2007). `clusterStarts` receives the first
+/// triangle of every cluster, split where the algorithm had to jump to a
+/// dead-end vertex, which are the units reordered for overdraw afterwards.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<uint32_t> tipsify(const std::vector<uint32_t>& indices, uint32_t vertexCount,
+                              std::vector<uint32_t>& clusterStarts)
+{
+	const uint32_t numTriangles = uint32_t(indices.size() / 3);
+
+	// vertex -> triangle adjacency
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for(uint32_t index : indices)
+	{
+		liveTriangles[index]++;
+	}
+	std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+	for(uint32_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for(uint32_t t = 0; t < numTriangles; t++)
+	{
+		for(int k = 0; k < 3; k++)
+		{
+			adjacency[fill[indices[3 * t + k]]++] = t;
+		}
+	}
+
+	std::vector<int> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	clusterStarts.assign(1, 0);
+
+	int time = VertexCacheSize + 1;
+	uint32_t cursor = 0;
+	int fanning = vertexCount > 0 ? 0 : -1;
+	while(fanning >= 0)
+	{
+		// Emit all remaining triangles around the fanning vertex
+		candidates.clear();
+		for(uint32_t a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++)
+		{
+			const uint32_t t = adjacency[a];
+			if(emitted[t])
+			{
+				continue;
+			}
+			for(int k = 0; k < 3; k++)
+			{
+				const uint32_t v = indices[3 * t + k];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if(time - cacheTime[v] > VertexCacheSize)
+				{
+					cacheTime[v] = time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// Next fanning vertex: the candidate that will still be in the cache
+		// after its remaining triangles are emitted, preferring the oldest
+		int next = -1;
+		int bestPriority = -1;
+		for(uint32_t v : candidates)
+		{
+			if(liveTriangles[v] == 0)
+			{
+				continue;
+			}
+			int priority = 0;
+			if(time - cacheTime[v] + 2 * int(liveTriangles[v]) <= VertexCacheSize)
+			{
+				priority = time - cacheTime[v];
+			}
+			if(priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = int(v);
+			}
+		}
+
+		if(next == -1)
+		{
+			// Dead end, continue from a recently used vertex or any vertex left
+			while(!deadEnds.empty() && next == -1)
+			{
+				const uint32_t v = deadEnds.back();
+				deadEnds.pop_back();
+				if(liveTriangles[v] > 0)
+				{
+					next = int(v);
+				}
+			}
+			while(next == -1 && cursor < vertexCount)
+			{
+				if(liveTriangles[cursor] > 0)
+				{
+					next = int(cursor);
+				}
+				cursor++;
+			}
+			const uint32_t emittedTriangles = uint32_t(output.size() / 3);
+			if(next != -1 && emittedTriangles != clusterStarts.back())
+			{
+				clusterStarts.push_back(emittedTriangles);
+			}
+		}
+		fanning = next;
+	}
+	return output;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Sorts the clusters so that the ones facing outwards from the mesh center
+/// are drawn first, which lets early depth reject more of the rest.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<uint32_t> sortClustersForOverdraw(const std::vector<uint32_t>& indices,
+                                              const std::vector<uint32_t>& clusterStarts,
+                                              const std::vector<vec3>& positions)
+{
+	if(indices.empty())
+	{
+		return indices;
+	}
+	const uint32_t numTriangles = uint32_t(indices.size() / 3);
+	const int numClusters = int(clusterStarts.size());
+
+	vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	std::vector<vec3> clusterCentroid(numClusters, vec3(0.0f));
+	std::vector<vec3> clusterNormal(numClusters, vec3(0.0f));
+	for(int c = 0; c < numClusters; c++)
+	{
+		const uint32_t end = c + 1 < numClusters ? clusterStarts[c + 1] : numTriangles;
+		float clusterArea = 0.0f;
+		for(uint32_t t = clusterStarts[c]; t < end; t++)
+		{
+			const vec3& a = positions[indices[3 * t + 0]];
+			const vec3& b = positions[indices[3 * t + 1]];
+			const vec3& d = positions[indices[3 * t + 2]];
+			const vec3 n = cross(b - a, d - a); // length is twice the area
+			const float area = 0.5f * length(n);
+			const vec3 centroid = (a + b + d) / 3.0f;
+			clusterCentroid[c] += centroid * area;
+			clusterNormal[c] += n;
+			clusterArea += area;
+		}
+		meshCentroid += clusterCentroid[c];
+		meshArea += clusterArea;
+		clusterCentroid[c] =
+		    clusterArea > 0.0f ? clusterCentroid[c] / clusterArea : positions[indices[3 * clusterStarts[c]]];
+	}
+	meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : vec3(0.0f);
+
+	std::vector<float> metric(numClusters);
+	for(int c = 0; c < numClusters; c++)
+	{
+		const float normalLength = length(clusterNormal[c]);
+		metric[c] = normalLength > 0.0f ?
+		                dot(clusterCentroid[c] - meshCentroid, clusterNormal[c] / normalLength) :
+		                0.0f;
+	}
+	std::vector<int> order(numClusters);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&metric](int a, int b) { return metric[a] > metric[b]; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for(int c : order)
+	{
+		const uint32_t end = c + 1 < numClusters ? clusterStarts[c + 1] : numTriangles;
+		output.insert(output.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * end);
+	}
+	return output;
+}
+
+struct BuiltMesh
+{
+	meshcache::Mesh mesh;
+	std::vector<meshcache::Vertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+BuiltMesh buildMesh(const labhelper::Model* model, const labhelper::Mesh& source)
+{
+	BuiltMesh result;
+	meshcache::Mesh& mesh = result.mesh;
+	mesh.materialIdx = source.m_material_idx;
+
+	vec3 boundsMin(std::numeric_limits<float>::max());
+	vec3 boundsMax(-std::numeric_limits<float>::max());
+	const uint32_t first = source.m_start_index;
+	const uint32_t last = source.m_start_index + source.m_number_of_vertices;
+	for(uint32_t i = first; i < last; i++)
+	{
+		boundsMin = min(boundsMin, model->m_positions[i]);
+		boundsMax = max(boundsMax, model->m_positions[i]);
+	}
+	if(first == last)
+	{
+		boundsMin = boundsMax = vec3(0.0f);
+	}
+	const vec3 center = 0.5f * (boundsMin + boundsMax);
+	const vec3 halfExtent = max(0.5f * (boundsMax - boundsMin), vec3(1e-6f));
+
+	///////////////////////////////////////////////////////////////////////
+	// Quantize and index. The obj loader emits three vertices per triangle,
+	// so identical quantized vertices are merged.
+	///////////////////////////////////////////////////////////////////////
+	std::unordered_map<meshcache::Vertex, uint32_t, PackedVertexHash, PackedVertexEqual> unique;
+	std::vector<vec3> positions;
+	std::vector<uint32_t> indices;
+	for(uint32_t i = first; i < last; i++)
+	{
+		meshcache::Vertex v;
+		const vec3 p = (model->m_positions[i] - center) / halfExtent;
+		v.position[0] = quantizeSnorm(p.x);
+		v.position[1] = quantizeSnorm(p.y);
+		v.position[2] = quantizeSnorm(p.z);
+		v.position[3] = 0;
+		const vec2 n = octEncode(model->m_normals[i]);
+		v.normal[0] = quantizeSnorm(n.x);
+		v.normal[1] = quantizeSnorm(n.y);
+		const uint32_t uv = packHalf2x16(model->m_texture_coordinates[i]);
+		v.texCoord[0] = uint16_t(uv & 0xffff);
+		v.texCoord[1] = uint16_t(uv >> 16);
+
+		auto it = unique.find(v);
+		if(it == unique.end())
+		{
+			it = unique.emplace(v, uint32_t(result.vertices.size())).first;
+			result.vertices.push_back(v);
+			positions.push_back(model->m_positions[i]);
+		}
+		indices.push_back(it->second);
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Reorder triangles for the vertex cache, then clusters for overdraw,
+	// then vertices in order of first use for fetch locality
+	///////////////////////////////////////////////////////////////////////
+	std::vector<uint32_t> clusterStarts;
+	indices = tipsify(indices, uint32_t(result.vertices.size()), clusterStarts);
+	indices = sortClustersForOverdraw(indices, clusterStarts, positions);
+
+	std::vector<uint32_t> remap(result.vertices.size(), UINT32_MAX);
+	std::vector<meshcache::Vertex> vertices;
+	vertices.reserve(result.vertices.size());
+	for(uint32_t& index : indices)
+	{
+		if(remap[index] == UINT32_MAX)
+		{
+			remap[index] = uint32_t(vertices.size());
+			vertices.push_back(result.vertices[index]);
+		}
+		index = remap[index];
+	}
+	result.vertices.swap(vertices);
+	result.indices.swap(indices);
+
+	mesh.indexCount = uint32_t(result.indices.size());
+	mesh.vertexCount = uint32_t(result.vertices.size());
+	for(int k = 0; k < 3; k++)
+	{
+		mesh.boundsMin[k] = boundsMin[k];
+		mesh.boundsMax[k] = boundsMax[k];
+		mesh.boundingSphere[k] = center[k];
+	}
+	mesh.boundingSphere[3] = length(boundsMax - center);
+	return result;
+}
+
+void copyPath(char (&dst)[256], const labhelper::Texture& texture)
+{
+	memset(dst, 0, sizeof(dst));
+	if(texture.valid)
+	{
+		const std::string path = texture.directory + texture.filename;
+		strncpy(dst, path.c_str(), sizeof(dst) - 1);
+	}
+}
+
+uint64_t align16(uint64_t offset)
+{
+	return (offset + 15) & ~uint64_t(15);
+}
+
+/// Converts `objPath` and writes the cache to `cachePath`
+bool buildCache(const std::string& objPath, const std::string& cachePath, uint64_t sourceHash,
+                const SourceStamp& stamp)
+{
+	labhelper::Model* model = labhelper::loadModelFromOBJ(objPath);
+	if(model == nullptr)
+	{
+		return false;
+	}
+
+	std::vector<meshcache::Material> materials(model->m_materials.size());
+	for(size_t i = 0; i < materials.size(); i++)
+	{
+		const labhelper::Material& source = model->m_materials[i];
+		meshcache::Material& material = materials[i];
+		for(int k = 0; k < 3; k++)
+		{
+			material.color[k] = source.m_color[k];
+			material.emission[k] = source.m_emission[k];
+		}
+		material.metalness = source.m_metalness;
+		material.fresnel = source.m_fresnel;
+		material.shininess = source.m_shininess;
+		copyPath(material.colorTexture, source.m_color_texture);
+		copyPath(material.emissionTexture, source.m_emission_texture);
+	}
+
+	std::vector<meshcache::Mesh> meshes;
+	std::vector<meshcache::Vertex> vertices;
+	std::vector<uint32_t> indices;
+	size_t sourceVertices = 0;
+	for(const labhelper::Mesh& source : model->m_meshes)
+	{
+		BuiltMesh built = buildMesh(model, source);
+		built.mesh.firstIndex = uint32_t(indices.size());
+		built.mesh.baseVertex = uint32_t(vertices.size());
+		meshes.push_back(built.mesh);
+		vertices.insert(vertices.end(), built.vertices.begin(), built.vertices.end());
+		indices.insert(indices.end(), built.indices.begin(), built.indices.end());
+		sourceVertices += source.m_number_of_vertices;
+	}
+	labhelper::freeModel(model);
+
+	meshcache::Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = meshcache::Version;
+	header.numMaterials = uint32_t(materials.size());
+	header.numMeshes = uint32_t(meshes.size());
+	header.numVertices = uint32_t(vertices.size());
+	header.numIndices = uint32_t(indices.size());
+	header.sourceHash = sourceHash;
+	header.sourceSize = stamp.size;
+	header.sourceTime = stamp.time;
+	header.materialOffset = align16(sizeof(header));
+	header.meshOffset = align16(header.materialOffset + materials.size() * sizeof(meshcache::Material));
+	header.vertexOffset = align16(header.meshOffset + meshes.size() * sizeof(meshcache::Mesh));
+	header.indexOffset = align16(header.vertexOffset + vertices.size() * sizeof(meshcache::Vertex));
+
+	std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+	if(!file)
+	{
+		std::cout << "Failed to write mesh cache: " << cachePath << ".\n";
+		return false;
+	}
+	auto writeAt = [&file](uint64_t offset, const void* data, size_t size) {
+		static const char zeros[16] = {};
+		file.write(zeros, std::streamsize(offset - uint64_t(file.tellp())));
+		file.write(static_cast<const char*>(data), std::streamsize(size));
+	};
+	writeAt(0, &header, sizeof(header));
+	writeAt(header.materialOffset, materials.data(), materials.size() * sizeof(meshcache::Material));
+	writeAt(header.meshOffset, meshes.data(), meshes.size() * sizeof(meshcache::Mesh));
+	writeAt(header.vertexOffset, vertices.data(), vertices.size() * sizeof(meshcache::Vertex));
+	writeAt(header.indexOffset, indices.data(), indices.size() * sizeof(uint32_t));
+	if(!file)
+	{
+		std::cout << "Failed to write mesh cache: " << cachePath << ".\n";
+		return false;
+	}
+
+	// The obj loader stores position, normal and uv as floats for every triangle corner
+	const size_t objBytes = sourceVertices * (sizeof(vec3) + sizeof(vec3) + sizeof(vec2));
+	const size_t cacheBytes = vertices.size() * sizeof(meshcache::Vertex) + indices.size() * sizeof(uint32_t);
+	std::cout << "Built mesh cache " << cachePath << ": " << vertices.size() << " vertices, "
+	          << indices.size() / 3 << " triangles, geometry " << objBytes / 1024 << " KiB -> "
+	          << cacheBytes / 1024 << " KiB.\n";
+	return true;
+}
+
+GlTexture loadTexture(const std::string& path)
+{
+	int width, height, components;
+	stbi_set_flip_vertically_on_load(true);
+	unsigned char* data = stbi_load(path.c_str(), &width, &height, &components, STBI_rgb_alpha);
+	stbi_set_flip_vertically_on_load(false);
+	if(data == nullptr)
+	{
+		std::cout << "Failed to load image: " << path << ".\n";
+		return GlTexture();
+	}
+	GlTexture texture("Scene textures", GL_RESOURCE_SITE);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	stbi_image_free(data);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	texture.setTextureSize(GL_SRGB_ALPHA, width, height, 1, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16.0f);
+	return texture;
+}
+} // namespace
+
+CachedModel::CachedModel()
+    : m_mapping(nullptr)
+    , m_mappingSize(0)
+#ifdef _WIN32
+    , m_file(nullptr)
+    , m_fileMapping(nullptr)
+#endif
+    , m_header(nullptr)
+    , m_materials(nullptr)
+    , m_meshes(nullptr)
+    , m_vertices(nullptr)
+    , m_indices(nullptr)
+{
+}
+
+CachedModel::~CachedModel()
+{
+	unmap();
+}
+
+CachedModel* CachedModel::load(const std::string& objPath)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	const std::string cachePath = objPath + ".meshcache";
+	SourceStamp stamp;
+	const bool hasSource = stampSource(objPath, stamp);
+	uint64_t sourceHash = 0;
+
+	CachedModel* model = new CachedModel();
+	// Without the source there is nothing to validate against, so any valid cache of the right version is used
+	bool loaded = model->map(cachePath);
+	if(loaded && hasSource && (model->m_header->sourceSize != stamp.size || model->m_header->sourceTime != stamp.time))
+	{
+		// Only hash the source when it was touched, a checkout or copy changes the time but not the contents
+		sourceHash = hashSource(objPath);
+		const bool unchanged = sourceHash != 0 && model->m_header->sourceHash == sourceHash;
+		model->unmap();
+		if(unchanged)
+		{
+			restampCache(cachePath, stamp);
+		}
+		loaded = unchanged && model->map(cachePath);
+	}
+	if(!loaded && hasSource)
+	{
+		std::cout << "Mesh cache " << cachePath << " is missing or stale, converting " << objPath << ".\n";
+		if(sourceHash == 0)
+		{
+			sourceHash = hashSource(objPath);
+		}
+		loaded = sourceHash != 0 && buildCache(objPath, cachePath, sourceHash, stamp) && model->map(cachePath);
+	}
+	if(!loaded)
+	{
+		std::cout << "Failed to load model: " << objPath << ".\n";
+		delete model;
+		return nullptr;
+	}
+	model->loadTextures();
+
+	std::chrono::duration<float, std::milli> loadTime = std::chrono::high_resolution_clock::now() - startTime;
+	std::cout << "Loaded " << objPath << " in " << loadTime.count() << " ms.\n";
+	return model;
+}
+
+bool CachedModel::map(const std::string& cachePath)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                          FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* mapping = fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if(mapping == nullptr)
+	{
+		if(fileMapping)
+		{
+			CloseHandle(fileMapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_fileMapping = fileMapping;
+	m_mapping = mapping;
+	m_mappingSize = size_t(size.QuadPart);
+#else
+	int fd = open(cachePath.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	void* mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		return false;
+	}
+	m_mapping = mapping;
+	m_mappingSize = size_t(info.st_size);
+#endif
+
+	///////////////////////////////////////////////////////////////////////
+	// Validate before handing out any pointers into the file
+	///////////////////////////////////////////////////////////////////////
+	const char* base = static_cast<const char*>(m_mapping);
+	const meshcache::Header* header = reinterpret_cast<const meshcache::Header*>(base);
+	auto fits = [this](uint64_t offset, uint64_t count, uint64_t size) {
+		return offset <= m_mappingSize && count <= (m_mappingSize - offset) / size;
+	};
+	bool valid = m_mappingSize >= sizeof(meshcache::Header) && memcmp(header->magic, Magic, sizeof(Magic)) == 0
+	             && header->version == meshcache::Version;
+	valid = valid && fits(header->materialOffset, header->numMaterials, sizeof(meshcache::Material))
+	        && fits(header->meshOffset, header->numMeshes, sizeof(meshcache::Mesh))
+	        && fits(header->vertexOffset, header->numVertices, sizeof(meshcache::Vertex))
+	        && fits(header->indexOffset, header->numIndices, sizeof(uint32_t));
+	// Every mesh and every index has to stay within the arrays, the draws and
+	// the collision grid index them without further checks
+	const meshcache::Mesh* meshes = reinterpret_cast<const meshcache::Mesh*>(base + header->meshOffset);
+	const uint32_t* indices = reinterpret_cast<const uint32_t*>(base + header->indexOffset);
+	for(uint32_t i = 0; valid && i < header->numMeshes; i++)
+	{
+		const meshcache::Mesh& mesh = meshes[i];
+		valid = uint64_t(mesh.firstIndex) + mesh.indexCount <= header->numIndices
+		        && uint64_t(mesh.baseVertex) + mesh.vertexCount <= header->numVertices
+		        && mesh.materialIdx < header->numMaterials;
+		for(uint32_t k = 0; valid && k < mesh.indexCount; k++)
+		{
+			valid = indices[mesh.firstIndex + k] < mesh.vertexCount;
+		}
+	}
+	// Texture paths are used as C strings
+	const meshcache::Material* materials = reinterpret_cast<const meshcache::Material*>(base + header->materialOffset);
+	for(uint32_t i = 0; valid && i < header->numMaterials; i++)
+	{
+		const meshcache::Material& material = materials[i];
+		valid = memchr(material.colorTexture, '\0', sizeof(material.colorTexture)) != nullptr
+		        && memchr(material.emissionTexture, '\0', sizeof(material.emissionTexture)) != nullptr;
+	}
+	if(!valid)
+	{
+		unmap();
+		return false;
+	}
+
+	m_header = header;
+	m_materials = reinterpret_cast<const meshcache::Material*>(base + header->materialOffset);
+	m_meshes = reinterpret_cast<const meshcache::Mesh*>(base + header->meshOffset);
+	m_vertices = reinterpret_cast<const meshcache::Vertex*>(base + header->vertexOffset);
+	m_indices = reinterpret_cast<const uint32_t*>(base + header->indexOffset);
+	return true;
+}
+
+void CachedModel::unmap()
+{
+	if(m_mapping == nullptr)
+	{
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(m_mapping);
+	CloseHandle(m_fileMapping);
+	CloseHandle(m_file);
+	m_file = m_fileMapping = nullptr;
+#else
+	munmap(m_mapping, m_mappingSize);
+#endif
+	m_mapping = nullptr;
+	m_mappingSize = 0;
+	m_header = nullptr;
+}
+
+void CachedModel::loadTextures()
+{
+	std::map<std::string, GLuint> loaded;
+	auto textureFor = [this, &loaded](const char* path) -> GLuint {
+		if(path[0] == '\0')
+		{
+			return 0;
+		}
+		auto it = loaded.find(path);
+		if(it == loaded.end())
+		{
+			m_textures.push_back(loadTexture(path));
+			it = loaded.emplace(path, m_textures.back().get()).first;
+		}
+		return it->second;
+	};
+	for(uint32_t i = 0; i < m_header->numMaterials; i++)
+	{
+		m_colorTextures.push_back(textureFor(m_materials[i].colorTexture));
+		m_emissionTextures.push_back(textureFor(m_materials[i].emissionTexture));
+	}
+}
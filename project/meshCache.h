@@ -0,0 +1,114 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "glResource.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary mesh cache. The first time an obj file is loaded it is converted to
+// a `<file>.meshcache` file next to it, which later runs map into memory and
+// use directly. Meshes are indexed and reordered for the post transform vertex
+// cache and for overdraw, and vertices are quantized to 16 bytes.
+///////////////////////////////////////////////////////////////////////////////
+namespace meshcache
+{
+const uint32_t Version = 2;
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t numMaterials;
+	uint32_t numMeshes;
+	uint32_t numVertices;
+	uint32_t numIndices;
+	uint32_t padding;
+	uint64_t sourceHash; // of the obj file and its material libraries
+	uint64_t sourceSize; // of the obj file, with sourceTime tells whether it has to be hashed
+	int64_t sourceTime;  // modification time of the obj file
+	uint64_t materialOffset;
+	uint64_t meshOffset;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+};
+
+struct Material
+{
+	float color[3];
+	float emission[3];
+	float metalness;
+	float fresnel;
+	float shininess;
+	char colorTexture[256];    // path, empty if none
+	char emissionTexture[256]; // path, empty if none
+};
+
+struct Mesh
+{
+	uint32_t materialIdx;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t baseVertex; // indices are relative to this vertex
+	uint32_t vertexCount;
+	float boundsMin[3]; // positions are quantized to this box
+	float boundsMax[3];
+	float boundingSphere[4];
+};
+
+struct Vertex
+{
+	int16_t position[4]; // snorm within the mesh bounds, w unused
+	int16_t normal[2];   // snorm octahedral encoding
+	uint16_t texCoord[2]; // half float
+};
+
+/// 64 bit FNV-1a hash
+uint64_t hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+} // namespace meshcache
+
+class CachedModel
+{
+public:
+	/// Maps the cache of `objPath` into memory, (re)building it from the obj file
+	/// first if it is missing, of another version or the source has changed.
+	/// Returns nullptr if the model could not be loaded at all.
+	static CachedModel* load(const std::string& objPath);
+
+	~CachedModel();
+
+	const meshcache::Header& header() const { return *m_header; }
+	const meshcache::Material* materials() const { return m_materials; }
+	const meshcache::Mesh* meshes() const { return m_meshes; }
+	const meshcache::Vertex* vertices() const { return m_vertices; }
+	const uint32_t* indices() const { return m_indices; }
+
+	/// Textures of the material, 0 if it has none
+	GLuint colorTexture(int material) const { return m_colorTextures[material]; }
+	GLuint emissionTexture(int material) const { return m_emissionTextures[material]; }
+
+private:
+	CachedModel();
+
+	/// Maps `cachePath` and validates its version and layout
+	bool map(const std::string& cachePath);
+	void unmap();
+	void loadTextures();
+
+	void* m_mapping;
+	size_t m_mappingSize;
+#ifdef _WIN32
+	void* m_file;
+	void* m_fileMapping;
+#endif
+
+	const meshcache::Header* m_header;
+	const meshcache::Material* m_materials;
+	const meshcache::Mesh* m_meshes;
+	const meshcache::Vertex* m_vertices;
+	const uint32_t* m_indices;
+	std::vector<GLuint> m_colorTextures;
+	std::vector<GLuint> m_emissionTextures;
+	std::vector<GlTexture> m_textures; // owns the above, materials share textures
+};
@@ -0,0 +1,136 @@
+#include "parallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+class WorkerPool
+{
+public:
+	WorkerPool() : m_body(nullptr), m_count(0), m_grain(1), m_next(0), m_busy(0), m_generation(0), m_stopping(false)
+	{
+		const int numWorkers = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+		for(int i = 0; i < numWorkers; i++)
+		{
+			m_workers.emplace_back(&WorkerPool::workerLoop, this);
+		}
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for(std::thread& worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	int numThreads() const { return int(m_workers.size()) + 1; }
+
+	void run(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body)
+	{
+		std::lock_guard<std::mutex> oneLoopAtATime(m_runMutex);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_body = &body;
+			m_count = count;
+			m_grain = grain;
+			m_next = 0;
+			m_busy = int(m_workers.size());
+			m_generation++;
+		}
+		m_wake.notify_all();
+
+		work();
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return m_busy == 0; });
+		m_body = nullptr;
+	}
+
+private:
+	void work()
+	{
+		for(;;)
+		{
+			const size_t first = m_next.fetch_add(m_grain);
+			if(first >= m_count)
+			{
+				return;
+			}
+			(*m_body)(first, std::min(first + m_grain, m_count));
+		}
+	}
+
+	void workerLoop()
+	{
+		uint64_t seen = 0;
+		for(;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&] { return m_stopping || m_generation != seen; });
+				if(m_stopping)
+				{
+					return;
+				}
+				seen = m_generation;
+			}
+			work();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_busy--;
+			}
+			m_done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	const std::function<void(size_t, size_t)>* m_body;
+	size_t m_count;
+	size_t m_grain;
+	std::atomic<size_t> m_next;
+	int m_busy;
+	uint64_t m_generation;
+	bool m_stopping;
+	std::mutex m_mutex;
+	std::mutex m_runMutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+};
+
+WorkerPool& pool()
+{
+	static WorkerPool workers;
+	return workers;
+}
+} // namespace
+
+void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+	grain = std::max<size_t>(grain, 1);
+	if(count <= grain)
+	{
+		if(count > 0)
+		{
+			body(0, count);
+		}
+		return;
+	}
+	pool().run(count, grain, body);
+}
+
+int parallelThreadCount()
+{
+	return pool().numThreads();
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+///////////////////////////////////////////////////////////////////////////////
+// Data parallel loops on a pool of worker threads that lives for the whole
+// program, so a loop costs a wake up instead of thread creation.
+///////////////////////////////////////////////////////////////////////////////
+
+/// Calls `body(first, last)` for consecutive ranges of at most `grain` elements
+/// covering [0, count), on the workers and the calling thread. Returns when all
+/// ranges are done. Loops started from several threads at once run one at a time,
+/// and `body` must not start another loop.
+void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+/// Threads a loop is spread over, including the caller
+int parallelThreadCount();
@@ -1,14 +1,16 @@
 #version 420
-layout(location = 0) in vec4 particle;
+// Either floats or half xyz and unorm16 life, the vertex array decodes both
+layout(location = 0) in vec3 particle_position;
+layout(location = 1) in float particle_life;
 uniform mat4 P;
 uniform float screen_x;
 uniform float screen_y;
 out float life;
 void main()
 {
-	life = particle.w;
+	life = particle_life;
 	// Particle is already in view space.
-	vec4 particle_vs = vec4(particle.xyz, 1.0);
+	vec4 particle_vs = vec4(particle_position, 1.0);
 	// Calculate one projected corner of a quad at the particles view space depth.
 	vec4 proj_quad = P * vec4(1.0, 1.0, particle_vs.z, particle_vs.w);
 	// Calculate the projected pixel size.
@@ -0,0 +1,23 @@
+#version 420
+in float life;
+layout(binding = 0) uniform sampler2D colortexture;
+layout(location = 0) out vec4 accumulation;
+layout(location = 1) out vec4 revealage;
+
+void main()
+{
+	// Same color and fade as particle.frag
+	vec4 color = texture(colortexture, gl_PointCoord);
+	color.rgb *= (1.0 - life);
+	color.a *= (1.0 - pow(life, 2.0)) * 0.5;
+
+	// Weight from McGuire and Bavoil (2013), eq. 10. Nearer and more opaque
+	// fragments get more say in the average, which hides the missing sort.
+	float weight = clamp(pow(min(1.0, color.a * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0),
+	                     1e-2, 3e3);
+
+	// Added up, premultiplied
+	accumulation = vec4(color.rgb * color.a, color.a) * weight;
+	// Multiplied into the target as (1 - alpha)
+	revealage = vec4(color.a);
+}
@@ -0,0 +1,20 @@
+#version 420
+layout(binding = 0) uniform sampler2D accumulationTexture;
+layout(binding = 1) uniform sampler2D revealageTexture;
+layout(location = 0) out vec4 fragmentColor;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float revealage = texelFetch(revealageTexture, pixel, 0).r;
+	if(revealage == 1.0)
+	{
+		// No particle covers this pixel
+		discard;
+	}
+	vec4 accumulation = texelFetch(accumulationTexture, pixel, 0);
+
+	// Weighted average color, premultiplied by the total coverage
+	vec3 average = accumulation.rgb / clamp(accumulation.a, 1e-4, 5e4);
+	fragmentColor = vec4(average * (1.0 - revealage), 1.0 - revealage);
+}
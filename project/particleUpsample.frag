@@ -0,0 +1,73 @@
+#version 420
+// Composites the low resolution particle target over the scene with a
+// nearest-depth filter: where the four low resolution texels around a pixel
+// are at about the pixel's own depth they are filtered bilinearly, at depth
+// edges the texel closest in depth is used alone, which avoids halos. Where
+// even that texel is well behind the pixel, e.g. on a foreground object
+// thinner than a block, the particles were only depth tested against the
+// background, so the pixel gets none rather than ones it should hide.
+layout(binding = 0) uniform sampler2D particleTexture; // premultiplied alpha
+layout(binding = 1) uniform sampler2D lowResDepthTexture;
+layout(binding = 2) uniform sampler2D sceneDepthTexture;
+// projectionMatrix[2][2] and [3][2], to get view space distances back
+uniform vec2 depthUnproject;
+// relative depth difference that counts as an edge
+uniform float edgeThreshold;
+// texels of the scene and of the particle target that hold the view, both
+// targets are allocated larger
+uniform vec2 sceneSize;
+uniform vec2 lowResSize;
+layout(location = 0) out vec4 fragmentColor;
+
+float linearDepth(float depth)
+{
+	return depthUnproject.y / (depth * 2.0 - 1.0 + depthUnproject.x);
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = linearDepth(texelFetch(sceneDepthTexture, pixel, 0).r);
+
+	vec2 lowResPosition = gl_FragCoord.xy / sceneSize * lowResSize;
+	ivec2 base = ivec2(floor(lowResPosition - 0.5));
+	ivec2 lastTexel = ivec2(lowResSize) - 1;
+
+	float maxDifference = 0.0;
+	float nearestDifference = 1e30;
+	float nearestDepth = depth;
+	ivec2 nearest = base;
+	for(int i = 0; i < 4; i++)
+	{
+		ivec2 texel = clamp(base + ivec2(i & 1, i >> 1), ivec2(0), lastTexel);
+		float texelDepth = linearDepth(texelFetch(lowResDepthTexture, texel, 0).r);
+		float difference = abs(texelDepth - depth);
+		maxDifference = max(maxDifference, difference);
+		if(difference < nearestDifference)
+		{
+			nearestDifference = difference;
+			nearestDepth = texelDepth;
+			nearest = texel;
+		}
+	}
+	// linearDepth is the distance along the view axis
+	if(nearestDepth - depth > edgeThreshold * abs(depth))
+	{
+		discard;
+	}
+
+	if(maxDifference < edgeThreshold * abs(depth))
+	{
+		// The target is allocated larger, keep the filter off the texels outside the view
+		vec2 position = clamp(lowResPosition, vec2(0.5), lowResSize - 0.5);
+		fragmentColor = texture(particleTexture, position / vec2(textureSize(particleTexture, 0)));
+	}
+	else
+	{
+		fragmentColor = texelFetch(particleTexture, nearest, 0);
+	}
+	if(fragmentColor.a == 0.0)
+	{
+		discard;
+	}
+}
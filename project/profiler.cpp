@@ -0,0 +1,457 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <imgui.h>
+
+Profiler::Profiler()
+    : m_epoch(Clock::now())
+    , m_recordFrame(0)
+    , m_lastFrameStart(m_epoch)
+    , m_queriesCreated(false)
+    , m_historyCount(0)
+    , m_historyNext(0)
+    , m_keepAll(false)
+    , m_resolvedFrame(0)
+    , m_resolvedGpuMs(-1.0f)
+{
+	for(int i = 0; i < FramesInFlight; i++)
+	{
+		for(int p = 0; p < MaxPasses; p++)
+		{
+			m_queries[i][p] = 0;
+			m_issued[i][p] = false;
+		}
+	}
+}
+
+int Profiler::addPass(const char* name, Thread thread)
+{
+	if(m_passes.size() == MaxPasses)
+	{
+		std::cout << "Profiler: too many passes, not timing " << name << std::endl;
+		return -1;
+	}
+	m_passes.push_back({ name, thread });
+	return int(m_passes.size()) - 1;
+}
+
+void Profiler::createQueries()
+{
+	for(int i = 0; i < FramesInFlight; i++)
+	{
+		glGenQueries(MaxPasses, m_queries[i]);
+	}
+	m_queriesCreated = true;
+}
+
+void Profiler::destroy()
+{
+	if(!m_queriesCreated)
+	{
+		return;
+	}
+	for(int i = 0; i < FramesInFlight; i++)
+	{
+		glDeleteQueries(MaxPasses, m_queries[i]);
+	}
+	m_queriesCreated = false;
+}
+
+double Profiler::microseconds(Clock::time_point t) const
+{
+	return std::chrono::duration<double, std::micro>(t - m_epoch).count();
+}
+
+Profiler::Frame& Profiler::slot(uint64_t frame)
+{
+	return m_pending[frame % PendingFrames];
+}
+
+uint64_t Profiler::beginFrame()
+{
+	const Clock::time_point now = Clock::now();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const uint64_t frame = ++m_recordFrame;
+	Frame& f = slot(frame);
+	f.index = frame;
+	f.start = microseconds(now);
+	f.frameMs = std::chrono::duration<float, std::milli>(now - m_lastFrameStart).count();
+	for(PassTiming& p : f.passes)
+	{
+		p.valid = false;
+		p.gpuMs = -1.0f;
+	}
+	m_lastFrameStart = now;
+	return frame;
+}
+
+void Profiler::beginGpuFrame(uint64_t frame)
+{
+	if(frame > FramesInFlight)
+	{
+		resolve(frame - FramesInFlight);
+	}
+	for(bool& issued : m_issued[frame % FramesInFlight])
+	{
+		issued = false;
+	}
+}
+
+void Profiler::resolve(uint64_t frame)
+{
+	const int querySlot = int(frame % FramesInFlight);
+	float gpuMs[MaxPasses];
+	for(size_t p = 0; p < m_passes.size(); p++)
+	{
+		gpuMs[p] = -1.0f;
+		if(!m_issued[querySlot][p])
+		{
+			continue;
+		}
+		// Never wait for the GPU. A result that is not there after FramesInFlight
+		// frames is dropped, the query is simply restarted for the new frame.
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(m_queries[querySlot][p], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available)
+		{
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(m_queries[querySlot][p], GL_QUERY_RESULT, &nanoseconds);
+			gpuMs[p] = float(nanoseconds * 1e-6);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Frame& f = slot(frame);
+	float frameGpuMs = -1.0f;
+	for(size_t p = 0; p < m_passes.size(); p++)
+	{
+		f.passes[p].gpuMs = gpuMs[p];
+		frameGpuMs = gpuMs[p] >= 0.0f ? std::max(frameGpuMs, 0.0f) + gpuMs[p] : frameGpuMs;
+	}
+	recordHistory(f);
+	m_resolvedFrame = frame;
+	m_resolvedGpuMs = frameGpuMs;
+}
+
+bool Profiler::latestGpuFrame(uint64_t& frame, float& gpuMs)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	frame = m_resolvedFrame;
+	gpuMs = m_resolvedGpuMs;
+	return m_resolvedFrame > 0 && m_resolvedGpuMs >= 0.0f;
+}
+
+void Profiler::recordHistory(const Frame& frame)
+{
+	if(m_keepAll)
+	{
+		m_log.push_back(frame);
+		return;
+	}
+	m_history[m_historyNext] = frame;
+	m_historyNext = (m_historyNext + 1) % HistoryLength;
+	m_historyCount = std::min<size_t>(m_historyCount + 1, HistoryLength);
+}
+
+void Profiler::flush()
+{
+	glFinish();
+	uint64_t last;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		last = m_recordFrame;
+	}
+	for(uint64_t frame = m_resolvedFrame + 1; frame <= last; frame++)
+	{
+		resolve(frame);
+	}
+}
+
+void Profiler::beginPass(uint64_t frame, int pass)
+{
+	if(pass < 0)
+	{
+		return;
+	}
+	if(m_passes[pass].thread == GLThread && m_queriesCreated)
+	{
+		// GL_TIME_ELAPSED queries can not nest, so neither can GL thread passes
+		glBeginQuery(GL_TIME_ELAPSED, m_queries[frame % FramesInFlight][pass]);
+	}
+	m_passBegin[frame % PendingFrames][pass] = Clock::now();
+}
+
+void Profiler::endPass(uint64_t frame, int pass)
+{
+	if(pass < 0)
+	{
+		return;
+	}
+	const Clock::time_point end = Clock::now();
+	if(m_passes[pass].thread == GLThread && m_queriesCreated)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		m_issued[frame % FramesInFlight][pass] = true;
+	}
+
+	const Clock::time_point begin = m_passBegin[frame % PendingFrames][pass];
+	std::lock_guard<std::mutex> lock(m_mutex);
+	PassTiming& timing = slot(frame).passes[pass];
+	timing.start = microseconds(begin);
+	timing.cpuMs = std::chrono::duration<float, std::milli>(end - begin).count();
+	timing.valid = true;
+}
+
+std::vector<const Profiler::Frame*> Profiler::historyInOrder() const
+{
+	std::vector<const Frame*> frames;
+	if(m_keepAll)
+	{
+		for(const Frame& frame : m_log)
+		{
+			frames.push_back(&frame);
+		}
+		return frames;
+	}
+	frames.reserve(m_historyCount);
+	const size_t first = (m_historyNext + HistoryLength - m_historyCount) % HistoryLength;
+	for(size_t i = 0; i < m_historyCount; i++)
+	{
+		frames.push_back(&m_history[(first + i) % HistoryLength]);
+	}
+	return frames;
+}
+
+namespace
+{
+Profiler::Stats computeStats(std::vector<float>& values)
+{
+	Profiler::Stats stats = { 0.0f, 0.0f, 0.0f };
+	if(values.empty())
+	{
+		return stats;
+	}
+	std::sort(values.begin(), values.end());
+	double sum = 0.0;
+	for(float v : values)
+	{
+		sum += v;
+	}
+	stats.min = values.front();
+	stats.avg = float(sum / values.size());
+	stats.p99 = values[(values.size() * 99 + 99) / 100 - 1];
+	return stats;
+}
+} // namespace
+
+void Profiler::passStats(int pass, Stats& cpu, Stats& gpu)
+{
+	std::vector<float> cpuValues, gpuValues;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(const Frame* f : historyInOrder())
+		{
+			const PassTiming& timing = f->passes[pass];
+			if(!timing.valid)
+			{
+				continue;
+			}
+			cpuValues.push_back(timing.cpuMs);
+			if(timing.gpuMs >= 0.0f)
+			{
+				gpuValues.push_back(timing.gpuMs);
+			}
+		}
+	}
+	cpu = computeStats(cpuValues);
+	gpu = computeStats(gpuValues);
+}
+
+void Profiler::gui()
+{
+	ImGui::Text("%-16s %-22s %-22s", "Pass", "CPU min/avg/p99 ms", "GPU min/avg/p99 ms");
+	for(size_t p = 0; p < m_passes.size(); p++)
+	{
+		Stats cpu, gpu;
+		passStats(int(p), cpu, gpu);
+		if(m_passes[p].thread == GLThread)
+		{
+			ImGui::Text("%-16s %6.3f %6.3f %6.3f   %6.3f %6.3f %6.3f", m_passes[p].name.c_str(), cpu.min, cpu.avg,
+			            cpu.p99, gpu.min, gpu.avg, gpu.p99);
+		}
+		else
+		{
+			ImGui::Text("%-16s %6.3f %6.3f %6.3f   %6s", m_passes[p].name.c_str(), cpu.min, cpu.avg, cpu.p99, "-");
+		}
+	}
+
+	std::vector<float> frameTimes;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(const Frame* f : historyInOrder())
+		{
+			frameTimes.push_back(f->frameMs);
+		}
+	}
+	if(!frameTimes.empty())
+	{
+		std::vector<float> sorted = frameTimes;
+		const Stats frame = computeStats(sorted);
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "avg %.2f ms, p99 %.2f ms", frame.avg, frame.p99);
+		ImGui::PlotLines("Frame time", frameTimes.data(), int(frameTimes.size()), 0, overlay, 0.0f,
+		                 std::max(frame.p99 * 1.5f, 1.0f), ImVec2(0, 80));
+	}
+
+	if(ImGui::Button("Export CSV"))
+	{
+		exportCsv("profile.csv");
+	}
+	ImGui::SameLine();
+	if(ImGui::Button("Export trace"))
+	{
+		exportChromeTrace("profile.json");
+	}
+}
+
+void Profiler::printSummary()
+{
+	std::vector<float> frameTimes;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(const Frame* f : historyInOrder())
+		{
+			frameTimes.push_back(f->frameMs);
+		}
+	}
+	const Stats frame = computeStats(frameTimes);
+	printf("%zu frames, frame time min %.3f avg %.3f p99 %.3f ms\n", frameTimes.size(), frame.min, frame.avg,
+	       frame.p99);
+	printf("%-16s %-22s %-22s\n", "Pass", "CPU min/avg/p99 ms", "GPU min/avg/p99 ms");
+	for(size_t p = 0; p < m_passes.size(); p++)
+	{
+		Stats cpu, gpu;
+		passStats(int(p), cpu, gpu);
+		if(m_passes[p].thread == GLThread)
+		{
+			printf("%-16s %6.3f %6.3f %6.3f   %6.3f %6.3f %6.3f\n", m_passes[p].name.c_str(), cpu.min, cpu.avg,
+			       cpu.p99, gpu.min, gpu.avg, gpu.p99);
+		}
+		else
+		{
+			printf("%-16s %6.3f %6.3f %6.3f   %6s\n", m_passes[p].name.c_str(), cpu.min, cpu.avg, cpu.p99, "-");
+		}
+	}
+	fflush(stdout);
+}
+
+bool Profiler::exportCsv(const std::string& filename)
+{
+	std::vector<Frame> frames;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(const Frame* f : historyInOrder())
+		{
+			frames.push_back(*f);
+		}
+	}
+
+	std::ofstream file(filename);
+	if(!file)
+	{
+		std::cout << "Failed to write " << filename << std::endl;
+		return false;
+	}
+	file << "frame,frame_ms,pass,thread,start_us,cpu_ms,gpu_ms\n";
+	for(const Frame& f : frames)
+	{
+		for(size_t p = 0; p < m_passes.size(); p++)
+		{
+			const PassTiming& timing = f.passes[p];
+			if(!timing.valid)
+			{
+				continue;
+			}
+			file << f.index << ',' << f.frameMs << ',' << m_passes[p].name << ','
+			     << (m_passes[p].thread == GLThread ? "gl" : "main") << ',' << uint64_t(timing.start) << ','
+			     << timing.cpuMs << ',';
+			if(timing.gpuMs >= 0.0f)
+			{
+				file << timing.gpuMs;
+			}
+			file << '\n';
+		}
+	}
+	std::cout << "Wrote " << frames.size() << " frames to " << filename << std::endl;
+	return true;
+}
+
+bool Profiler::exportChromeTrace(const std::string& filename)
+{
+	std::vector<Frame> frames;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(const Frame* f : historyInOrder())
+		{
+			frames.push_back(*f);
+		}
+	}
+
+	std::ofstream file(filename);
+	if(!file)
+	{
+		std::cout << "Failed to write " << filename << std::endl;
+		return false;
+	}
+
+	enum
+	{
+		MainTid = 1,
+		GLTid = 2,
+		GpuTid = 3
+	};
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << MainTid << ",\"args\":{\"name\":\"Main\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << GLTid << ",\"args\":{\"name\":\"GL submit\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << GpuTid << ",\"args\":{\"name\":\"GPU\"}}";
+
+	char event[256];
+	// Timer queries only give durations, so GPU passes are placed at their
+	// submission time, or right after the previous GPU pass if that ends later
+	double gpuEnd = 0.0;
+	for(const Frame& f : frames)
+	{
+		for(size_t p = 0; p < m_passes.size(); p++)
+		{
+			const PassTiming& timing = f.passes[p];
+			if(!timing.valid)
+			{
+				continue;
+			}
+			const char* name = m_passes[p].name.c_str();
+			const int tid = m_passes[p].thread == GLThread ? GLTid : MainTid;
+			snprintf(event, sizeof(event),
+			         ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+			         "\"args\":{\"frame\":%llu}}",
+			         name, tid, timing.start, timing.cpuMs * 1000.0, (unsigned long long)f.index);
+			file << event;
+
+			if(timing.gpuMs >= 0.0f)
+			{
+				const double start = std::max(timing.start, gpuEnd);
+				gpuEnd = start + timing.gpuMs * 1000.0;
+				snprintf(event, sizeof(event),
+				         ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+				         "\"args\":{\"frame\":%llu}}",
+				         name, GpuTid, start, timing.gpuMs * 1000.0, (unsigned long long)f.index);
+				file << event;
+			}
+		}
+	}
+	file << "\n]}\n";
+	std::cout << "Wrote " << frames.size() << " frames to " << filename << std::endl;
+	return true;
+}
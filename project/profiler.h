@@ -0,0 +1,156 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Per pass CPU and GPU timings. Passes are registered once at startup and are
+// either measured on the main thread (CPU only) or on the GL thread, where a
+// GL_TIME_ELAPSED query is wrapped around them as well. The queries live in a
+// ring of FramesInFlight frames and a frame is read back only when its slot is
+// needed again, by which time the GPU has long finished it.
+///////////////////////////////////////////////////////////////////////////////
+class Profiler
+{
+public:
+	enum
+	{
+		MaxPasses = 16,
+		FramesInFlight = 4,
+		HistoryLength = 256
+	};
+
+	enum Thread
+	{
+		MainThread,
+		GLThread
+	};
+
+	struct Stats
+	{
+		float min;
+		float avg;
+		float p99;
+	};
+
+	/// Measures the lifetime of the scope, use on the thread the pass was registered for
+	class Scope
+	{
+	public:
+		Scope(Profiler& profiler, uint64_t frame, int pass) : m_profiler(profiler), m_frame(frame), m_pass(pass)
+		{
+			m_profiler.beginPass(m_frame, m_pass);
+		}
+		~Scope() { m_profiler.endPass(m_frame, m_pass); }
+
+	private:
+		Profiler& m_profiler;
+		uint64_t m_frame;
+		int m_pass;
+	};
+
+	Profiler();
+
+	/// Registers a pass, before any frame is started
+	int addPass(const char* name, Thread thread);
+
+	/// Creates the timer queries, needs the GL context
+	void createQueries();
+	void destroy();
+
+	/// Main thread: starts recording a new frame and returns its index
+	uint64_t beginFrame();
+
+	/// GL thread: called before the first pass of `frame` is replayed. Reads back
+	/// the frame that used the same query slot before and moves it to the history.
+	void beginGpuFrame(uint64_t frame);
+
+	void beginPass(uint64_t frame, int pass);
+	void endPass(uint64_t frame, int pass);
+
+	/// GL thread: waits for the GPU and reads back every frame still in flight
+	void flush();
+
+	/// Keeps every frame instead of the last HistoryLength, for benchmark runs
+	void setKeepAll(bool keepAll) { m_keepAll = keepAll; }
+
+	/// GPU time of all GL thread passes of the last frame read back. Returns false
+	/// if no frame has been read back or none of its passes was measured.
+	bool latestGpuFrame(uint64_t& frame, float& gpuMs);
+
+	/// Rolling statistics over the history, in milliseconds. Fields are 0 if the pass has no samples.
+	void passStats(int pass, Stats& cpu, Stats& gpu);
+
+	/// Draws the timing table, frame time graph and export buttons
+	void gui();
+
+	/// Writes the same table to stdout
+	void printSummary();
+
+	bool exportCsv(const std::string& filename);
+	/// Trace event format, loadable in chrome://tracing or Perfetto
+	bool exportChromeTrace(const std::string& filename);
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	struct PassTiming
+	{
+		double start; // microseconds since the profiler was created
+		float cpuMs;
+		float gpuMs; // < 0 if not measured
+		bool valid;
+	};
+
+	struct Frame
+	{
+		uint64_t index;
+		double start;
+		float frameMs;
+		PassTiming passes[MaxPasses];
+	};
+
+	struct Pass
+	{
+		std::string name;
+		Thread thread;
+	};
+
+	double microseconds(Clock::time_point t) const;
+	Frame& slot(uint64_t frame);
+	void resolve(uint64_t frame);
+	void recordHistory(const Frame& frame);
+	std::vector<const Frame*> historyInOrder() const;
+
+	Clock::time_point m_epoch;
+	std::vector<Pass> m_passes;
+
+	// Frames that are recorded but not yet read back. Main thread may be up to two
+	// frames ahead of the GL thread, which reads back FramesInFlight frames late.
+	enum
+	{
+		PendingFrames = FramesInFlight + 4
+	};
+	Frame m_pending[PendingFrames];
+	Clock::time_point m_passBegin[PendingFrames][MaxPasses];
+	uint64_t m_recordFrame;
+	Clock::time_point m_lastFrameStart;
+
+	GLuint m_queries[FramesInFlight][MaxPasses];
+	bool m_issued[FramesInFlight][MaxPasses];
+	bool m_queriesCreated;
+
+	Frame m_history[HistoryLength];
+	size_t m_historyCount;
+	size_t m_historyNext;
+	bool m_keepAll;
+	std::vector<Frame> m_log;
+	uint64_t m_resolvedFrame;
+	float m_resolvedGpuMs; // < 0 if not measured
+
+	std::mutex m_mutex;
+};
@@ -0,0 +1,462 @@
+#include "shaderReloader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// Editors often write a file in several steps, a program is rebuilt once its files were left alone this long
+const std::chrono::milliseconds Settle(100);
+// How often modification times are compared where there is no inotify
+const std::chrono::milliseconds PollInterval(250);
+
+struct WatchedFile
+{
+	std::string path;
+	std::string directory;
+	std::string name;
+	std::vector<int> entries;
+	time_t modified;
+};
+
+time_t modificationTime(const std::string& path)
+{
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+}
+
+std::string baseName(const std::string& path)
+{
+	const size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+std::string directoryName(const std::string& path)
+{
+	const size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+float millisecondsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	return std::chrono::duration<float, std::milli>(end - start).count();
+}
+} // namespace
+
+ShaderReloader::ShaderReloader() : m_parallel(false), m_checkedParallel(false), m_running(false), m_reloadAll(false)
+{
+	m_counters = Counters{ 0, 0, 0, 0, false };
+}
+
+ShaderReloader::~ShaderReloader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	if(m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+void ShaderReloader::add(GlProgram* program, const std::string& vertexShader, const std::string& fragmentShader)
+{
+	Entry entry;
+	entry.program = program;
+	entry.files[0] = vertexShader;
+	entry.files[1] = fragmentShader;
+	entry.numFiles = fragmentShader.empty() ? 1 : 2;
+	entry.name = baseName(vertexShader) + (fragmentShader.empty() ? "" : " + " + baseName(fragmentShader));
+	m_entries.push_back(entry);
+}
+
+void ShaderReloader::start()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_running = true;
+	m_thread = std::thread(&ShaderReloader::run, this);
+}
+
+void ShaderReloader::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+		m_requests.clear();
+	}
+	if(m_thread.joinable())
+	{
+		m_thread.join();
+	}
+	for(Build& build : m_builds)
+	{
+		deleteBuild(build);
+	}
+	m_builds.clear();
+}
+
+void ShaderReloader::reloadAll()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_reloadAll = true;
+}
+
+ShaderReloader::Counters ShaderReloader::counters()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_counters;
+}
+
+void ShaderReloader::run()
+{
+	std::vector<WatchedFile> files;
+	for(int i = 0; i < int(m_entries.size()); i++)
+	{
+		for(int f = 0; f < m_entries[i].numFiles; f++)
+		{
+			const std::string& path = m_entries[i].files[f];
+			auto file = std::find_if(files.begin(), files.end(),
+			                         [&path](const WatchedFile& w) { return w.path == path; });
+			if(file == files.end())
+			{
+				files.push_back(
+				    WatchedFile{ path, directoryName(path), baseName(path), {}, modificationTime(path) });
+				file = files.end() - 1;
+			}
+			file->entries.push_back(i);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_counters.watchedFiles = int(files.size());
+	}
+
+	// Entries whose files changed, and when they last did
+	std::vector<bool> dirty(m_entries.size(), false);
+	std::vector<Clock::time_point> changed(m_entries.size());
+	auto markChanged = [&](const WatchedFile& file, Clock::time_point when) {
+		for(int entry : file.entries)
+		{
+			dirty[entry] = true;
+			changed[entry] = when;
+		}
+	};
+
+#ifdef __linux__
+	// One watch per directory, files are often replaced rather than written in place
+	std::map<int, std::string> directories;
+	const int inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	for(const WatchedFile& file : files)
+	{
+		const uint32_t events = IN_CLOSE_WRITE | IN_MOVED_TO;
+		const int watch = inotify >= 0 ? inotify_add_watch(inotify, file.directory.c_str(), events) : -1;
+		if(watch < 0)
+		{
+			std::cout << "Could not watch " << file.directory << " for shader changes.\n";
+			continue;
+		}
+		directories[watch] = file.directory;
+	}
+#endif
+
+	for(;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(!m_running)
+			{
+				break;
+			}
+			if(m_reloadAll)
+			{
+				std::fill(dirty.begin(), dirty.end(), true);
+				std::fill(changed.begin(), changed.end(), Clock::now() - Settle);
+				m_reloadAll = false;
+			}
+		}
+
+#ifdef __linux__
+		if(inotify >= 0)
+		{
+			pollfd descriptor = { inotify, POLLIN, 0 };
+			if(::poll(&descriptor, 1, 50) > 0)
+			{
+				alignas(inotify_event) char buffer[4096];
+				ssize_t length;
+				while((length = read(inotify, buffer, sizeof(buffer))) > 0)
+				{
+					for(char* p = buffer; p < buffer + length;)
+					{
+						const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+						p += sizeof(inotify_event) + event->len;
+						if(event->len == 0)
+						{
+							continue;
+						}
+						const std::string& directory = directories[event->wd];
+						for(const WatchedFile& file : files)
+						{
+							if(file.directory == directory && file.name == event->name)
+							{
+								markChanged(file, Clock::now());
+							}
+						}
+					}
+				}
+			}
+		}
+		else
+#endif
+		{
+			std::this_thread::sleep_for(PollInterval);
+			for(WatchedFile& file : files)
+			{
+				const time_t modified = modificationTime(file.path);
+				if(modified != file.modified)
+				{
+					file.modified = modified;
+					markChanged(file, Clock::now());
+				}
+			}
+		}
+
+		const Clock::time_point now = Clock::now();
+		for(int i = 0; i < int(m_entries.size()); i++)
+		{
+			if(!dirty[i] || now - changed[i] < Settle)
+			{
+				continue;
+			}
+			dirty[i] = false;
+			Request request;
+			if(readSources(i, request))
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_requests.push_back(request);
+				m_counters.pending++; // recounted by poll()
+			}
+		}
+	}
+
+#ifdef __linux__
+	if(inotify >= 0)
+	{
+		close(inotify);
+	}
+#endif
+}
+
+bool ShaderReloader::readSources(int entry, Request& request) const
+{
+	request.entry = entry;
+	for(int f = 0; f < m_entries[entry].numFiles; f++)
+	{
+		std::ifstream file(m_entries[entry].files[f]);
+		std::stringstream source;
+		source << file.rdbuf();
+		request.sources[f] = source.str();
+		if(!file || request.sources[f].empty())
+		{
+			std::cout << "Could not read " << m_entries[entry].files[f] << ", not reloading it.\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+void ShaderReloader::poll()
+{
+	if(!m_checkedParallel)
+	{
+		m_parallel = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+		if(GLEW_KHR_parallel_shader_compile)
+		{
+			// Let the driver pick how many threads to compile on
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		}
+		else if(GLEW_ARB_parallel_shader_compile)
+		{
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		}
+		m_checkedParallel = true;
+	}
+
+	std::vector<Request> requests;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		requests.swap(m_requests);
+		m_counters.parallel = m_parallel;
+	}
+	for(const Request& request : requests)
+	{
+		startBuild(request);
+	}
+
+	// Without the extension every status query waits for the driver, so only
+	// one build is advanced a frame
+	int advanced = 0;
+	for(size_t i = 0; i < m_builds.size() && (m_parallel || advanced == 0);)
+	{
+		advanced++;
+		if(advance(m_builds[i]))
+		{
+			m_builds.erase(m_builds.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_counters.pending = int(m_requests.size() + m_builds.size());
+}
+
+void ShaderReloader::startBuild(const Request& request)
+{
+	// A newer change replaces a build of the same program that has not finished
+	for(size_t i = 0; i < m_builds.size(); i++)
+	{
+		if(m_builds[i].entry == request.entry)
+		{
+			deleteBuild(m_builds[i]);
+			m_builds.erase(m_builds.begin() + i);
+			break;
+		}
+	}
+
+	const Entry& entry = m_entries[request.entry];
+	Build build;
+	build.entry = request.entry;
+	build.numShaders = entry.numFiles;
+	build.program = 0;
+	build.compileMs = 0.0f;
+	build.start = Clock::now();
+	const GLenum types[2] = { GLenum(entry.numFiles == 1 ? GL_COMPUTE_SHADER : GL_VERTEX_SHADER),
+		                      GL_FRAGMENT_SHADER };
+	for(int s = 0; s < build.numShaders; s++)
+	{
+		const char* source = request.sources[s].c_str();
+		build.shaders[s] = glCreateShader(types[s]);
+		glShaderSource(build.shaders[s], 1, &source, nullptr);
+		glCompileShader(build.shaders[s]);
+	}
+	m_builds.push_back(build);
+}
+
+bool ShaderReloader::isComplete(GLuint object, bool program) const
+{
+	if(!m_parallel)
+	{
+		return true;
+	}
+	GLint complete = GL_FALSE;
+	if(program)
+	{
+		glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &complete);
+	}
+	else
+	{
+		glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &complete);
+	}
+	return complete == GL_TRUE;
+}
+
+bool ShaderReloader::advance(Build& build)
+{
+	const Entry& entry = m_entries[build.entry];
+	char log[4096];
+	if(build.program == 0)
+	{
+		for(int s = 0; s < build.numShaders; s++)
+		{
+			if(!isComplete(build.shaders[s], false))
+			{
+				return false;
+			}
+		}
+		for(int s = 0; s < build.numShaders; s++)
+		{
+			GLint compiled = GL_FALSE;
+			glGetShaderiv(build.shaders[s], GL_COMPILE_STATUS, &compiled);
+			if(compiled != GL_TRUE)
+			{
+				glGetShaderInfoLog(build.shaders[s], sizeof(log), nullptr, log);
+				std::cout << "Reloading " << entry.name << " failed, keeping the previous program.\n"
+				          << entry.files[s] << ":\n" << log << "\n";
+				deleteBuild(build);
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_counters.failed++;
+				return true;
+			}
+		}
+
+		// Seen once a frame with the extension, so this is only as fine as the frame time
+		build.linkStart = Clock::now();
+		build.compileMs = millisecondsBetween(build.start, build.linkStart);
+		build.program = glCreateProgram();
+		for(int s = 0; s < build.numShaders; s++)
+		{
+			glAttachShader(build.program, build.shaders[s]);
+		}
+		glLinkProgram(build.program);
+	}
+	if(!isComplete(build.program, true))
+	{
+		return false;
+	}
+
+	const float linkMs = millisecondsBetween(build.linkStart, Clock::now());
+	GLint linked = GL_FALSE;
+	glGetProgramiv(build.program, GL_LINK_STATUS, &linked);
+	if(linked != GL_TRUE)
+	{
+		glGetProgramInfoLog(build.program, sizeof(log), nullptr, log);
+		std::cout << "Linking " << entry.name << " failed, keeping the previous program.\n" << log << "\n";
+		deleteBuild(build);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_counters.failed++;
+		return true;
+	}
+
+	for(int s = 0; s < build.numShaders; s++)
+	{
+		glDetachShader(build.program, build.shaders[s]);
+		glDeleteShader(build.shaders[s]);
+	}
+	build.numShaders = 0;
+	// Frames after this one use the new program, GL keeps the old one alive for the draws already submitted
+	*entry.program = GlProgram::adopt(build.program, "Shaders", GL_RESOURCE_SITE);
+	build.program = 0;
+	std::cout << "Reloaded " << entry.name << ": compile " << build.compileMs << " ms, link " << linkMs << " ms"
+	          << (m_parallel ? " (parallel)" : "") << ".\n";
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_counters.reloaded++;
+	return true;
+}
+
+void ShaderReloader::deleteBuild(Build& build)
+{
+	for(int s = 0; s < build.numShaders; s++)
+	{
+		glDeleteShader(build.shaders[s]);
+	}
+	build.numShaders = 0;
+	if(build.program != 0)
+	{
+		glDeleteProgram(build.program);
+		build.program = 0;
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "glResource.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Rebuilds shader programs in the background when their files change. A
+// watcher thread (inotify on Linux, polling modification times elsewhere)
+// notices writes to the files of the programs added, waits for the writes to
+// settle and reads the new sources. poll() on the GL thread then starts the
+// compile, and on later frames checks GL_COMPLETION_STATUS_KHR, links once
+// the shaders are done and swaps the program's handle only after it has
+// linked, so a frame never waits for the driver and a program that fails to
+// build leaves the old one in place.
+//
+// Without KHR or ARB_parallel_shader_compile the status queries block, so at most
+// one program is built per frame instead.
+///////////////////////////////////////////////////////////////////////////////
+class ShaderReloader
+{
+public:
+	struct Counters
+	{
+		int watchedFiles;
+		int pending; // changed, being compiled or linked
+		uint64_t reloaded;
+		uint64_t failed;
+		bool parallel; // KHR or ARB_parallel_shader_compile is used
+	};
+
+	ShaderReloader();
+	~ShaderReloader();
+
+	/// Registers `program` as built from `vertexShader` and `fragmentShader`, or
+	/// from the compute shader `vertexShader` if `fragmentShader` is empty
+	void add(GlProgram* program, const std::string& vertexShader, const std::string& fragmentShader);
+
+	/// Starts the thread watching the files of every program added
+	void start();
+	/// Stops the watcher and deletes the programs still being built, needs the GL context
+	void stop();
+
+	/// Rebuilds every program, as if all of their files had changed
+	void reloadAll();
+
+	/// GL thread, once a frame: starts building the programs whose files changed
+	/// and swaps in those that have linked
+	void poll();
+
+	Counters counters();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Entry
+	{
+		GlProgram* program;
+		std::string files[2];
+		int numFiles;
+		std::string name;
+	};
+
+	struct Request
+	{
+		int entry;
+		std::string sources[2];
+	};
+
+	struct Build
+	{
+		int entry;
+		GLuint shaders[2];
+		int numShaders;
+		GLuint program; // 0 while compiling
+		Clock::time_point start;
+		Clock::time_point linkStart;
+		float compileMs;
+	};
+
+	void run();
+	bool readSources(int entry, Request& request) const;
+	void startBuild(const Request& request);
+	/// Returns true once the build has finished, whether or not it succeeded
+	bool advance(Build& build);
+	bool isComplete(GLuint object, bool program) const;
+	void deleteBuild(Build& build);
+
+	std::vector<Entry> m_entries; // fixed once the watcher runs
+	std::vector<Build> m_builds;  // GL thread only
+	bool m_parallel;
+	bool m_checkedParallel;
+
+	// Everything below is guarded by m_mutex
+	std::mutex m_mutex;
+	bool m_running;
+	bool m_reloadAll;
+	std::thread m_thread;
+	std::vector<Request> m_requests;
+	Counters m_counters;
+};
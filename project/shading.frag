@@ -1,4 +1,4 @@
-#version 420
+#version 430
 
 // required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
 precision highp float;
@@ -6,23 +6,38 @@ precision highp float;
 ///////////////////////////////////////////////////////////////////////////////
 // Material
 ///////////////////////////////////////////////////////////////////////////////
-uniform vec3 material_color = vec3(1, 1, 1);
-uniform float material_metalness = 0;
-uniform float material_fresnel = 0;
-uniform float material_shininess = 0;
-uniform vec3 material_emission = vec3(0);
+struct Material
+{
+	vec4 color;
+	vec4 emission;
+	float metalness;
+	float fresnel;
+	float shininess;
+	int hasTextures; // bit 0: color texture, bit 1: emission texture
+};
+layout(std430, binding = 1) readonly buffer MaterialBuffer
+{
+	Material materials[];
+};
+flat in uint materialIdx;
 
-uniform int has_color_texture = 0;
+vec3 material_color;
+float material_metalness;
+float material_fresnel;
+float material_shininess;
+vec3 material_emission;
+
+int has_color_texture;
 layout(binding = 0) uniform sampler2D colorMap;
-uniform int has_emission_texture = 0;
+int has_emission_texture;
 layout(binding = 5) uniform sampler2D emissiveMap;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Environment
 ///////////////////////////////////////////////////////////////////////////////
-layout(binding = 6) uniform sampler2D environmentMap;
-layout(binding = 7) uniform sampler2D irradianceMap;
-layout(binding = 8) uniform sampler2D reflectionMap;
+layout(binding = 6) uniform samplerCube environmentMap;
+layout(binding = 7) uniform samplerCube irradianceMap;
+layout(binding = 8) uniform samplerCube reflectionMap;
 uniform float environment_multiplier;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -112,43 +127,16 @@ vec3 calculateIndirectIllumination(vec3 wo, vec3 n, vec3 base_color)
 {
 	vec3 indirect_illum = vec3(0.f);
 
-	// Lookup the irradiance from the irradiance map and calculate the diffuse reflection.    
-	// Calculate the spherical coordinates of the direction
-	vec3 diffuse_term;
-	{
-		vec3 dir = (transpose(inverse(viewInverse)) * vec4(n, 0.0)).xyz;
-
-		float theta = acos(max(-1.0f, min(1.0f, dir.y)));
-		float phi = atan(dir.z, dir.x);
-		if(phi < 0.0f)
-		{
-			phi = phi + 2.0f * PI;
-		}
-
-		// Use these to lookup the color in the environment map
-		vec2 lookup = vec2(phi / (2.0 * PI), 1 - theta / PI);
-		vec3 irradiance = (texture(irradianceMap, lookup)).xyz;
-
-		diffuse_term = base_color * (1.0 / PI) * irradiance;
-	}
-
-	// Look up in the reflection map from the perfect specular direction and calculate the dielectric and metal terms.     
+	// World space direction, the environment cubemaps are looked up by direction directly
 	vec3 dir = (transpose(inverse(viewInverse)) * vec4(n, 0.0)).xyz;
 
-	float theta = acos(max(-1.0f, min(1.0f, dir.y)));
-	float phi = atan(dir.z, dir.x);
-	if(phi < 0.0f)
-	{
-		phi = phi + 2.0f * PI;
-	}
-
-	// Use these to lookup the color in the environment map
-	vec2 lookup = vec2(phi / (2.0 * PI), 1 - theta / PI);
-
-
+	// Lookup the irradiance from the irradiance map and calculate the diffuse reflection.
+	vec3 irradiance = texture(irradianceMap, dir).xyz;
+	vec3 diffuse_term = base_color * (1.0 / PI) * irradiance;
 
+	// Look up in the reflection map from the perfect specular direction and calculate the dielectric and metal terms.
 	float roughness = sqrt(sqrt(2/(material_shininess+2)));
-	vec3 li = environment_multiplier * textureLod(reflectionMap, lookup, roughness * 7.0).rgb;
+	vec3 li = environment_multiplier * textureLod(reflectionMap, dir, roughness * 7.0).rgb;
 
 	vec3 wi = normalize(viewSpaceLightPosition - viewSpacePosition);
 	vec3 wh = normalize(wi + wo);
@@ -163,6 +151,15 @@ vec3 calculateIndirectIllumination(vec3 wo, vec3 n, vec3 base_color)
 
 void main()
 {
+	Material material = materials[materialIdx];
+	material_color = material.color.rgb;
+	material_metalness = material.metalness;
+	material_fresnel = material.fresnel;
+	material_shininess = material.shininess;
+	material_emission = material.emission.rgb;
+	has_color_texture = material.hasTextures & 1;
+	has_emission_texture = (material.hasTextures >> 1) & 1;
+
 	float visibility = textureProj(shadowMapTex, shadowMapCoord);
 	float attenuation = 1.0;
 
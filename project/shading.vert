@@ -1,17 +1,37 @@
-#version 420
+#version 430
 ///////////////////////////////////////////////////////////////////////////////
 // Input vertex attributes
 ///////////////////////////////////////////////////////////////////////////////
-layout(location = 0) in vec3 position;
-layout(location = 1) in vec3 normalIn;
-layout(location = 2) in vec2 texCoordIn;
+layout(location = 0) in vec3 position;   // snorm within the mesh bounds
+layout(location = 1) in vec2 normalOct;  // snorm octahedral encoding
+layout(location = 2) in vec2 texCoordIn; // half float
+layout(location = 3) in uint drawId; // instanced, fetched through the command's baseInstance
+
+///////////////////////////////////////////////////////////////////////////////
+// Per draw data of the geometry arena
+///////////////////////////////////////////////////////////////////////////////
+struct Draw
+{
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+	vec4 boundingSphere;
+	vec4 positionScale;
+	vec4 positionOffset;
+	uint materialIdx;
+	uint firstIndex;
+	uint indexCount;
+	uint baseVertex;
+};
+layout(std430, binding = 0) readonly buffer DrawBuffer
+{
+	Draw draws[];
+};
 
 ///////////////////////////////////////////////////////////////////////////////
 // Input uniform variables
 ///////////////////////////////////////////////////////////////////////////////
-uniform mat4 normalMatrix;
-uniform mat4 modelViewMatrix;
-uniform mat4 modelViewProjectionMatrix;
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
 
 uniform mat4 lightMatrix;
 
@@ -21,15 +41,30 @@ uniform mat4 lightMatrix;
 out vec2 texCoord;
 out vec3 viewSpaceNormal;
 out vec3 viewSpacePosition;
+flat out uint materialIdx;
 
 out vec4 shadowMapCoord;
 
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
 void main()
 {
-	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+	Draw draw = draws[drawId];
+	vec3 objectSpacePos = draw.positionOffset.xyz + draw.positionScale.xyz * position;
+	vec3 normalIn = octDecode(normalOct);
+	vec4 viewSpacePos = viewMatrix * (draw.modelMatrix * vec4(objectSpacePos, 1.0));
+	gl_Position = projectionMatrix * viewSpacePos;
 	texCoord = texCoordIn;
-	viewSpaceNormal = (normalMatrix * vec4(normalIn, 0.0)).xyz;
-	viewSpacePosition = (modelViewMatrix * vec4(position, 1.0)).xyz;
+	// The view matrix is rigid, so it can rotate the world space normal directly
+	viewSpaceNormal = (viewMatrix * (draw.normalMatrix * vec4(normalIn, 0.0))).xyz;
+	viewSpacePosition = viewSpacePos.xyz;
+	materialIdx = draw.materialIdx;
 
 	shadowMapCoord = lightMatrix * vec4(viewSpacePosition, 1.f);
 }
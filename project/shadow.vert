@@ -0,0 +1,30 @@
+#version 430
+
+layout(location = 0) in vec3 position;
+layout(location = 3) in uint drawId;
+
+struct Draw
+{
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+	vec4 boundingSphere;
+	vec4 positionScale;
+	vec4 positionOffset;
+	uint materialIdx;
+	uint firstIndex;
+	uint indexCount;
+	uint baseVertex;
+};
+layout(std430, binding = 0) readonly buffer DrawBuffer
+{
+	Draw draws[];
+};
+
+uniform mat4 viewProjectionMatrix;
+
+void main()
+{
+	Draw draw = draws[drawId];
+	vec3 objectSpacePos = draw.positionOffset.xyz + draw.positionScale.xyz * position;
+	gl_Position = viewProjectionMatrix * (draw.modelMatrix * vec4(objectSpacePos, 1.0));
+}
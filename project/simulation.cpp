@@ -0,0 +1,281 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+
+constexpr int Simulation::TickRate;
+constexpr float Simulation::TickLength;
+
+namespace
+{
+const float ShipSpeed = 50.0f;
+const float ShipTurnSpeed = 4.0f;
+const float LightRotationSpeed = 90.0f; // degrees per second
+const float ParticleRepulsionStrength = 200.0f;
+// How far the simulation may fall behind before it drops time instead of catching up
+const int MaxCatchUpTicks = 8;
+} // namespace
+
+mat4 ShipState::modelMatrix() const
+{
+	return translate(position) * rotate(yaw, vec3(0, 1, 0));
+}
+
+float SimSnapshot::alpha(double now) const
+{
+	return clamp(float((now - time) / Simulation::TickLength), 0.0f, 1.0f);
+}
+
+mat4 SimSnapshot::shipMatrix(float alpha) const
+{
+	ShipState interpolated;
+	interpolated.position = mix(previousShip.position, ship.position, alpha);
+	interpolated.yaw = mix(previousShip.yaw, ship.yaw, alpha);
+	return interpolated.modelMatrix();
+}
+
+float SimSnapshot::lightAzimuthAt(float alpha) const
+{
+	// take the short way around when the azimuth wrapped at 360
+	float delta = lightAzimuth - previousLightAzimuth;
+	if(delta > 180.0f)
+	{
+		delta -= 360.0f;
+	}
+	if(delta < -180.0f)
+	{
+		delta += 360.0f;
+	}
+	return fmodf(previousLightAzimuth + alpha * delta + 360.0f, 360.0f);
+}
+
+Simulation::Simulation(int maxParticles)
+    : m_shipControls(0)
+    , m_animateLight(false)
+    , m_lightAzimuth(0.0f)
+    , m_previousLightAzimuth(0.0f)
+    , m_particlesPerTick(1)
+    , m_collider(nullptr)
+    , m_particleCollision(true)
+    , m_particles(maxParticles)
+    , m_random(1234)
+    , m_tick(0)
+    , m_published(nullptr)
+    , m_manual(false)
+    , m_manualTime(0.0)
+    , m_running(false)
+{
+	m_ship.position = vec3(0.0f);
+	m_ship.yaw = 0.0f;
+	m_previousShip = m_ship;
+}
+
+Simulation::~Simulation()
+{
+	stop();
+}
+
+void Simulation::setCollider(const TriangleGrid* collider)
+{
+	m_collider = collider;
+	m_particles.set_collider(m_particleCollision ? m_collider : nullptr);
+}
+
+void Simulation::start()
+{
+	if(m_running)
+	{
+		return;
+	}
+	m_startTime = std::chrono::steady_clock::now();
+	publish();
+	m_running = true;
+	m_thread = std::thread(&Simulation::run, this);
+}
+
+void Simulation::startManual()
+{
+	m_manual = true;
+	m_manualTime = 0.0;
+	publish();
+}
+
+void Simulation::advance(double seconds)
+{
+	m_manualTime += seconds;
+	while((m_tick + 1) * double(TickLength) <= m_manualTime)
+	{
+		processCommands();
+		step();
+		publish();
+	}
+}
+
+void Simulation::stop()
+{
+	if(!m_running.exchange(false))
+	{
+		return;
+	}
+	m_thread.join();
+}
+
+double Simulation::now() const
+{
+	if(m_manual)
+	{
+		return m_manualTime;
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+}
+
+void Simulation::run()
+{
+	using std::chrono::steady_clock;
+	const steady_clock::duration tickDuration =
+	    std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>(TickLength));
+	steady_clock::time_point nextTick = m_startTime + tickDuration;
+
+	while(m_running)
+	{
+		std::this_thread::sleep_until(nextTick);
+
+		processCommands();
+		step();
+		nextTick += tickDuration;
+
+		// After a long stall, e.g. a breakpoint, resume from now instead of fast forwarding
+		const steady_clock::time_point now = steady_clock::now();
+		if(now - nextTick > MaxCatchUpTicks * tickDuration)
+		{
+			nextTick = now;
+		}
+		publish();
+	}
+}
+
+void Simulation::processCommands()
+{
+	SimCommand command;
+	while(m_commands.pop(command))
+	{
+		switch(command.type)
+		{
+		case SimCommand::SetShipControls:
+			m_shipControls = command.controls;
+			break;
+		case SimCommand::SetAnimateLight:
+			m_animateLight = command.value != 0.0f;
+			break;
+		case SimCommand::SetLightAzimuth:
+			m_lightAzimuth = command.value;
+			m_previousLightAzimuth = command.value;
+			break;
+		case SimCommand::SetParticlesPerTick:
+			m_particlesPerTick = std::max(0, int(command.value));
+			break;
+		case SimCommand::SetParticleCollision:
+			m_particleCollision = command.value != 0.0f;
+			m_particles.set_collider(m_particleCollision ? m_collider : nullptr);
+			break;
+		case SimCommand::SetParticleRepulsion:
+			m_particles.set_repulsion(std::max(0.0f, command.value), ParticleRepulsionStrength);
+			break;
+		}
+	}
+}
+
+void Simulation::step()
+{
+	const float dt = TickLength;
+	m_previousShip = m_ship;
+	m_previousLightAzimuth = m_lightAzimuth;
+	m_tick++;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Ship
+	///////////////////////////////////////////////////////////////////////////
+	if(m_shipControls & ShipTurnLeft)
+	{
+		m_ship.yaw += ShipTurnSpeed * dt;
+	}
+	if(m_shipControls & ShipTurnRight)
+	{
+		m_ship.yaw -= ShipTurnSpeed * dt;
+	}
+	const mat4 shipRotation = rotate(m_ship.yaw, vec3(0, 1, 0));
+	const vec3 shipForward = vec3(shipRotation * vec4(-1, 0, 0, 0));
+	const vec3 shipUp = vec3(0, 1, 0);
+	if(m_shipControls & ShipForward)
+	{
+		m_ship.position += shipForward * ShipSpeed * dt;
+	}
+	if(m_shipControls & ShipBackward)
+	{
+		m_ship.position -= shipForward * ShipSpeed * dt;
+	}
+	if(m_shipControls & ShipUp)
+	{
+		m_ship.position += shipUp * ShipSpeed * dt;
+	}
+	if(m_shipControls & ShipDown)
+	{
+		m_ship.position -= shipUp * ShipSpeed * dt;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Light
+	///////////////////////////////////////////////////////////////////////////
+	if(m_animateLight)
+	{
+		m_lightAzimuth = fmodf(m_lightAzimuth + dt * LightRotationSpeed, 360.0f);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Thruster particles from the back of the ship
+	///////////////////////////////////////////////////////////////////////////
+	std::uniform_real_distribution<float> angle(0.0f, 2.0f * 3.14159265f);
+	std::uniform_real_distribution<float> spread(0.95f, 1.0f);
+	const vec3 exhaust = vec3(m_ship.modelMatrix() * vec4(10.0f, 1.0f, 0.0f, 1.0f));
+	for(int i = 0; i < m_particlesPerTick; i++)
+	{
+		const float theta = angle(m_random);
+		const float u = spread(m_random);
+		const vec3 direction = vec3(u, sqrt(1.f - u * u) * cosf(theta), sqrt(1.f - u * u) * sinf(theta));
+
+		Particle p;
+		p.pos = exhaust;
+		p.velocity = vec3(shipRotation * vec4(direction, 0.0f)) * 30.0f;
+		p.lifetime = 0.f;
+		p.life_length = 3.f;
+		m_particles.spawn(p);
+	}
+	// straight into the slot publish() hands out, so the particles are not copied there
+	m_particles.process_particles(m_published->particles, dt, m_snapshots.back().particles);
+}
+
+void Simulation::publish()
+{
+	SimSnapshot& snapshot = m_snapshots.back();
+	snapshot.tick = m_tick;
+	if(m_manual)
+	{
+		snapshot.time = m_tick * double(TickLength);
+	}
+	else
+	{
+		snapshot.time = m_tick == 0 ? 0.0 : now();
+	}
+	snapshot.previousShip = m_previousShip;
+	snapshot.ship = m_ship;
+	snapshot.previousLightAzimuth = m_previousLightAzimuth;
+	snapshot.lightAzimuth = m_lightAzimuth;
+	// particles were written to the slot by step()
+	snapshot.gridBuildMs = m_particles.grid_build_ms();
+	snapshot.gridQueryMs = m_particles.grid_query_ms();
+	m_published = &snapshot;
+	m_snapshots.publish();
+}
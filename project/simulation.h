@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ParticleSystem.h"
+#include "spscQueue.h"
+#include "tripleBuffer.h"
+
+enum ShipControl
+{
+	ShipForward = 1 << 0,
+	ShipBackward = 1 << 1,
+	ShipTurnLeft = 1 << 2,
+	ShipTurnRight = 1 << 3,
+	ShipUp = 1 << 4,
+	ShipDown = 1 << 5
+};
+
+/// Input sent from the render thread to the simulation
+struct SimCommand
+{
+	enum Type
+	{
+		SetShipControls, // `controls` holds the ShipControl bits currently held down
+		SetAnimateLight, // `value` != 0 enables the light animation
+		SetLightAzimuth, // `value` in degrees
+		SetParticlesPerTick, // `value` thruster particles spawned each tick
+		SetParticleCollision, // `value` != 0 makes particles bounce off the collider
+		SetParticleRepulsion // `value` radius within which particles push apart, 0 disables it
+	};
+	Type type;
+	uint32_t controls;
+	float value;
+};
+
+struct ShipState
+{
+	glm::vec3 position;
+	float yaw; // radians around the y axis
+
+	glm::mat4 modelMatrix() const;
+};
+
+/// Everything the renderer needs from one simulation tick. The previous tick
+/// is kept alongside so the renderer can interpolate between the two.
+struct SimSnapshot
+{
+	uint64_t tick;
+	double time; // simulated seconds at this tick
+	ShipState previousShip;
+	ShipState ship;
+	float previousLightAzimuth;
+	float lightAzimuth;
+	std::vector<Particle> particles;
+	float gridBuildMs; // particle neighbour grid timings of the last tick
+	float gridQueryMs;
+
+	/// Interpolation factor between the previous and current tick for render time `now`
+	float alpha(double now) const;
+	glm::mat4 shipMatrix(float alpha) const;
+	float lightAzimuthAt(float alpha) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Ship, light and particle simulation running on its own thread at a fixed
+// tick rate. Input arrives through a lock-free queue and results leave
+// through a triple buffer, so neither side ever waits for the other.
+///////////////////////////////////////////////////////////////////////////////
+class Simulation
+{
+public:
+	static constexpr int TickRate = 60;
+	static constexpr float TickLength = 1.0f / TickRate;
+
+	explicit Simulation(int maxParticles);
+	~Simulation();
+
+	/// Static geometry for particle collisions, set before starting. Must outlive the simulation.
+	void setCollider(const TriangleGrid* collider);
+
+	void start();
+	void stop();
+
+	/// Runs the simulation on the calling thread from a manual clock instead,
+	/// for reproducible replays. Use either this or start(), not both.
+	void startManual();
+	/// Advances the manual clock, running every tick that falls within it
+	void advance(double seconds);
+
+	/// Render thread: queues input for the next tick. Returns false if the queue is full.
+	bool pushCommand(const SimCommand& command) { return m_commands.push(command); }
+
+	/// Render thread: latest published state, valid until the next call
+	const SimSnapshot& latestSnapshot() { return m_snapshots.acquire(); }
+
+	/// Seconds since start(), on the clock the snapshot times refer to
+	double now() const;
+
+private:
+	void run();
+	void processCommands();
+	void step();
+	void publish();
+
+	// Simulation state, only touched by the simulation thread
+	ShipState m_ship;
+	ShipState m_previousShip;
+	uint32_t m_shipControls;
+	bool m_animateLight;
+	float m_lightAzimuth;
+	float m_previousLightAzimuth;
+	int m_particlesPerTick;
+	const TriangleGrid* m_collider;
+	bool m_particleCollision;
+	ParticleSimulation m_particles;
+	std::mt19937 m_random;
+	uint64_t m_tick;
+
+	SpscQueue<SimCommand, 256> m_commands;
+	TripleBuffer<SimSnapshot> m_snapshots;
+	// Last slot handed to the reader, whose particles the next step reads. The
+	// writer never gets it back as its next back slot, so reading it is safe.
+	const SimSnapshot* m_published;
+
+	std::chrono::steady_clock::time_point m_startTime;
+	bool m_manual;
+	double m_manualTime;
+	std::atomic<bool> m_running;
+	std::thread m_thread;
+};
@@ -0,0 +1,402 @@
+#include "spatialGrid.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include "meshCache.h"
+#include "parallelFor.h"
+
+using namespace glm;
+
+namespace
+{
+typedef std::chrono::high_resolution_clock Clock;
+
+// Fewer points per range than this are not worth another row of bucket counts
+const size_t MinRangePoints = 16384;
+// Buckets summed per task of the prefix sum
+const size_t BucketBlock = 65536;
+
+float millisecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// SpatialHashGrid
+///////////////////////////////////////////////////////////////////////////////
+SpatialHashGrid::SpatialHashGrid(float cellSize) : m_positions(nullptr), m_stride(sizeof(vec3))
+{
+	setCellSize(cellSize);
+	m_bucketStart.assign(2, 0);
+}
+
+void SpatialHashGrid::setCellSize(float cellSize)
+{
+	m_cellSize = cellSize;
+	m_inverseCellSize = 1.0f / cellSize;
+}
+
+void SpatialHashGrid::build(const vec3* positions, size_t count, size_t stride, int numRanges)
+{
+	m_positions = positions;
+	m_stride = stride;
+
+	// about two buckets per point keeps unrelated cells from sharing one
+	uint32_t numBuckets = 1024;
+	while(numBuckets < 2 * count)
+	{
+		numBuckets *= 2;
+	}
+	m_bucketStart.resize(numBuckets + 1);
+	m_bucketOfPoint.resize(count);
+	m_sortedIndices.resize(count);
+
+	// The ranges are fixed by the count alone, not by which thread runs them
+	if(numRanges <= 0)
+	{
+		numRanges = parallelThreadCount();
+	}
+	const size_t ranges = std::max<size_t>(1, std::min(size_t(numRanges), count / MinRangePoints));
+	const size_t rangeSize = (count + ranges - 1) / std::max<size_t>(1, ranges);
+	m_rangeCounts.resize(ranges * numBuckets);
+
+	// Hash and count each range into its own row
+	parallelFor(ranges, 1, [&](size_t range, size_t) {
+		uint32_t* counts = &m_rangeCounts[range * numBuckets];
+		std::fill(counts, counts + numBuckets, 0u);
+		const size_t last = std::min(count, (range + 1) * rangeSize);
+		for(size_t i = range * rangeSize; i < last; i++)
+		{
+			const uint32_t bucket = bucketOf(cellOf(position(uint32_t(i))));
+			m_bucketOfPoint[i] = bucket;
+			counts[bucket]++;
+		}
+	});
+
+	// Exclusive prefix sum over the buckets, and within a bucket over the
+	// ranges in order: first the total of each block of buckets...
+	const size_t numBlocks = (numBuckets + BucketBlock - 1) / BucketBlock;
+	m_blockTotals.resize(numBlocks);
+	parallelFor(numBuckets, BucketBlock, [&](size_t first, size_t last) {
+		uint32_t total = 0;
+		for(size_t range = 0; range < ranges; range++)
+		{
+			const uint32_t* counts = &m_rangeCounts[range * numBuckets];
+			for(size_t b = first; b < last; b++)
+			{
+				total += counts[b];
+			}
+		}
+		m_blockTotals[first / BucketBlock] = total;
+	});
+	uint32_t sum = 0;
+	for(uint32_t& total : m_blockTotals)
+	{
+		const uint32_t blockStart = sum;
+		sum += total;
+		total = blockStart;
+	}
+	// ...then the bucket starts within each block, which turns every count
+	// into the offset its range scatters to
+	parallelFor(numBuckets, BucketBlock, [&](size_t first, size_t last) {
+		uint32_t offset = m_blockTotals[first / BucketBlock];
+		for(size_t b = first; b < last; b++)
+		{
+			m_bucketStart[b] = offset;
+			for(size_t range = 0; range < ranges; range++)
+			{
+				uint32_t& slot = m_rangeCounts[range * numBuckets + b];
+				const uint32_t rangeCount = slot;
+				slot = offset;
+				offset += rangeCount;
+			}
+		}
+	});
+	m_bucketStart[numBuckets] = uint32_t(count);
+
+	// Scatter each range front to back, which keeps the points of a bucket in
+	// increasing order
+	parallelFor(ranges, 1, [&](size_t range, size_t) {
+		uint32_t* offsets = &m_rangeCounts[range * numBuckets];
+		const size_t last = std::min(count, (range + 1) * rangeSize);
+		for(size_t i = range * rangeSize; i < last; i++)
+		{
+			m_sortedIndices[offsets[m_bucketOfPoint[i]]++] = uint32_t(i);
+		}
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TriangleGrid
+///////////////////////////////////////////////////////////////////////////////
+TriangleGrid::TriangleGrid() : m_min(0.0f), m_cellSize(1.0f), m_resolution(0)
+{
+}
+
+void TriangleGrid::build(const CachedModel& model, const mat4& modelMatrix, float cellSize)
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Dequantize and transform the triangles
+	///////////////////////////////////////////////////////////////////////////
+	m_triangles.clear();
+	vec3 boundsMin(std::numeric_limits<float>::max());
+	vec3 boundsMax(-std::numeric_limits<float>::max());
+	for(uint32_t m = 0; m < model.header().numMeshes; m++)
+	{
+		const meshcache::Mesh& mesh = model.meshes()[m];
+		const vec3 meshMin(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+		const vec3 meshMax(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+		const vec3 center = 0.5f * (meshMin + meshMax);
+		const vec3 halfExtent = max(0.5f * (meshMax - meshMin), vec3(1e-6f));
+
+		const uint32_t* indices = model.indices() + mesh.firstIndex;
+		const meshcache::Vertex* vertices = model.vertices() + mesh.baseVertex;
+		for(uint32_t i = 0; i + 2 < mesh.indexCount; i += 3)
+		{
+			vec3 v[3];
+			for(int k = 0; k < 3; k++)
+			{
+				const int16_t* q = vertices[indices[i + k]].position;
+				const vec3 p = center + halfExtent * max(vec3(q[0], q[1], q[2]) / 32767.0f, vec3(-1.0f));
+				v[k] = vec3(modelMatrix * vec4(p, 1.0f));
+				boundsMin = min(boundsMin, v[k]);
+				boundsMax = max(boundsMax, v[k]);
+			}
+			Triangle triangle;
+			triangle.v0 = v[0];
+			triangle.edge1 = v[1] - v[0];
+			triangle.edge2 = v[2] - v[0];
+			const vec3 n = cross(triangle.edge1, triangle.edge2);
+			if(dot(n, n) < 1e-12f)
+			{
+				continue;
+			}
+			triangle.normal = normalize(n);
+			m_triangles.push_back(triangle);
+		}
+	}
+	if(m_triangles.empty())
+	{
+		m_resolution = ivec3(0);
+		m_cellStart.assign(1, 0);
+		m_triangleIndices.clear();
+		return;
+	}
+
+	// Grow the cells rather than allocate an unreasonable grid
+	const vec3 extent = max(boundsMax - boundsMin, vec3(1e-3f));
+	while(extent.x * extent.y * extent.z / (cellSize * cellSize * cellSize) > 8e6f)
+	{
+		cellSize *= 2.0f;
+	}
+	m_min = boundsMin;
+	m_cellSize = cellSize;
+	m_resolution = max(ivec3(ceil(extent / cellSize)), ivec3(1));
+	const int numCells = m_resolution.x * m_resolution.y * m_resolution.z;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Counting sort of (cell, triangle) pairs, a triangle goes into every cell
+	// its bounding box overlaps
+	///////////////////////////////////////////////////////////////////////////
+	m_cellStart.assign(numCells + 1, 0);
+	for(const Triangle& triangle : m_triangles)
+	{
+		ivec3 lo, hi;
+		cellRange(triangle, lo, hi);
+		for(int z = lo.z; z <= hi.z; z++)
+		{
+			for(int y = lo.y; y <= hi.y; y++)
+			{
+				for(int x = lo.x; x <= hi.x; x++)
+				{
+					m_cellStart[cellIndex(ivec3(x, y, z))]++;
+				}
+			}
+		}
+	}
+	uint32_t sum = 0;
+	for(int c = 0; c <= numCells; c++)
+	{
+		sum += m_cellStart[c];
+		m_cellStart[c] = sum;
+	}
+	m_triangleIndices.resize(sum);
+	for(size_t t = m_triangles.size(); t-- > 0;)
+	{
+		ivec3 lo, hi;
+		cellRange(m_triangles[t], lo, hi);
+		for(int z = lo.z; z <= hi.z; z++)
+		{
+			for(int y = lo.y; y <= hi.y; y++)
+			{
+				for(int x = lo.x; x <= hi.x; x++)
+				{
+					m_triangleIndices[--m_cellStart[cellIndex(ivec3(x, y, z))]] = uint32_t(t);
+				}
+			}
+		}
+	}
+}
+
+ivec3 TriangleGrid::cellOf(const vec3& p) const
+{
+	return clamp(ivec3(floor((p - m_min) / m_cellSize)), ivec3(0), m_resolution - 1);
+}
+
+void TriangleGrid::cellRange(const Triangle& triangle, ivec3& lo, ivec3& hi) const
+{
+	const vec3 v1 = triangle.v0 + triangle.edge1;
+	const vec3 v2 = triangle.v0 + triangle.edge2;
+	lo = cellOf(min(triangle.v0, min(v1, v2)));
+	hi = cellOf(max(triangle.v0, max(v1, v2)));
+}
+
+bool TriangleGrid::intersect(const vec3& from, const vec3& to, float& t, vec3& normal) const
+{
+	if(m_triangles.empty())
+	{
+		return false;
+	}
+	const vec3 lo = min(from, to);
+	const vec3 hi = max(from, to);
+	const vec3 gridMax = m_min + vec3(m_resolution) * m_cellSize;
+	if(any(lessThan(hi, m_min)) || any(greaterThan(lo, gridMax)))
+	{
+		return false;
+	}
+
+	// Möller-Trumbore against every triangle in the cells the segment's box touches.
+	// A triangle in several cells is tested more than once, which is harmless.
+	const vec3 direction = to - from;
+	const ivec3 first = cellOf(lo);
+	const ivec3 last = cellOf(hi);
+	float nearest = 1.0f;
+	bool hit = false;
+	for(int z = first.z; z <= last.z; z++)
+	{
+		for(int y = first.y; y <= last.y; y++)
+		{
+			for(int x = first.x; x <= last.x; x++)
+			{
+				const int cell = cellIndex(ivec3(x, y, z));
+				for(uint32_t i = m_cellStart[cell]; i < m_cellStart[cell + 1]; i++)
+				{
+					const Triangle& triangle = m_triangles[m_triangleIndices[i]];
+					const vec3 p = cross(direction, triangle.edge2);
+					const float det = dot(triangle.edge1, p);
+					if(std::abs(det) < 1e-12f)
+					{
+						continue;
+					}
+					const float inverseDet = 1.0f / det;
+					const vec3 s = from - triangle.v0;
+					const float u = dot(s, p) * inverseDet;
+					if(u < 0.0f || u > 1.0f)
+					{
+						continue;
+					}
+					const vec3 q = cross(s, triangle.edge1);
+					const float v = dot(direction, q) * inverseDet;
+					if(v < 0.0f || u + v > 1.0f)
+					{
+						continue;
+					}
+					const float distance = dot(triangle.edge2, q) * inverseDet;
+					if(distance >= 0.0f && distance <= nearest)
+					{
+						nearest = distance;
+						normal = triangle.normal;
+						hit = true;
+					}
+				}
+			}
+		}
+	}
+	if(hit)
+	{
+		t = nearest;
+		if(dot(normal, direction) > 0.0f)
+		{
+			normal = -normal;
+		}
+	}
+	return hit;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark
+///////////////////////////////////////////////////////////////////////////////
+void benchmarkSpatialGrid()
+{
+	printf("Spatial hash grid, %d threads, about one point per cell, query radius = cell size\n",
+	       parallelThreadCount());
+	printf("%10s %12s %12s %12s %16s %12s\n", "points", "rebuild ms", "1 range ms", "query ms", "neighbours/point",
+	       "differences");
+
+	std::mt19937 random(1);
+	const size_t counts[] = { 10000, 100000, 1000000 };
+	for(size_t count : counts)
+	{
+		const float side = std::cbrt(float(count));
+		std::uniform_real_distribution<float> coordinate(0.0f, side);
+		std::vector<vec3> points(count);
+		for(vec3& p : points)
+		{
+			p = vec3(coordinate(random), coordinate(random), coordinate(random));
+		}
+
+		SpatialHashGrid grid(1.0f);
+		grid.build(points.data(), count); // warm up the allocations
+		const int repeats = 10;
+		Clock::time_point start = Clock::now();
+		for(int r = 0; r < repeats; r++)
+		{
+			grid.build(points.data(), count);
+		}
+		const float buildMs = millisecondsSince(start) / repeats;
+
+		SpatialHashGrid serial(1.0f);
+		serial.build(points.data(), count, sizeof(vec3), 1);
+		start = Clock::now();
+		for(int r = 0; r < repeats; r++)
+		{
+			serial.build(points.data(), count, sizeof(vec3), 1);
+		}
+		const float serialMs = millisecondsSince(start) / repeats;
+
+		std::vector<uint32_t> neighbours(count);
+		start = Clock::now();
+		parallelFor(count, 4096, [&](size_t first, size_t last) {
+			for(size_t i = first; i < last; i++)
+			{
+				uint32_t n = 0;
+				grid.forEachNeighbour(points[i], 1.0f, [&](uint32_t) { n++; });
+				neighbours[i] = n;
+			}
+		});
+		const float queryMs = millisecondsSince(start);
+
+		double total = 0.0;
+		for(uint32_t n : neighbours)
+		{
+			total += n;
+		}
+
+		// Neighbours are visited in bucket order, so both grids must visit them identically
+		size_t differences = 0;
+		for(size_t i = 0; i < count; i++)
+		{
+			uint64_t a = 0, b = 0;
+			grid.forEachNeighbour(points[i], 1.0f, [&](uint32_t j) { a = a * 31 + j; });
+			serial.forEachNeighbour(points[i], 1.0f, [&](uint32_t j) { b = b * 31 + j; });
+			differences += a != b;
+		}
+		printf("%10zu %12.3f %12.3f %12.3f %16.2f %12zu\n", count, buildMs, serialMs, queryMs, total / count,
+		       differences);
+	}
+}
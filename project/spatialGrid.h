@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+class CachedModel;
+
+///////////////////////////////////////////////////////////////////////////////
+// Uniform grid over unbounded space, hashed into a power of two number of
+// buckets. It is rebuilt from scratch with a counting sort: the points are
+// counted per bucket, a prefix sum turns the counts into bucket start
+// offsets, and the point indices are scattered into one array. No cell
+// allocates anything, and a rebuild is linear in the number of points.
+//
+// The points are split into fixed ranges that are counted and scattered in
+// parallel, each into its own row of bucket counts. The prefix sum runs over
+// the rows in range order, so every range scatters into its own slice of each
+// bucket and the result does not depend on the number of ranges or threads.
+///////////////////////////////////////////////////////////////////////////////
+class SpatialHashGrid
+{
+public:
+	explicit SpatialHashGrid(float cellSize = 1.0f);
+
+	/// Sets the cell size used by the next build()
+	void setCellSize(float cellSize);
+	float cellSize() const { return m_cellSize; }
+
+	/// Bins `count` positions that are `stride` bytes apart, split into
+	/// `numRanges` ranges, 0 for one per thread. The points of a bucket always
+	/// end up in increasing order.
+	void build(const glm::vec3* positions, size_t count, size_t stride = sizeof(glm::vec3), int numRanges = 0);
+
+	/// Calls `f(index)` for every point of the last build within `radius` of `p`,
+	/// `p` itself included if it was built. `radius` must not exceed the cell size.
+	template <typename F>
+	void forEachNeighbour(const glm::vec3& p, float radius, F f) const
+	{
+		const glm::ivec3 center = cellOf(p);
+		const float radius2 = radius * radius;
+		uint32_t visited[27];
+		int numVisited = 0;
+		for(int z = -1; z <= 1; z++)
+		{
+			for(int y = -1; y <= 1; y++)
+			{
+				for(int x = -1; x <= 1; x++)
+				{
+					const uint32_t bucket = bucketOf(center + glm::ivec3(x, y, z));
+					// neighbouring cells can share a bucket, visit each once
+					bool seen = false;
+					for(int i = 0; i < numVisited; i++)
+					{
+						seen |= visited[i] == bucket;
+					}
+					if(seen)
+					{
+						continue;
+					}
+					visited[numVisited++] = bucket;
+
+					for(uint32_t i = m_bucketStart[bucket]; i < m_bucketStart[bucket + 1]; i++)
+					{
+						const uint32_t index = m_sortedIndices[i];
+						const glm::vec3 d = position(index) - p;
+						if(glm::dot(d, d) <= radius2)
+						{
+							f(index);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	size_t numPoints() const { return m_sortedIndices.size(); }
+	uint32_t numBuckets() const { return uint32_t(m_bucketStart.size()) - 1; }
+
+private:
+	glm::ivec3 cellOf(const glm::vec3& p) const { return glm::ivec3(glm::floor(p * m_inverseCellSize)); }
+	uint32_t bucketOf(const glm::ivec3& cell) const
+	{
+		return (uint32_t(cell.x) * 73856093u ^ uint32_t(cell.y) * 19349663u ^ uint32_t(cell.z) * 83492791u)
+		       & (numBuckets() - 1);
+	}
+	const glm::vec3& position(uint32_t index) const
+	{
+		return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(m_positions) + index * m_stride);
+	}
+
+	float m_cellSize;
+	float m_inverseCellSize;
+	const glm::vec3* m_positions;
+	size_t m_stride;
+	std::vector<uint32_t> m_bucketStart; // numBuckets + 1 offsets into m_sortedIndices
+	std::vector<uint32_t> m_bucketOfPoint;
+	std::vector<uint32_t> m_sortedIndices;
+	std::vector<uint32_t> m_rangeCounts; // numBuckets per range, then their scatter offsets
+	std::vector<uint32_t> m_blockTotals; // points per block of buckets, for the prefix sum
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Static triangles binned into a bounded uniform grid for collision tests.
+// Each triangle is listed in every cell its bounding box overlaps, stored
+// with the same counting sort layout as SpatialHashGrid.
+///////////////////////////////////////////////////////////////////////////////
+class TriangleGrid
+{
+public:
+	TriangleGrid();
+
+	/// Bins the triangles of `model` transformed by `modelMatrix`
+	void build(const CachedModel& model, const glm::mat4& modelMatrix, float cellSize);
+
+	/// Finds the first triangle crossed by the segment `from` -> `to`. On a hit,
+	/// `t` is the fraction of the segment before it and `normal` faces `from`.
+	bool intersect(const glm::vec3& from, const glm::vec3& to, float& t, glm::vec3& normal) const;
+
+	size_t numTriangles() const { return m_triangles.size(); }
+	size_t numReferences() const { return m_triangleIndices.size(); }
+
+private:
+	struct Triangle
+	{
+		glm::vec3 v0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+		glm::vec3 normal;
+	};
+
+	glm::ivec3 cellOf(const glm::vec3& p) const;
+	/// Cells overlapped by the bounding box of `triangle`, inclusive
+	void cellRange(const Triangle& triangle, glm::ivec3& lo, glm::ivec3& hi) const;
+	int cellIndex(const glm::ivec3& cell) const { return (cell.z * m_resolution.y + cell.y) * m_resolution.x + cell.x; }
+
+	glm::vec3 m_min;
+	float m_cellSize;
+	glm::ivec3 m_resolution;
+	std::vector<Triangle> m_triangles;
+	std::vector<uint32_t> m_cellStart; // numCells + 1 offsets into m_triangleIndices
+	std::vector<uint32_t> m_triangleIndices;
+};
+
+/// Prints rebuild and neighbour query times of SpatialHashGrid for 10k to 1M random points, and
+/// checks that the rebuild gives the same grid for one range as for one per thread
+void benchmarkSpatialGrid();
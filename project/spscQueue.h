@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+///////////////////////////////////////////////////////////////////////////////
+// Lock-free single producer, single consumer ring buffer. `Capacity` must be
+// a power of two; one slot is kept free to tell full from empty.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	SpscQueue() : m_head(0), m_tail(0) {}
+
+	/// Producer side. Returns false if the queue is full.
+	bool push(const T& item)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t next = (tail + 1) & (Capacity - 1);
+		if(next == m_head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		m_items[tail] = item;
+		m_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	/// Consumer side. Returns false if the queue is empty.
+	bool pop(T& item)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if(head == m_tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		item = m_items[head];
+		m_head.store((head + 1) & (Capacity - 1), std::memory_order_release);
+		return true;
+	}
+
+private:
+	T m_items[Capacity];
+	// Kept on separate cache lines so producer and consumer do not false share
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+};
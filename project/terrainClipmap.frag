@@ -0,0 +1,22 @@
+#version 420
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+
+in vec2 texCoord;
+in vec2 terrainTexel;
+in float terrainHeight;
+layout(location = 0) out vec4 fragmentColor;
+
+// Level 0 texels covered by the next finer grid, which is drawn instead of this one there
+uniform vec4 inner_region;
+
+void main()
+{
+	if(all(greaterThan(terrainTexel, inner_region.xy)) && all(lessThan(terrainTexel, inner_region.zw)))
+	{
+		discard;
+	}
+	fragmentColor = vec4(vec3(0.25 + 0.75 * terrainHeight), 1);
+}
@@ -0,0 +1,66 @@
+#version 420
+///////////////////////////////////////////////////////////////////////////////
+// Input vertex attributes
+///////////////////////////////////////////////////////////////////////////////
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec2 texCoordIn;
+
+///////////////////////////////////////////////////////////////////////////////
+// Input uniform variables
+///////////////////////////////////////////////////////////////////////////////
+
+uniform mat4 normalMatrix;
+uniform mat4 modelViewMatrix;
+uniform mat4 modelViewProjectionMatrix;
+
+///////////////////////////////////////////////////////////////////////////////
+// Streamed clipmap, one layer per level with tiles in toroidal slots
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 0) uniform sampler2DArray clipmap;
+uniform float clipmap_size;       // texels per side of a layer
+uniform int num_levels;
+uniform vec4 valid_region[16];    // per level, min and max in texels of that level, empty if min > max
+uniform int clipmap_level;        // level this grid is drawn for
+uniform vec2 grid_center;         // in level 0 texels
+uniform vec2 grid_half_extent;    // in level 0 texels
+uniform vec2 terrain_size;        // in level 0 texels
+uniform float texel_size;         // world units between level 0 texels
+uniform vec2 height_range;        // world height of 0 and 1
+
+///////////////////////////////////////////////////////////////////////////////
+// Output to fragment shader
+///////////////////////////////////////////////////////////////////////////////
+out vec2 texCoord;
+out vec3 viewSpacePosition;
+out vec3 viewSpaceNormal;
+out vec2 terrainTexel;
+out float terrainHeight;
+
+/// Height in [0, 1] from the finest level at or above the grid's that has `texel` resident
+float sampleHeight(vec2 texel)
+{
+	for(int level = clipmap_level; level < num_levels; level++)
+	{
+		vec2 p = texel / float(1 << level);
+		vec4 region = valid_region[level];
+		if(all(greaterThanEqual(p, region.xy)) && all(lessThanEqual(p, region.zw)))
+		{
+			// slot of a texel is its position modulo the window, which GL_REPEAT does for us
+			return textureLod(clipmap, vec3((p + 0.5) / clipmap_size, float(level)), 0.0).r;
+		}
+	}
+	return 0.0;
+}
+
+void main()
+{
+	terrainTexel = grid_center + position.xz * grid_half_extent;
+	terrainHeight = sampleHeight(terrainTexel);
+	vec2 xz = (terrainTexel - 0.5 * terrain_size) * texel_size;
+	vec4 worldPosition = vec4(xz.x, mix(height_range.x, height_range.y, terrainHeight), xz.y, 1.0);
+
+	gl_Position = modelViewProjectionMatrix * worldPosition;
+	viewSpacePosition = (modelViewMatrix * worldPosition).xyz;
+	viewSpaceNormal = normalize((normalMatrix * vec4(0.0, 1.0, 0.0, 0.0)).xyz);
+	texCoord = texCoordIn;
+}
@@ -0,0 +1,517 @@
+#include "terrainStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace glm;
+
+TerrainStreamer::TerrainStreamer() : m_running(false), m_bandwidthBytes(0)
+{
+	memset(&m_counters, 0, sizeof(m_counters));
+	m_windows.numLevels = 0;
+}
+
+TerrainStreamer::~TerrainStreamer()
+{
+	close();
+}
+
+bool TerrainStreamer::open(const std::string& path)
+{
+	close();
+	if(!m_file.open(path))
+	{
+		return false;
+	}
+	const heighttiles::Header& header = m_file.header();
+
+	const Slot empty = { { -1, 0, 0 }, false };
+	m_slots.assign(header.numLevels * WindowTiles * WindowTiles, empty);
+	m_buffers.assign(BufferedTiles, std::vector<uint16_t>(m_file.tileBytes() / sizeof(uint16_t)));
+	m_freeBuffers.clear();
+	for(int i = 0; i < BufferedTiles; i++)
+	{
+		m_freeBuffers.push_back(i);
+	}
+	m_requests.clear();
+	m_loading.clear();
+	m_loaded.clear();
+	m_windows.numLevels = 0;
+	memset(&m_counters, 0, sizeof(m_counters));
+	m_bandwidthBytes = 0;
+	m_bandwidthStart = std::chrono::steady_clock::now();
+
+	m_running = true;
+	m_thread = std::thread(&TerrainStreamer::run, this);
+	std::cout << "Streaming terrain " << path << ": " << header.width << "x" << header.height << ", "
+	          << header.numLevels << " levels of " << header.tileSize << "x" << header.tileSize << " tiles.\n";
+	return true;
+}
+
+void TerrainStreamer::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_running)
+		{
+			return;
+		}
+		m_running = false;
+	}
+	m_wake.notify_all();
+	m_thread.join();
+	m_file.close();
+}
+
+void TerrainStreamer::createTexture()
+{
+	const heighttiles::Header& header = m_file.header();
+	const int size = WindowTiles * header.tileSize;
+	m_texture = GlTexture("Terrain", GL_RESOURCE_SITE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, size, size, header.numLevels, 0, GL_RED, GL_UNSIGNED_SHORT, nullptr);
+	m_texture.setTextureSize(GL_R16, size, size, header.numLevels);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// toroidal addressing
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// whatever was tracked before has no texels yet
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(Slot& s : m_slots)
+	{
+		s.key.level = -1;
+		s.ready = false;
+	}
+}
+
+void TerrainStreamer::destroyTexture()
+{
+	m_texture.reset();
+}
+
+vec2 TerrainStreamer::worldToTexel(const vec3& position) const
+{
+	const heighttiles::Header& header = m_file.header();
+	return vec2(position.x, position.z) / header.texelSize + 0.5f * vec2(float(header.width), float(header.height));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main thread
+///////////////////////////////////////////////////////////////////////////////
+TerrainStreamer::Windows TerrainStreamer::update(const vec2& texel)
+{
+	const heighttiles::Header& header = m_file.header();
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	///////////////////////////////////////////////////////////////////////////
+	// Window of each level, the tile under the camera and three more around it
+	///////////////////////////////////////////////////////////////////////////
+	m_windows.numLevels = header.numLevels;
+	for(int level = 0; level < int(header.numLevels); level++)
+	{
+		const float tileTexels = float(header.tileSize << level);
+		const ivec2 cameraTile(int(floorf(texel.x / tileTexels)), int(floorf(texel.y / tileTexels)));
+		const ivec2 tiles(int(header.tilesX[level]), int(header.tilesY[level]));
+		// keep the window inside the terrain, where it is larger than the terrain it starts at 0
+		m_windows.origin[level] =
+		    max(min(cameraTile - ivec2(WindowTiles / 2 - 1), tiles - ivec2(WindowTiles)), ivec2(0));
+		if(level == 0)
+		{
+			m_cameraTile = cameraTile;
+		}
+	}
+
+	// Tiles read for a window the camera has left are dropped
+	for(size_t i = 0; i < m_loaded.size();)
+	{
+		if(isWanted(m_loaded[i].key, m_windows))
+		{
+			i++;
+			continue;
+		}
+		m_loading.erase(std::find(m_loading.begin(), m_loading.end(), m_loaded[i].key));
+		releaseBuffer(m_loaded[i].buffer);
+		m_loaded[i] = m_loaded.back();
+		m_loaded.pop_back();
+		m_counters.cancelledTiles++;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Requests, coarse levels first as they cover the most, then nearest first
+	///////////////////////////////////////////////////////////////////////////
+	m_requests.clear();
+	m_counters.wantedTiles = 0;
+	for(int level = 0; level < m_windows.numLevels; level++)
+	{
+		for(int y = 0; y < WindowTiles; y++)
+		{
+			for(int x = 0; x < WindowTiles; x++)
+			{
+				const TileKey key = { level, m_windows.origin[level].x + x, m_windows.origin[level].y + y };
+				if(!isWanted(key, m_windows))
+				{
+					continue;
+				}
+				m_counters.wantedTiles++;
+				if(!isResident(key) && !isLoading(key))
+				{
+					m_requests.push_back(key);
+				}
+			}
+		}
+	}
+	const vec2 cameraTexel = texel;
+	std::sort(m_requests.begin(), m_requests.end(), [&header, cameraTexel](const TileKey& a, const TileKey& b) {
+		if(a.level != b.level)
+		{
+			return a.level < b.level;
+		}
+		const float tileTexels = float(header.tileSize << a.level);
+		const vec2 da = (vec2(float(a.x), float(a.y)) + 0.5f) * tileTexels - cameraTexel;
+		const vec2 db = (vec2(float(b.x), float(b.y)) + 0.5f) * tileTexels - cameraTexel;
+		return dot(da, da) > dot(db, db);
+	});
+	m_counters.queuedTiles = int(m_requests.size());
+
+	// The renderer falls back to a coarser level wherever level 0 is missing
+	bool stalled = false;
+	for(int y = -1; y <= 1; y++)
+	{
+		for(int x = -1; x <= 1; x++)
+		{
+			const TileKey key = { 0, m_cameraTile.x + x, m_cameraTile.y + y };
+			stalled |= isWanted(key, m_windows) && !isResident(key);
+		}
+	}
+	if(stalled)
+	{
+		m_counters.stallFrames++;
+	}
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const float seconds = std::chrono::duration<float>(now - m_bandwidthStart).count();
+	if(seconds >= 1.0f)
+	{
+		m_counters.bandwidthMBs = float(m_bandwidthBytes) / seconds / 1e6f;
+		m_bandwidthBytes = 0;
+		m_bandwidthStart = now;
+	}
+
+	const Windows windows = m_windows;
+	lock.unlock();
+	m_wake.notify_one();
+	return windows;
+}
+
+void TerrainStreamer::validRegions(ValidRegion regions[heighttiles::MaxLevels])
+{
+	const heighttiles::Header& header = m_file.header();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(int level = 0; level < m_windows.numLevels; level++)
+	{
+		// Grow a square of resident tiles around the camera while it stays inside the window
+		const ivec2 origin = m_windows.origin[level];
+		const ivec2 center =
+		    clamp(ivec2(m_cameraTile.x >> level, m_cameraTile.y >> level), origin, origin + ivec2(WindowTiles - 1));
+		const ivec2 tiles(int(header.tilesX[level]), int(header.tilesY[level]));
+		auto present = [&](int x, int y) {
+			const TileKey key = { level, x, y };
+			return x < 0 || y < 0 || x >= tiles.x || y >= tiles.y || isResident(key);
+		};
+		ValidRegion& region = regions[level];
+		region.valid = present(center.x, center.y) && center.x < tiles.x && center.y < tiles.y;
+		if(!region.valid)
+		{
+			continue;
+		}
+		int radius = 0;
+		for(int r = 1; r < WindowTiles; r++)
+		{
+			if(center.x - r < origin.x || center.y - r < origin.y || center.x + r >= origin.x + WindowTiles
+			   || center.y + r >= origin.y + WindowTiles)
+			{
+				break;
+			}
+			bool complete = true;
+			for(int i = -r; i <= r && complete; i++)
+			{
+				complete = present(center.x + i, center.y - r) && present(center.x + i, center.y + r)
+				           && present(center.x - r, center.y + i) && present(center.x + r, center.y + i);
+			}
+			if(!complete)
+			{
+				break;
+			}
+			radius = r;
+		}
+		// bilinear filtering reads one texel past the sample, stay a texel inside the last one
+		const float tileSize = float(header.tileSize);
+		const vec2 levelTexels(float((header.width + (1u << level) - 1) >> level),
+		                       float((header.height + (1u << level) - 1) >> level));
+		region.min = max(vec2(center - ivec2(radius)) * tileSize, vec2(0.0f));
+		region.max = min(vec2(center + ivec2(radius + 1)) * tileSize - 1.0f, levelTexels - 1.0f);
+	}
+}
+
+TerrainStreamer::Counters TerrainStreamer::counters()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Counters counters = m_counters;
+	counters.residentTiles = 0;
+	for(const Slot& s : m_slots)
+	{
+		counters.residentTiles += s.key.level >= 0 && s.ready ? 1 : 0;
+	}
+	counters.bufferBytes = m_buffers.size() * m_file.tileBytes();
+	const size_t size = size_t(WindowTiles) * m_file.header().tileSize;
+	counters.textureBytes = m_texture != 0 ? size * size * sizeof(uint16_t) * m_file.header().numLevels : 0;
+	return counters;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GL thread
+///////////////////////////////////////////////////////////////////////////////
+int TerrainStreamer::upload(int maxTiles, const Windows& windows)
+{
+	const heighttiles::Header& header = m_file.header();
+	std::vector<LoadedTile> batch;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(size_t i = 0; i < m_loaded.size() && int(batch.size()) < maxTiles;)
+		{
+			// A tile wanted now but not by the frame being drawn waits for a later frame,
+			// its slot may still hold a tile this frame samples
+			const TileKey key = m_loaded[i].key;
+			if(!isWanted(key, windows) || !isWanted(key, m_windows))
+			{
+				i++;
+				continue;
+			}
+			// not resident under either key until the texels are in place
+			Slot& s = slot(key);
+			s.key = key;
+			s.ready = false;
+			batch.push_back(m_loaded[i]);
+			m_loaded[i] = m_loaded.back();
+			m_loaded.pop_back();
+		}
+	}
+
+	if(m_texture != 0 && !batch.empty())
+	{
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	}
+	for(const LoadedTile& tile : batch)
+	{
+		const uint16_t* heights = m_buffers[tile.buffer].data();
+		if(m_texture != 0)
+		{
+			const int slotX = ((tile.key.x % WindowTiles) + WindowTiles) % WindowTiles;
+			const int slotY = ((tile.key.y % WindowTiles) + WindowTiles) % WindowTiles;
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, slotX * header.tileSize, slotY * header.tileSize, tile.key.level,
+			                header.tileSize, header.tileSize, 1, GL_RED, GL_UNSIGNED_SHORT, heights);
+		}
+		if(m_uploadCallback)
+		{
+			m_uploadCallback(tile.key.level, tile.key.x, tile.key.y, heights);
+		}
+	}
+	if(m_texture != 0 && !batch.empty())
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	if(!batch.empty())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for(const LoadedTile& tile : batch)
+			{
+				Slot& s = slot(tile.key);
+				s.ready = s.key == tile.key;
+				m_loading.erase(std::find(m_loading.begin(), m_loading.end(), tile.key));
+				releaseBuffer(tile.buffer);
+				m_counters.tilesUploaded++;
+			}
+		}
+		m_wake.notify_one();
+	}
+	return int(batch.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Streaming thread
+///////////////////////////////////////////////////////////////////////////////
+void TerrainStreamer::run()
+{
+	const size_t tileBytes = m_file.tileBytes();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(true)
+	{
+		m_wake.wait(lock, [this]() { return !m_running || (!m_requests.empty() && !m_freeBuffers.empty()); });
+		if(!m_running)
+		{
+			break;
+		}
+		const TileKey key = m_requests.back();
+		m_requests.pop_back();
+		const int buffer = m_freeBuffers.back();
+		m_freeBuffers.pop_back();
+		m_loading.push_back(key);
+		lock.unlock();
+
+		// The copy faults the pages in, then they are handed back to the OS
+		memcpy(m_buffers[buffer].data(), m_file.tile(key.level, key.x, key.y), tileBytes);
+		m_file.release(key.level, key.x, key.y);
+
+		lock.lock();
+		m_loaded.push_back({ key, buffer });
+		m_counters.tilesRead++;
+		m_counters.bytesRead += tileBytes;
+		m_bandwidthBytes += tileBytes;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers, called with m_mutex held
+///////////////////////////////////////////////////////////////////////////////
+bool TerrainStreamer::isWanted(const TileKey& key, const Windows& windows) const
+{
+	if(key.level < 0 || key.level >= windows.numLevels)
+	{
+		return false;
+	}
+	const heighttiles::Header& header = m_file.header();
+	const ivec2 origin = windows.origin[key.level];
+	return key.x >= origin.x && key.y >= origin.y && key.x < origin.x + WindowTiles && key.y < origin.y + WindowTiles
+	       && key.x < int(header.tilesX[key.level]) && key.y < int(header.tilesY[key.level]);
+}
+
+TerrainStreamer::Slot& TerrainStreamer::slot(const TileKey& key)
+{
+	const int x = ((key.x % WindowTiles) + WindowTiles) % WindowTiles;
+	const int y = ((key.y % WindowTiles) + WindowTiles) % WindowTiles;
+	return m_slots[(key.level * WindowTiles + y) * WindowTiles + x];
+}
+
+bool TerrainStreamer::isResident(const TileKey& key)
+{
+	const Slot& s = slot(key);
+	return s.ready && s.key == key;
+}
+
+bool TerrainStreamer::isLoading(const TileKey& key) const
+{
+	return std::find(m_loading.begin(), m_loading.end(), key) != m_loading.end();
+}
+
+void TerrainStreamer::releaseBuffer(int buffer)
+{
+	m_freeBuffers.push_back(buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test
+///////////////////////////////////////////////////////////////////////////////
+int testTerrainStreaming(const std::string& path, float gigabytes)
+{
+	// level 0 alone is `gigabytes`, the coarser levels add about a third
+	const uint32_t tileSize = 256;
+	const double texels = std::sqrt(double(gigabytes) * 1024.0 * 1024.0 * 1024.0 / sizeof(uint16_t));
+	const uint32_t size = std::max(1u, uint32_t(texels / tileSize)) * tileSize;
+
+	{
+		TiledHeightFile existing;
+		const bool reuse = existing.open(path) && existing.header().width == size && existing.header().height == size
+		                   && existing.header().tileSize == tileSize;
+		existing.close();
+		if(!reuse && !heighttiles::writeProcedural(path, size, tileSize))
+		{
+			return 1;
+		}
+	}
+
+	TerrainStreamer streamer;
+	if(!streamer.open(path))
+	{
+		return 1;
+	}
+
+	// Every uploaded tile is compared with the generator on a sparse grid of texels
+	uint64_t checkedTexels = 0, mismatches = 0;
+	streamer.setUploadCallback([&](int level, int x, int y, const uint16_t* heights) {
+		const double spacing = double(1u << level);
+		for(uint32_t j = 0; j < tileSize; j += 37)
+		{
+			for(uint32_t i = 0; i < tileSize; i += 37)
+			{
+				const uint16_t expected = heighttiles::quantize(
+				    heighttiles::proceduralHeight((x * tileSize + i) * spacing, (y * tileSize + j) * spacing));
+				mismatches += heights[j * tileSize + i] != expected ? 1 : 0;
+				checkedTexels++;
+			}
+		}
+	});
+
+	// An S curve from one corner to the other in 20 seconds of 60 Hz frames
+	const int frames = 1200;
+	const int uploadsPerFrame = 8;
+	int maxResident = 0;
+	const std::chrono::steady_clock::duration frameTime = std::chrono::microseconds(16667);
+	std::chrono::steady_clock::time_point nextFrame = std::chrono::steady_clock::now();
+	for(int frame = 0; frame < frames; frame++)
+	{
+		const float t = float(frame) / (frames - 1);
+		const vec2 texel = float(size) * vec2(0.1f + 0.8f * t, 0.5f + 0.35f * sinf(t * 2.0f * 3.14159265f));
+		const TerrainStreamer::Windows windows = streamer.update(texel);
+		streamer.upload(uploadsPerFrame, windows);
+		maxResident = std::max(maxResident, streamer.counters().residentTiles);
+
+		nextFrame += frameTime;
+		std::this_thread::sleep_until(nextFrame);
+	}
+
+	const TerrainStreamer::Counters counters = streamer.counters();
+	const int residencyBound = int(streamer.header().numLevels) * TerrainStreamer::WindowTiles
+	                           * TerrainStreamer::WindowTiles;
+	char line[256];
+	snprintf(line, sizeof(line), "%d frames over %.1f km at %.0f m/s", frames,
+	         float(size) * 1.2f * streamer.header().texelSize / 1000.0f,
+	         float(size) * 1.2f * streamer.header().texelSize / (frames / 60.0f));
+	std::cout << line << "\n";
+	snprintf(line, sizeof(line), "tiles: %llu read, %llu uploaded, %llu cancelled, %d resident at most (bound %d)",
+	         (unsigned long long)counters.tilesRead, (unsigned long long)counters.tilesUploaded,
+	         (unsigned long long)counters.cancelledTiles, maxResident, residencyBound);
+	std::cout << line << "\n";
+	snprintf(line, sizeof(line), "read %.1f MiB, %.1f MB/s over the last second, %llu stalled frames",
+	         counters.bytesRead / (1024.0 * 1024.0), counters.bandwidthMBs, (unsigned long long)counters.stallFrames);
+	std::cout << line << "\n";
+	snprintf(line, sizeof(line), "tile buffers %.1f MiB, %llu texels checked, %llu mismatches",
+	         counters.bufferBytes / (1024.0 * 1024.0), (unsigned long long)checkedTexels,
+	         (unsigned long long)mismatches);
+	std::cout << line << "\n";
+#ifndef _WIN32
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+		std::cout << "peak resident memory " << usage.ru_maxrss / 1024 << " MiB\n";
+	}
+#endif
+	streamer.close();
+
+	const bool passed = mismatches == 0 && checkedTexels > 0 && maxResident <= residencyBound;
+	std::cout << (passed ? "Terrain streaming test passed" : "Terrain streaming test FAILED") << std::endl;
+	return passed ? 0 : 2;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "glResource.h"
+#include "heightTiles.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Pages the tiles of a TiledHeightFile around the camera into a clipmap: one
+// layer of a GL_R16 texture array per level, each holding a window of
+// WindowTiles x WindowTiles tiles. Tile (x, y) always lives in slot
+// (x mod WindowTiles, y mod WindowTiles), so as the camera moves only the
+// row or column of tiles entering the window is loaded, overwriting the one
+// that left (a toroidal update), and the shader samples with GL_REPEAT.
+//
+// The main thread calls update() every frame with the camera, which decides
+// the wanted tiles. A streaming thread copies them out of the file mapping,
+// which is where the disk reads and page faults happen. upload() then moves
+// finished tiles into the texture on the GL thread. CPU memory is a fixed
+// pool of tile buffers and the texture is fixed in size, whatever the size
+// of the terrain.
+///////////////////////////////////////////////////////////////////////////////
+class TerrainStreamer
+{
+public:
+	enum
+	{
+		WindowTiles = 8,
+		BufferedTiles = 32 // tiles read but not yet uploaded
+	};
+
+	/// Wanted window of every level, in tiles. Captured by update() and handed to
+	/// the upload() of the same frame, so a frame only sees tiles it asked for.
+	struct Windows
+	{
+		glm::ivec2 origin[heighttiles::MaxLevels];
+		int numLevels;
+	};
+
+	/// Region of a level the shader may sample, in texels of that level. Empty
+	/// if the tile under the camera is not resident.
+	struct ValidRegion
+	{
+		glm::vec2 min;
+		glm::vec2 max;
+		bool valid;
+	};
+
+	struct Counters
+	{
+		int residentTiles;
+		int wantedTiles;
+		int queuedTiles; // requested, not yet read
+		uint64_t tilesRead;
+		uint64_t bytesRead;
+		uint64_t tilesUploaded;
+		uint64_t cancelledTiles; // read, then left the window before they could be uploaded
+		float bandwidthMBs;      // read from the file, averaged over about a second
+		uint64_t stallFrames;    // frames where the tiles next to the camera were not all resident at level 0
+		size_t bufferBytes;
+		size_t textureBytes;
+	};
+
+	TerrainStreamer();
+	~TerrainStreamer();
+
+	/// Maps the tile file and starts the streaming thread
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const { return m_file.isOpen(); }
+	const heighttiles::Header& header() const { return m_file.header(); }
+
+	/// GL thread: creates the clipmap texture. Without it upload() only tracks residency.
+	void createTexture();
+	void destroyTexture();
+	GLuint texture() const { return m_texture; }
+
+	/// Main thread: centers the windows on `texel`, a level 0 texel position, and
+	/// queues the tiles that are missing
+	Windows update(const glm::vec2& texel);
+
+	/// GL thread: uploads up to `maxTiles` finished tiles that are wanted in `windows`
+	int upload(int maxTiles, const Windows& windows);
+
+	/// Level 0 texel position of world space `position`, the terrain is centered on the origin
+	glm::vec2 worldToTexel(const glm::vec3& position) const;
+
+	void validRegions(ValidRegion regions[heighttiles::MaxLevels]);
+	Counters counters();
+
+	/// Called on the GL thread with every tile that is uploaded, for testing
+	void setUploadCallback(const std::function<void(int level, int x, int y, const uint16_t* heights)>& callback)
+	{
+		m_uploadCallback = callback;
+	}
+
+private:
+	struct TileKey
+	{
+		int level;
+		int x;
+		int y;
+		bool operator==(const TileKey& other) const
+		{
+			return level == other.level && x == other.x && y == other.y;
+		}
+	};
+
+	struct Slot
+	{
+		TileKey key;
+		bool ready; // false while the tile is being uploaded
+	};
+
+	struct LoadedTile
+	{
+		TileKey key;
+		int buffer;
+	};
+
+	void run();
+	bool isWanted(const TileKey& key, const Windows& windows) const;
+	Slot& slot(const TileKey& key);
+	bool isResident(const TileKey& key);
+	bool isLoading(const TileKey& key) const;
+	void releaseBuffer(int buffer);
+
+	TiledHeightFile m_file;
+	GlTexture m_texture;
+	std::function<void(int, int, int, const uint16_t*)> m_uploadCallback;
+
+	// Everything below is guarded by m_mutex
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_running;
+	std::thread m_thread;
+
+	Windows m_windows;
+	glm::ivec2 m_cameraTile; // level 0
+	std::vector<Slot> m_slots; // WindowTiles^2 per level
+	std::vector<TileKey> m_requests; // most important last
+	std::vector<TileKey> m_loading;  // being read, or read and waiting for upload
+	std::vector<LoadedTile> m_loaded;
+	std::vector<std::vector<uint16_t>> m_buffers;
+	std::vector<int> m_freeBuffers;
+
+	Counters m_counters;
+	uint64_t m_bandwidthBytes;
+	std::chrono::steady_clock::time_point m_bandwidthStart;
+};
+
+/// Generates a procedural terrain of `gigabytes` at `path` unless it already
+/// exists, then flies a camera across it on a fixed path with the streamer
+/// running headless. Checks every streamed tile against the generator and
+/// prints the counters. Returns the process exit code.
+int testTerrainStreaming(const std::string& path, float gigabytes);
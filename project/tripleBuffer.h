@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+
+///////////////////////////////////////////////////////////////////////////////
+// Lock-free triple buffer between one writer and one reader. The writer fills
+// its back slot and publishes it; the reader always gets the latest published
+// slot and keeps it until the next acquire, without ever blocking the writer.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : m_middle(1), m_back(0), m_front(2) {}
+
+	/// Writer side: the slot to fill before calling publish()
+	T& back() { return m_slots[m_back]; }
+
+	/// Writer side: hands the back slot to the reader
+	void publish() { m_back = m_middle.exchange(m_back | NewData, std::memory_order_acq_rel) & IndexMask; }
+
+	/// Reader side: returns the latest published slot, which stays valid until the next call
+	const T& acquire()
+	{
+		if(m_middle.load(std::memory_order_relaxed) & NewData)
+		{
+			m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+		}
+		return m_slots[m_front];
+	}
+
+	/// Reader side: true if acquire() would return a newer slot
+	bool hasNewData() const { return (m_middle.load(std::memory_order_relaxed) & NewData) != 0; }
+
+private:
+	enum
+	{
+		IndexMask = 3,
+		NewData = 4
+	};
+
+	T m_slots[3];
+	std::atomic<int> m_middle;
+	int m_back;  // owned by the writer
+	int m_front; // owned by the reader
+};
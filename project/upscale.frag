@@ -0,0 +1,33 @@
+#version 420
+// Upscales the corner of the scene target the camera view was rendered to onto
+// the whole window. Bilinear, sharpened by its difference to the four samples
+// a source texel away, then clamped to the range of those samples so edges
+// get crisper without ringing.
+layout(binding = 0) uniform sampler2D sceneTexture;
+uniform vec2 renderSize; // texels of sceneTexture that hold the view
+uniform vec2 outputSize;
+uniform float sharpness;
+layout(location = 0) out vec4 fragmentColor;
+
+vec3 sampleScene(vec2 position)
+{
+	// Half a texel inside the rendered corner, past it are texels of earlier frames
+	position = clamp(position, vec2(0.5), renderSize - 0.5);
+	return texture(sceneTexture, position / vec2(textureSize(sceneTexture, 0))).rgb;
+}
+
+void main()
+{
+	vec2 position = gl_FragCoord.xy * renderSize / outputSize;
+	vec3 center = sampleScene(position);
+	vec3 left = sampleScene(position - vec2(1.0, 0.0));
+	vec3 right = sampleScene(position + vec2(1.0, 0.0));
+	vec3 down = sampleScene(position - vec2(0.0, 1.0));
+	vec3 up = sampleScene(position + vec2(0.0, 1.0));
+
+	vec3 blurred = 0.25 * (left + right + down + up);
+	vec3 sharpened = center + sharpness * (center - blurred);
+	vec3 low = min(center, min(min(left, right), min(down, up)));
+	vec3 high = max(center, max(max(left, right), max(down, up)));
+	fragmentColor = vec4(clamp(sharpened, low, high), 1.0);
+}